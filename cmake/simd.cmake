@@ -1,15 +1,74 @@
 include(cmake/TargetArch.cmake)
 
-function(target_enable_simd tgt)
-    if(NOT APPLE)
+# Instruction sets the kernels are built for on the target architecture.
+function(simd_isas output_var)
+    target_architecture(arch)
+    if(APPLE)
         # Broken on osx github runners for some reason
-        target_architecture(arch)
-        set(is_gcc_like "$<OR:$<COMPILE_LANG_AND_ID:CXX,AppleClang,Clang,GNU>,$<COMPILE_LANG_AND_ID:C,AppleClang,Clang,GNU>>")
-        set(is_msvc_like "$<OR:$<COMPILE_LANG_AND_ID:CXX,MSVC>,$<COMPILE_LANG_AND_ID:C,MSVC>>")
-        set(is_arch_x64 "$<STREQUAL:${arch},x86_64>")
-        target_compile_options(${tgt} PRIVATE
-            $<$<AND:${is_arch_x64},${is_gcc_like}>:-mavx2>
-            $<$<AND:${is_arch_x64},${is_msvc_like}>:/arch:AVX2>
-        )
+        set(isas scalar)
+    elseif(arch STREQUAL "x86_64")
+        set(isas scalar sse41 avx2 avx512)
+    elseif(arch STREQUAL "aarch64")
+        set(isas scalar neon)
+    else()
+        set(isas scalar)
+    endif()
+    set(${output_var} ${isas} PARENT_SCOPE)
+endfunction()
+
+# Compiles the kernel sources once per instruction set and adds the objects to
+# `tgt`. The kernels are selected at run time (see src/simcams/kernels.c), so
+# the binary runs on any cpu of the architecture.
+#
+#   target_simd_kernels(<tgt> SOURCES <src>... [LIBRARIES <lib>...])
+#
+# Each build defines SIMD_ISA=<isa>. `tgt` gets SIMD_HAVE_<ISA> for every
+# build. LIBRARIES provide the include directories the sources need.
+#
+# The builds are linked together, so the sources mustn't define inline
+# functions with external linkage. The linker would keep one build's copy for
+# all of them. See src/simcams/kernels.math.h.
+function(target_simd_kernels tgt)
+    cmake_parse_arguments(ARG "" "" "SOURCES;LIBRARIES" ${ARGN})
+    simd_isas(isas)
+    set(is_gcc_like "$<OR:$<COMPILE_LANG_AND_ID:CXX,AppleClang,Clang,GNU>,$<COMPILE_LANG_AND_ID:C,AppleClang,Clang,GNU>>")
+    set(is_msvc_like "$<OR:$<COMPILE_LANG_AND_ID:CXX,MSVC>,$<COMPILE_LANG_AND_ID:C,MSVC>>")
+
+    # The scalar build is the reference, so it isn't auto-vectorized either,
+    # except where it's the only build. MSVC has no SSE4.1 switch, so its
+    # sse41 build is baseline x64 code.
+    if(APPLE)
+        set(flags_scalar "")
+    else()
+        set(flags_scalar $<${is_gcc_like}:-fno-tree-vectorize>)
     endif()
+    set(flags_neon "")
+    set(flags_sse41 $<${is_gcc_like}:-msse4.1>)
+    set(flags_avx2
+        $<${is_gcc_like}:-mavx2>
+        $<${is_msvc_like}:/arch:AVX2>
+    )
+    set(flags_avx512
+        $<${is_gcc_like}:-mavx512f>
+        $<${is_gcc_like}:-mavx512bw>
+        $<${is_gcc_like}:-mavx512dq>
+        $<${is_gcc_like}:-mavx512vl>
+        $<${is_msvc_like}:/arch:AVX512>
+    )
+
+    foreach(isa ${isas})
+        set(obj ${tgt}-${isa})
+        add_library(${obj} OBJECT ${ARG_SOURCES})
+        target_compile_definitions(${obj} PRIVATE SIMD_ISA=${isa})
+        # No fused multiply-adds, so every build computes the same frames.
+        target_compile_options(${obj} PRIVATE
+            $<${is_gcc_like}:-ffp-contract=off>
+            ${flags_${isa}}
+        )
+        target_link_libraries(${obj} PRIVATE ${ARG_LIBRARIES})
+        target_sources(${tgt} PRIVATE $<TARGET_OBJECTS:${obj}>)
+
+        string(TOUPPER ${isa} ISA)
+        target_compile_definitions(${tgt} PRIVATE SIMD_HAVE_${ISA})
+    endforeach()
 endfunction()
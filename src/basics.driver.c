@@ -4,6 +4,7 @@
 #include "identifiers.h"
 #include "logger.h"
 
+#include "simcams/kernels.h"
 #include "simcams/simulated.camera.h"
 #include "storage/basic.storage.h"
 
@@ -38,6 +39,9 @@ basic_device_kind_to_string(enum BasicDeviceKind kind)
         CASE(BasicDevice_Camera_Random);
         CASE(BasicDevice_Camera_Sin);
         CASE(BasicDevice_Camera_Empty);
+        CASE(BasicDevice_Camera_NoisySin);
+        CASE(BasicDevice_Camera_Entropy);
+        CASE(BasicDevice_Camera_Sprites);
         CASE(BasicDevice_Storage_Raw);
         CASE(BasicDevice_Storage_Tiff);
         CASE(BasicDevice_Storage_Trash);
@@ -86,6 +90,9 @@ basic_device_describe(const struct Driver* driver,
         XXX(Camera,Random,"simulated: uniform random"),
         XXX(Camera,Sin,"simulated: radial sin"),
         XXX(Camera,Empty,"simulated: empty"),
+        XXX(Camera,NoisySin,"simulated: noisy radial sin"),
+        XXX(Camera,Entropy,"simulated: tunable entropy"),
+        XXX(Camera,Sprites,"simulated: sprites"),
         XXX(Storage,Raw,"raw"),
         XXX(Storage,Tiff,"tiff"),
         XXX(Storage,Trash,"trash"),
@@ -110,7 +117,10 @@ basic_device_open(struct Driver* driver,
     switch (device_id) {
         case BasicDevice_Camera_Random:
         case BasicDevice_Camera_Sin:
-        case BasicDevice_Camera_Empty: {
+        case BasicDevice_Camera_Empty:
+        case BasicDevice_Camera_NoisySin:
+        case BasicDevice_Camera_Entropy:
+        case BasicDevice_Camera_Sprites: {
             struct Camera* camera = 0;
             CHECK(camera = simcam_make_camera(device_id));
             *out = &camera->device;
@@ -141,7 +151,10 @@ basic_device_close(struct Driver* driver, struct Device* in)
     switch (in->identifier.device_id) {
         case BasicDevice_Camera_Random:
         case BasicDevice_Camera_Sin:
-        case BasicDevice_Camera_Empty: {
+        case BasicDevice_Camera_Empty:
+        case BasicDevice_Camera_NoisySin:
+        case BasicDevice_Camera_Entropy:
+        case BasicDevice_Camera_Sprites: {
             struct Camera* camera = containerof(in, struct Camera, device);
             return simcam_close_camera(camera);
         }
@@ -184,6 +197,7 @@ acquire_driver_init_v0(void (*reporter)(int is_error,
 {
     struct BasicsDriver* self;
     logger_set_reporter(reporter);
+    simcam_kernels_init();
     CHECK(self = (struct BasicsDriver*)malloc(sizeof(*self)));
     *self = (struct BasicsDriver){
         .driver = { .device_count = basic_device_count,
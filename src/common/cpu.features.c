@@ -0,0 +1,131 @@
+#include "cpu.features.h"
+
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) ||            \
+  defined(_M_IX86)
+#define IS_X86
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#endif
+
+#define countof(e) (sizeof(e) / sizeof(*(e)))
+
+// clang-format off
+static const char* const g_isa_names[] = {
+    [SimdIsa_Scalar] = "scalar",
+    [SimdIsa_NEON] = "neon",
+    [SimdIsa_SSE41] = "sse4.1",
+    [SimdIsa_AVX2] = "avx2",
+    [SimdIsa_AVX512] = "avx512",
+};
+// clang-format on
+
+const char*
+simd_isa_to_string(enum SimdIsa isa)
+{
+    if ((unsigned)isa >= countof(g_isa_names))
+        return "(unknown)";
+    return g_isa_names[isa];
+}
+
+int
+simd_isa_from_string(const char* str, enum SimdIsa* isa)
+{
+    for (unsigned i = 0; i < countof(g_isa_names); ++i) {
+        if (strcmp(str, g_isa_names[i]) == 0) {
+            *isa = (enum SimdIsa)i;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+#ifdef IS_X86
+static void
+cpuid(uint32_t leaf, uint32_t subleaf, uint32_t r[4])
+{
+#ifdef _MSC_VER
+    int t[4];
+    __cpuidex(t, (int)leaf, (int)subleaf);
+    memcpy(r, t, sizeof(t)); // NOLINT
+#else
+    __cpuid_count(leaf, subleaf, r[0], r[1], r[2], r[3]);
+#endif
+}
+
+/// State components the OS saves on context switches (XCR0).
+static uint64_t
+os_saved_state(void)
+{
+#ifdef _MSC_VER
+    return _xgetbv(0);
+#else
+    uint32_t lo, hi;
+    __asm__ volatile("xgetbv" : "=a"(lo), "=d"(hi) : "c"(0));
+    return ((uint64_t)hi << 32) | lo;
+#endif
+}
+
+static unsigned
+detect(void)
+{
+    unsigned out = 1u << SimdIsa_Scalar;
+    uint32_t r[4] = { 0 };
+    cpuid(0, 0, r);
+    const uint32_t max_leaf = r[0];
+    if (max_leaf < 1)
+        return out;
+
+    cpuid(1, 0, r);
+    const uint32_t ecx1 = r[2];
+    if (ecx1 & (1u << 19))
+        out |= 1u << SimdIsa_SSE41;
+
+    // AVX state has to be enabled by the OS (OSXSAVE, then XCR0).
+    const int has_osxsave = (ecx1 >> 27) & 1;
+    const int has_avx = (ecx1 >> 28) & 1;
+    if (!has_osxsave || !has_avx || max_leaf < 7)
+        return out;
+    const uint64_t xcr0 = os_saved_state();
+    cpuid(7, 0, r);
+    const uint32_t ebx7 = r[1];
+
+    // XMM and YMM
+    if ((xcr0 & 0x6) == 0x6 && (ebx7 & (1u << 5)))
+        out |= 1u << SimdIsa_AVX2;
+
+    // plus the opmask and ZMM state; then F, DQ, BW and VL
+    const uint32_t avx512 = (1u << 16) | (1u << 17) | (1u << 30) | (1u << 31);
+    if ((xcr0 & 0xe6) == 0xe6 && (ebx7 & avx512) == avx512 &&
+        (out & (1u << SimdIsa_AVX2)))
+        out |= 1u << SimdIsa_AVX512;
+    return out;
+}
+#else
+static unsigned
+detect(void)
+{
+    unsigned out = 1u << SimdIsa_Scalar;
+#if defined(__aarch64__) || defined(_M_ARM64)
+    // NEON is part of the base architecture.
+    out |= 1u << SimdIsa_NEON;
+#endif
+    return out;
+}
+#endif
+
+int
+simd_isa_is_supported(enum SimdIsa isa)
+{
+    // Thread safety: every caller computes the same value, so it doesn't
+    // matter who wins.
+    static unsigned supported = 0;
+    if (!supported)
+        supported = detect();
+    return (unsigned)isa < SimdIsaCount && ((supported >> isa) & 1);
+}
@@ -0,0 +1,37 @@
+#ifndef H_ACQUIRE_DRIVER_BASICS_CPU_FEATURES_V0
+#define H_ACQUIRE_DRIVER_BASICS_CPU_FEATURES_V0
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    /// Instruction sets that kernels are built for.
+    /// Later entries are preferred when more than one is usable.
+    enum SimdIsa
+    {
+        SimdIsa_Scalar = 0, ///< no vector instructions
+        SimdIsa_NEON,
+        SimdIsa_SSE41,
+        SimdIsa_AVX2,
+        SimdIsa_AVX512, ///< AVX-512 F, BW, DQ and VL
+        SimdIsaCount
+    };
+
+    /// @returns the lower-case name used by the `ACQUIRE_SIMD` option, like
+    /// "avx2", or "(unknown)".
+    const char* simd_isa_to_string(enum SimdIsa isa);
+
+    /// Parses a name produced by `simd_isa_to_string()`.
+    /// @returns 1 on success, 0 otherwise.
+    int simd_isa_from_string(const char* str, enum SimdIsa* isa);
+
+    /// @returns 1 if the cpu and the OS support `isa`, 0 otherwise.
+    /// The cpu is queried once.
+    int simd_isa_is_supported(enum SimdIsa isa);
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif // H_ACQUIRE_DRIVER_BASICS_CPU_FEATURES_V0
@@ -0,0 +1,132 @@
+#include "frame.copy.h"
+#include "options.h"
+#include "logger.h"
+
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <immintrin.h>
+#define HAVE_STREAMING_STORES 1
+#endif
+
+#define LOG(...) aq_logger(0, __FILE__, __LINE__, __FUNCTION__, __VA_ARGS__)
+#define LOGE(...) aq_logger(1, __FILE__, __LINE__, __FUNCTION__, __VA_ARGS__)
+#define EXPECT(e, ...)                                                         \
+    do {                                                                       \
+        if (!(e)) {                                                            \
+            LOGE(__VA_ARGS__);                                                 \
+            goto Error;                                                        \
+        }                                                                      \
+    } while (0)
+
+// Bytes moved per loop iteration: two cache lines.
+#define BLOCK (128)
+// How far ahead of the loads the source is prefetched.
+#define PREFETCH_DISTANCE (512)
+
+#define DEFAULT_THRESHOLD (8ULL << 20)
+
+void
+frame_copy_streaming(void* dst_, const void* src_, size_t nbytes)
+{
+#ifdef HAVE_STREAMING_STORES
+    uint8_t* dst = (uint8_t*)dst_;
+    const uint8_t* src = (const uint8_t*)src_;
+
+    // Streaming stores need an aligned destination.
+    const size_t head = (size_t)(-(intptr_t)dst & 15);
+    if (nbytes < head + BLOCK) {
+        memcpy(dst, src, nbytes); // NOLINT
+        return;
+    }
+    memcpy(dst, src, head); // NOLINT
+    dst += head;
+    src += head;
+    nbytes -= head;
+
+    const uint8_t* const end = src + (nbytes & ~(size_t)(BLOCK - 1));
+    for (; src < end; src += BLOCK, dst += BLOCK) {
+        _mm_prefetch((const char*)src + PREFETCH_DISTANCE, _MM_HINT_T0);
+        _mm_prefetch((const char*)src + PREFETCH_DISTANCE + 64, _MM_HINT_T0);
+        for (int i = 0; i < BLOCK / 16; ++i)
+            _mm_stream_si128((__m128i*)dst + i,
+                             _mm_loadu_si128((const __m128i*)src + i));
+    }
+    // Streaming stores are weakly ordered. Fence so the frame is complete
+    // before anyone is told about it.
+    _mm_sfence();
+    memcpy(dst, src, nbytes & (BLOCK - 1)); // NOLINT
+#else
+    memcpy(dst_, src_, nbytes); // NOLINT
+#endif
+}
+
+size_t
+frame_copy_threshold(void)
+{
+    // Races on initialization are benign: every thread computes the same value.
+    static size_t threshold = 0;
+    if (!threshold) {
+        int64_t v = DEFAULT_THRESHOLD;
+        if (options_get_int("ACQUIRE_COPY_NT_THRESHOLD", &v) && v <= 0) {
+            LOGE("ACQUIRE_COPY_NT_THRESHOLD must be positive. Using %llu.",
+                 (unsigned long long)DEFAULT_THRESHOLD);
+            v = DEFAULT_THRESHOLD;
+        }
+        threshold = (size_t)v;
+    }
+    return threshold;
+}
+
+void
+frame_copy(void* dst, const void* src, size_t nbytes)
+{
+    if (nbytes >= frame_copy_threshold())
+        frame_copy_streaming(dst, src, nbytes);
+    else
+        memcpy(dst, src, nbytes); // NOLINT
+}
+
+#ifndef NO_UNIT_TESTS
+#include "device/kit/driver.h"
+
+#include <stdlib.h>
+
+acquire_export int
+unit_test_frame_copy_streaming()
+{
+    const size_t n = 4096 + 97;
+    uint8_t* src = malloc(n + 64);
+    uint8_t* dst = malloc(n + 64);
+    EXPECT(src && dst, "Allocation failed");
+    for (size_t i = 0; i < n + 64; ++i)
+        src[i] = (uint8_t)(i * 31 + 7);
+
+    // Every alignment of source and destination, and sizes around the
+    // block and head boundaries.
+    for (size_t so = 0; so < 32; so += 3) {
+        for (size_t dof = 0; dof < 32; ++dof) {
+            for (size_t len = n - 300; len <= n; len += 37) {
+                memset(dst, 0xcd, n + 64); // NOLINT
+                frame_copy_streaming(dst + dof, src + so, len);
+                EXPECT(memcmp(dst + dof, src + so, len) == 0,
+                       "Mismatch. src offset %d, dst offset %d, length %d",
+                       (int)so,
+                       (int)dof,
+                       (int)len);
+                EXPECT(dst[dof + len] == 0xcd, "Wrote past the end");
+                EXPECT(dof == 0 || dst[dof - 1] == 0xcd,
+                       "Wrote before the start");
+            }
+        }
+    }
+    free(src);
+    free(dst);
+    return 1;
+Error:
+    free(src);
+    free(dst);
+    return 0;
+}
+#endif // NO_UNIT_TESTS
@@ -0,0 +1,33 @@
+#ifndef H_ACQUIRE_DRIVER_BASICS_FRAME_COPY_V0
+#define H_ACQUIRE_DRIVER_BASICS_FRAME_COPY_V0
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    /// Copies a frame. Copies of at least `frame_copy_threshold()` bytes use
+    /// `frame_copy_streaming()`; smaller copies use `memcpy`.
+    void frame_copy(void* dst, const void* src, size_t nbytes);
+
+    /// Copies with non-temporal (streaming) stores and prefetches the source
+    /// ahead of the loads. The destination bypasses the cache, so a large copy
+    /// doesn't evict the working sets of other threads. The data is not in
+    /// cache afterwards, so only use this when the reader comes later or runs
+    /// on another core.
+    ///
+    /// Falls back to `memcpy` where streaming stores aren't available.
+    void frame_copy_streaming(void* dst, const void* src, size_t nbytes);
+
+    /// Size in bytes from which `frame_copy()` uses streaming stores.
+    /// Read once from `ACQUIRE_COPY_NT_THRESHOLD`. Defaults to 8 MiB, above the
+    /// per-core share of the last-level cache on typical hosts.
+    size_t frame_copy_threshold(void);
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif // H_ACQUIRE_DRIVER_BASICS_FRAME_COPY_V0
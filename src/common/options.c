@@ -0,0 +1,45 @@
+#include "options.h"
+#include "logger.h"
+
+#include <stdlib.h>
+
+#define LOGE(...) aq_logger(1, __FILE__, __LINE__, __FUNCTION__, __VA_ARGS__)
+
+const char*
+options_get_string(const char* name)
+{
+    const char* value = getenv(name); // NOLINT
+    return (value && value[0]) ? value : 0;
+}
+
+int
+options_get_int(const char* name, int64_t* out)
+{
+    const char* value = options_get_string(name);
+    char* end = 0;
+    if (!value)
+        return 0;
+    const long long v = strtoll(value, &end, 0);
+    if (end == value || *end != '\0') {
+        LOGE("Ignoring %s. Expected an integer. Got: \"%s\"", name, value);
+        return 0;
+    }
+    *out = v;
+    return 1;
+}
+
+int
+options_get_double(const char* name, double* out)
+{
+    const char* value = options_get_string(name);
+    char* end = 0;
+    if (!value)
+        return 0;
+    const double v = strtod(value, &end);
+    if (end == value || *end != '\0') {
+        LOGE("Ignoring %s. Expected a number. Got: \"%s\"", name, value);
+        return 0;
+    }
+    *out = v;
+    return 1;
+}
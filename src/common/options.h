@@ -0,0 +1,33 @@
+#ifndef H_ACQUIRE_DRIVER_BASICS_OPTIONS_V0
+#define H_ACQUIRE_DRIVER_BASICS_OPTIONS_V0
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    /// Tuning knobs that don't have a home in the `CameraProperties` or
+    /// `StorageProperties` interfaces are read from environment variables.
+    /// Empty variables are treated as unset.
+
+    /// @returns the value of the variable `name` or NULL if it isn't set.
+    const char* options_get_string(const char* name);
+
+    /// Parses the variable `name` as an integer. Accepts decimal, hex (0x) or
+    /// octal (0) notation.
+    /// @returns 1 and writes `out` when the variable is set and valid,
+    ///          otherwise 0 and leaves `out` untouched.
+    int options_get_int(const char* name, int64_t* out);
+
+    /// Parses the variable `name` as a floating point number.
+    /// @returns 1 and writes `out` when the variable is set and valid,
+    ///          otherwise 0 and leaves `out` untouched.
+    int options_get_double(const char* name, double* out);
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif // H_ACQUIRE_DRIVER_BASICS_OPTIONS_V0
@@ -0,0 +1,202 @@
+#ifdef __linux__
+#define _GNU_SOURCE
+#endif
+
+#include "thread.placement.h"
+#include "options.h"
+#include "logger.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+#define LOG(...) aq_logger(0, __FILE__, __LINE__, __FUNCTION__, __VA_ARGS__)
+#define LOGE(...) aq_logger(1, __FILE__, __LINE__, __FUNCTION__, __VA_ARGS__)
+#define EXPECT(e, ...)                                                         \
+    do {                                                                       \
+        if (!(e)) {                                                            \
+            LOGE(__VA_ARGS__);                                                 \
+            goto Error;                                                        \
+        }                                                                      \
+    } while (0)
+
+#define countof(e) (sizeof(e) / sizeof(*(e)))
+
+static void
+set_cpu(struct ThreadPlacement* self, unsigned cpu)
+{
+    self->cpus[cpu / 64] |= 1ULL << (cpu % 64);
+}
+
+static int
+has_cpu(const struct ThreadPlacement* self, unsigned cpu)
+{
+    return (self->cpus[cpu / 64] >> (cpu % 64)) & 1;
+}
+
+int
+thread_placement_parse_cpus(struct ThreadPlacement* self, const char* cpus)
+{
+    const char* p = cpus;
+    memset(self->cpus, 0, sizeof(self->cpus)); // NOLINT
+    self->has_cpus = 0;
+    while (*p) {
+        char* end = 0;
+        unsigned long beg = strtoul(p, &end, 10);
+        unsigned long last = beg;
+        EXPECT(end != p, "Expected a cpu id at \"%s\"", p);
+        p = end;
+        if (*p == '-') {
+            ++p;
+            last = strtoul(p, &end, 10);
+            EXPECT(end != p, "Expected a cpu id at \"%s\"", p);
+            p = end;
+        }
+        EXPECT(beg <= last && last < THREAD_PLACEMENT_MAX_CPUS,
+               "Invalid cpu range %lu-%lu",
+               beg,
+               last);
+        for (unsigned long i = beg; i <= last; ++i)
+            set_cpu(self, (unsigned)i);
+        if (*p == ',')
+            ++p;
+        else
+            EXPECT(*p == '\0', "Unexpected character '%c' in cpu list", *p);
+    }
+    for (size_t i = 0; i < countof(self->cpus); ++i)
+        self->has_cpus |= (self->cpus[i] != 0);
+    return self->has_cpus;
+Error:
+    memset(self->cpus, 0, sizeof(self->cpus)); // NOLINT
+    self->has_cpus = 0;
+    return 0;
+}
+
+void
+thread_placement_from_options(struct ThreadPlacement* self, const char* prefix)
+{
+    char name[128] = { 0 };
+    const char* value = 0;
+    int64_t priority = 1;
+
+    memset(self, 0, sizeof(*self)); // NOLINT
+
+    snprintf(name, sizeof(name) - 1, "%s_CPUS", prefix);
+    if ((value = options_get_string(name)) &&
+        !thread_placement_parse_cpus(self, value))
+        LOGE("Ignoring %s=\"%s\"", name, value);
+
+    snprintf(name, sizeof(name) - 1, "%s_SCHED", prefix);
+    if ((value = options_get_string(name))) {
+        if (strcmp(value, "fifo") == 0)
+            self->policy = ThreadScheduling_Fifo;
+        else if (strcmp(value, "rr") == 0)
+            self->policy = ThreadScheduling_RoundRobin;
+        else if (strcmp(value, "other") != 0)
+            LOGE("Ignoring %s=\"%s\". Expected one of: other, fifo, rr.",
+                 name,
+                 value);
+    }
+
+    snprintf(name, sizeof(name) - 1, "%s_PRIORITY", prefix);
+    options_get_int(name, &priority);
+    self->priority = (int)priority;
+}
+
+#if defined(_WIN32)
+
+int
+thread_placement_apply(const struct ThreadPlacement* self)
+{
+    int ok = 1;
+    if (self->has_cpus) {
+        // Only the first processor group is addressable this way.
+        DWORD_PTR mask = (DWORD_PTR)self->cpus[0];
+        if (!mask || !SetThreadAffinityMask(GetCurrentThread(), mask)) {
+            LOGE("Failed to set thread affinity. Error: %lu", GetLastError());
+            ok = 0;
+        }
+    }
+    if (self->policy != ThreadScheduling_Default &&
+        !SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_TIME_CRITICAL)) {
+        LOGE("Failed to set thread priority. Error: %lu", GetLastError());
+        ok = 0;
+    }
+    return ok;
+}
+
+#else
+
+int
+thread_placement_apply(const struct ThreadPlacement* self)
+{
+    int ok = 1;
+    if (self->has_cpus) {
+#if defined(__linux__)
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        for (unsigned i = 0; i < THREAD_PLACEMENT_MAX_CPUS && i < CPU_SETSIZE;
+             ++i)
+            if (has_cpu(self, i))
+                CPU_SET(i, &set);
+        int ecode = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+        if (ecode) {
+            LOGE("Failed to set thread affinity: %s", strerror(ecode));
+            ok = 0;
+        }
+#else
+        (void)has_cpu;
+        LOGE("Thread affinity is not supported on this platform.");
+        ok = 0;
+#endif
+    }
+    if (self->policy != ThreadScheduling_Default) {
+        const int policy =
+          (self->policy == ThreadScheduling_Fifo) ? SCHED_FIFO : SCHED_RR;
+        const int lo = sched_get_priority_min(policy);
+        const int hi = sched_get_priority_max(policy);
+        struct sched_param param = {
+            .sched_priority = self->priority < lo   ? lo
+                              : self->priority > hi ? hi
+                                                    : self->priority,
+        };
+        int ecode = pthread_setschedparam(pthread_self(), policy, &param);
+        if (ecode) {
+            LOGE("Failed to set real-time scheduling (priority %d): %s",
+                 param.sched_priority,
+                 strerror(ecode));
+            ok = 0;
+        }
+    }
+    return ok;
+}
+
+#endif
+
+#ifndef NO_UNIT_TESTS
+#include "device/kit/driver.h"
+
+acquire_export int
+unit_test_thread_placement_parse_cpus()
+{
+    struct ThreadPlacement p = { 0 };
+    EXPECT(thread_placement_parse_cpus(&p, "0-2,5,64"), "parse failed");
+    EXPECT(p.cpus[0] == 0x27 && p.cpus[1] == 1, "wrong cpu set");
+    EXPECT(!thread_placement_parse_cpus(&p, "3-1"), "accepted bad range");
+    EXPECT(!thread_placement_parse_cpus(&p, "1;2"), "accepted bad separator");
+    EXPECT(!thread_placement_parse_cpus(&p, "4096"), "accepted bad cpu id");
+    EXPECT(!p.has_cpus, "expected an empty set after a failed parse");
+    return 1;
+Error:
+    return 0;
+}
+#endif // NO_UNIT_TESTS
@@ -0,0 +1,54 @@
+#ifndef H_ACQUIRE_DRIVER_BASICS_THREAD_PLACEMENT_V0
+#define H_ACQUIRE_DRIVER_BASICS_THREAD_PLACEMENT_V0
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#define THREAD_PLACEMENT_MAX_CPUS (1024)
+
+    enum ThreadSchedulingPolicy
+    {
+        ThreadScheduling_Default = 0,
+        ThreadScheduling_Fifo,
+        ThreadScheduling_RoundRobin,
+    };
+
+    /// Where and how a worker thread should run.
+    /// The zero-initialized value means "leave it up to the OS".
+    struct ThreadPlacement
+    {
+        uint64_t cpus[THREAD_PLACEMENT_MAX_CPUS / 64]; ///< bitset of cpu ids
+        int has_cpus;
+        enum ThreadSchedulingPolicy policy;
+        int priority; ///< only used for the real-time policies
+    };
+
+    /// Reads the placement from the environment variables
+    /// `<prefix>_CPUS`     a cpu list like "0-3,8,10-11"
+    /// `<prefix>_SCHED`    one of "other", "fifo" or "rr"
+    /// `<prefix>_PRIORITY` real-time priority, defaults to 1.
+    ///
+    /// Invalid values are logged and ignored.
+    void thread_placement_from_options(struct ThreadPlacement* self,
+                                       const char* prefix);
+
+    /// Parses a cpu list like "0-3,8,10-11" into the cpu set of `self`.
+    /// @returns 1 on success, 0 otherwise.
+    int thread_placement_parse_cpus(struct ThreadPlacement* self,
+                                    const char* cpus);
+
+    /// Pins the calling thread and requests the scheduling class.
+    /// Failures (e.g. insufficient privileges for real-time scheduling) are
+    /// logged but are not fatal.
+    /// @returns 1 if everything that was requested was applied, 0 otherwise.
+    int thread_placement_apply(const struct ThreadPlacement* self);
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif // H_ACQUIRE_DRIVER_BASICS_THREAD_PLACEMENT_V0
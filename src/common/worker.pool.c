@@ -0,0 +1,201 @@
+#include "worker.pool.h"
+#include "thread.placement.h"
+#include "platform.h"
+#include "logger.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define LOG(...) aq_logger(0, __FILE__, __LINE__, __FUNCTION__, __VA_ARGS__)
+#define LOGE(...) aq_logger(1, __FILE__, __LINE__, __FUNCTION__, __VA_ARGS__)
+#define EXPECT(e, ...)                                                         \
+    do {                                                                       \
+        if (!(e)) {                                                            \
+            LOGE(__VA_ARGS__);                                                 \
+            goto Error;                                                        \
+        }                                                                      \
+    } while (0)
+#define CHECK(e) EXPECT(e, "Expression evaluated as false:\n\t%s", #e)
+
+struct WorkerPool
+{
+    struct lock lock;
+    struct condition_variable work_ready; ///< a job was posted or shutdown
+    struct condition_variable work_done;  ///< the job finished or was taken
+
+    struct
+    {
+        void (*fn)(void* ctx, size_t i); ///< NULL when idle
+        void* ctx;
+        size_t n;
+        size_t next;      ///< next item to hand out
+        size_t remaining; ///< items not yet finished
+    } job;
+
+    int is_running;
+    struct ThreadPlacement placement;
+    int has_placement;
+
+    unsigned nthreads;
+    struct thread* threads;
+};
+
+/// Runs items of the current job until there are none left to hand out.
+/// Called with the lock held; returns with the lock held.
+static void
+work(struct WorkerPool* self)
+{
+    while (self->job.fn && self->job.next < self->job.n) {
+        const size_t i = self->job.next++;
+        void (*const fn)(void*, size_t) = self->job.fn;
+        void* const ctx = self->job.ctx;
+        lock_release(&self->lock);
+        fn(ctx, i);
+        lock_acquire(&self->lock);
+        if (--self->job.remaining == 0)
+            condition_variable_notify_all(&self->work_done);
+    }
+}
+
+static void
+worker_thread(struct WorkerPool* self)
+{
+    if (self->has_placement)
+        thread_placement_apply(&self->placement);
+
+    lock_acquire(&self->lock);
+    while (self->is_running) {
+        work(self);
+        if (self->is_running)
+            condition_variable_wait(&self->work_ready, &self->lock);
+    }
+    lock_release(&self->lock);
+}
+
+struct WorkerPool*
+worker_pool_create(unsigned nthreads, const struct ThreadPlacement* placement)
+{
+    struct WorkerPool* self = 0;
+    CHECK(self = malloc(sizeof(*self)));
+    memset(self, 0, sizeof(*self)); // NOLINT
+    lock_init(&self->lock);
+    condition_variable_init(&self->work_ready);
+    condition_variable_init(&self->work_done);
+    if (placement) {
+        self->placement = *placement;
+        self->has_placement = 1;
+    }
+    self->is_running = 1;
+    if (nthreads) {
+        CHECK(self->threads = malloc(nthreads * sizeof(*self->threads)));
+        for (unsigned i = 0; i < nthreads; ++i) {
+            thread_init(self->threads + i);
+            EXPECT(thread_create(self->threads + i,
+                                 (void (*)(void*))worker_thread,
+                                 self),
+                   "Failed to start worker %u of %u.",
+                   i,
+                   nthreads);
+            ++self->nthreads;
+        }
+    }
+    return self;
+Error:
+    worker_pool_destroy(self);
+    return 0;
+}
+
+void
+worker_pool_destroy(struct WorkerPool* self)
+{
+    if (!self)
+        return;
+    lock_acquire(&self->lock);
+    self->is_running = 0;
+    condition_variable_notify_all(&self->work_ready);
+    lock_release(&self->lock);
+    for (unsigned i = 0; i < self->nthreads; ++i)
+        thread_join(self->threads + i);
+    free(self->threads);
+    lock_deinit(&self->lock);
+    free(self);
+}
+
+void
+worker_pool_parallel_for(struct WorkerPool* self,
+                         size_t n,
+                         void (*fn)(void* ctx, size_t i),
+                         void* ctx)
+{
+    if (!self || !self->nthreads || n < 2) {
+        for (size_t i = 0; i < n; ++i)
+            fn(ctx, i);
+        return;
+    }
+
+    lock_acquire(&self->lock);
+    while (self->job.fn) // another caller's job is in flight
+        condition_variable_wait(&self->work_done, &self->lock);
+    self->job.fn = fn;
+    self->job.ctx = ctx;
+    self->job.n = n;
+    self->job.next = 0;
+    self->job.remaining = n;
+    condition_variable_notify_all(&self->work_ready);
+
+    work(self);
+    while (self->job.remaining)
+        condition_variable_wait(&self->work_done, &self->lock);
+    self->job.fn = 0;
+    // Wake callers waiting to post their own job.
+    condition_variable_notify_all(&self->work_done);
+    lock_release(&self->lock);
+}
+
+#ifndef NO_UNIT_TESTS
+#include "device/kit/driver.h"
+
+struct test_accumulator
+{
+    struct lock lock;
+    size_t sum;
+};
+
+static void
+add_index(void* ctx, size_t i)
+{
+    struct test_accumulator* acc = ctx;
+    lock_acquire(&acc->lock);
+    acc->sum += i + 1;
+    lock_release(&acc->lock);
+}
+
+acquire_export int
+unit_test_worker_pool()
+{
+    struct test_accumulator acc = { 0 };
+    struct WorkerPool* pool = 0;
+    lock_init(&acc.lock);
+
+    CHECK(pool = worker_pool_create(3, 0));
+    for (int rep = 0; rep < 100; ++rep) {
+        acc.sum = 0;
+        worker_pool_parallel_for(pool, 1000, add_index, &acc);
+        EXPECT(acc.sum == 1000 * 1001 / 2,
+               "Wrong sum: %llu",
+               (unsigned long long)acc.sum);
+    }
+    worker_pool_destroy(pool);
+    pool = 0;
+
+    // No pool runs inline.
+    acc.sum = 0;
+    worker_pool_parallel_for(0, 10, add_index, &acc);
+    EXPECT(acc.sum == 55, "Wrong sum: %llu", (unsigned long long)acc.sum);
+    lock_deinit(&acc.lock);
+    return 1;
+Error:
+    worker_pool_destroy(pool);
+    return 0;
+}
+#endif // NO_UNIT_TESTS
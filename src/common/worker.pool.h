@@ -0,0 +1,42 @@
+#ifndef H_ACQUIRE_DRIVER_BASICS_WORKER_POOL_V0
+#define H_ACQUIRE_DRIVER_BASICS_WORKER_POOL_V0
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    struct ThreadPlacement;
+
+    /// A fixed set of threads that run data-parallel loops.
+    struct WorkerPool;
+
+    /// Starts `nthreads` worker threads. With a `placement`, each worker
+    /// applies it when it starts.
+    /// @returns NULL on failure.
+    struct WorkerPool* worker_pool_create(
+      unsigned nthreads,
+      const struct ThreadPlacement* placement);
+
+    /// Stops and joins the workers. Accepts NULL.
+    void worker_pool_destroy(struct WorkerPool* self);
+
+    /// Calls `fn(ctx, i)` for every `i` in [0,n) and returns when all calls
+    /// are done. The calling thread works too, so a NULL pool or a pool of
+    /// 0 threads runs the loop inline. Items are handed out one at a time, so
+    /// make each one big enough to amortize that (a few tens of
+    /// microseconds).
+    ///
+    /// Concurrent calls on the same pool are run one after the other.
+    void worker_pool_parallel_for(struct WorkerPool* self,
+                                  size_t n,
+                                  void (*fn)(void* ctx, size_t i),
+                                  void* ctx);
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif // H_ACQUIRE_DRIVER_BASICS_WORKER_POOL_V0
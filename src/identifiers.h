@@ -11,6 +11,9 @@ extern "C"
         BasicDevice_Camera_Random,
         BasicDevice_Camera_Sin,
         BasicDevice_Camera_Empty,
+        BasicDevice_Camera_NoisySin,
+        BasicDevice_Camera_Entropy,
+        BasicDevice_Camera_Sprites,
         BasicDevice_Storage_Raw,
         BasicDevice_Storage_Tiff,
         BasicDevice_Storage_Trash,
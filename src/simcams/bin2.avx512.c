@@ -0,0 +1,73 @@
+#ifdef __AVX512BW__
+#include <immintrin.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/// Mask selecting the first `n` of 64 byte lanes.
+static __mmask64
+bin2_tail_mask(int n)
+{
+    if (n <= 0)
+        return 0;
+    return n >= 64 ? ~(__mmask64)0 : (((__mmask64)1 << n) - 1);
+}
+
+static void
+bin2(uint8_t* im_, int w, int h)
+{
+    const __m512i ones = _mm512_set1_epi8(1);
+    const __m512i two = _mm512_set1_epi16(2);
+    const __m512i order = _mm512_setr_epi64(0, 2, 4, 6, 1, 3, 5, 7);
+    const int ow = w / 2;
+
+    for (int y = 0; y < h / 2; ++y) {
+        const uint8_t* const a = im_ + (size_t)2 * y * w;
+        const uint8_t* const b = a + w;
+        uint8_t* const out = im_ + (size_t)y * ow;
+        for (int x = 0; x < ow; x += 64) {
+            const int n = ow - x; // outputs left in the row
+            const __mmask64 m0 = bin2_tail_mask(2 * n);
+            const __mmask64 m1 = bin2_tail_mask(2 * n - 64);
+            const uint8_t* const pa = a + 2 * x;
+            const uint8_t* const pb = b + 2 * x;
+
+            __m512i s0 = _mm512_add_epi16(
+              _mm512_maddubs_epi16(_mm512_maskz_loadu_epi8(m0, pa), ones),
+              _mm512_maddubs_epi16(_mm512_maskz_loadu_epi8(m0, pb), ones));
+            __m512i s1 = _mm512_add_epi16(
+              _mm512_maddubs_epi16(_mm512_maskz_loadu_epi8(m1, pa + 64), ones),
+              _mm512_maddubs_epi16(_mm512_maskz_loadu_epi8(m1, pb + 64), ones));
+            s0 = _mm512_srli_epi16(_mm512_add_epi16(s0, two), 2);
+            s1 = _mm512_srli_epi16(_mm512_add_epi16(s1, two), 2);
+
+            const __m512i v =
+              _mm512_permutexvar_epi64(order, _mm512_packus_epi16(s0, s1));
+            _mm512_mask_storeu_epi8(out + x, bin2_tail_mask(n), v);
+        }
+    }
+}
+#endif
+
+/*
+AVX-512BW 2x2 averaging of an image with size (w,h), in place.
+
+Unlike the AVX2 version this works on one output row at a time and rounds
+like bin2.plain.c, `(a + b + c + d + 2) >> 2`. Any width works: row tails
+use masked loads and stores.
+
+Each step makes 64 output pixels from 128 bytes of each of the two input
+rows:
+
+1. `maddubs` against a vector of ones adds horizontal pairs of bytes into
+   16-bit lanes. Doing that for both rows and adding gives the 2x2 sums.
+2. The sums are rounded and packed back to bytes with `packus`. The pack
+   interleaves its two sources in 64-bit chunks per 128-bit lane:
+
+        [s0(0) s1(0) s0(1) s1(1) s0(2) s1(2) s0(3) s1(3)]
+
+   and the final 64-bit permutation puts the chunks back in order.
+
+Reads run ahead of writes, both within a step (all loads happen before the
+store) and across steps (output x trails input 2x), so this can run in
+place.
+*/
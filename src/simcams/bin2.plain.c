@@ -1,31 +1,18 @@
+#include <stddef.h>
 #include <stdint.h>
-#include <string.h>
 
 static void
 bin2(uint8_t* im_, int w, int h)
 {
-    const uint8_t* end = im_ + w * h;
-
-    // horizontal
-    for (uint8_t* row = im_; row < end; row += w) {
-        const uint8_t* row_end = im_ + w;
-        for (uint8_t* p = row; p < row_end; p += 2) {
-            p[0] = (uint8_t)(0.5f * p[0] + 0.5f * p[1]);
-        }
-        for (uint8_t *p = row, *s = row; s < row_end; ++p, s += 2) {
-            *p = *s;
-        }
-    }
-
-    // vertical
-    for (uint8_t* row = im_ + w; row < end; row += 2 * w) {
-        const uint8_t* row_end = im_ + 2 * w;
-        for (uint8_t* p = row; p < row_end; ++p) {
-            p[-w] = (uint8_t)(0.5f * p[-w] + 0.5f * p[0]);
-        }
-    }
-    for (uint8_t *src_row = im_, *dst_row = im_; src_row < end;
-         src_row += 2 * w, dst_row += w) {
-        memcpy(dst_row, src_row, w);
+    // Writes to output row y trail the reads from input rows 2y and 2y+1, so
+    // this can run in place.
+    for (int y = 0; y < h / 2; ++y) {
+        const uint8_t* const a = im_ + (size_t)2 * y * w;
+        const uint8_t* const b = a + w;
+        uint8_t* const out = im_ + (size_t)y * (w / 2);
+        for (int x = 0; x < w / 2; ++x)
+            out[x] = (uint8_t)((a[2 * x] + a[2 * x + 1] + b[2 * x] +
+                                b[2 * x + 1] + 2) >>
+                               2);
     }
 }
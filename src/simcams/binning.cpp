@@ -0,0 +1,217 @@
+#include "kernels.h"
+#include "kernels.math.h"
+
+#include <cstdint>
+#include <limits>
+#include <type_traits>
+
+#ifdef __AVX512BW__
+#include <immintrin.h>
+#endif
+
+#if defined(__AVX512BW__)
+#include "bin2.avx512.c"
+#elif defined(__AVX2__)
+#include "bin2.avx2.c"
+#else
+#include "bin2.plain.c"
+#endif
+
+namespace {
+/// Averages `factor` x `factor` blocks of a `w` by `h` image in place.
+///
+/// Same contract as `bin2()`: the input rows are contiguous and the result is
+/// left at the start of the buffer as a contiguous `w/factor` by `h/factor`
+/// image. Each output row is accumulated in a small buffer before it is
+/// written, and writes always trail the rows still to be read, so no second
+/// image-sized buffer is needed.
+constexpr int chunk = 256; // output pixels accumulated at a time
+
+template<typename T>
+T
+round_to(float v)
+{
+    if constexpr (std::is_floating_point_v<T>) {
+        return (T)v;
+    } else {
+        constexpr float lo = (float)std::numeric_limits<T>::min();
+        constexpr float hi = (float)std::numeric_limits<T>::max();
+        return (T)kernel_floor(kernel_clamp(v, lo, hi) + 0.5f);
+    }
+}
+
+#ifdef __AVX512BW__
+/// Mask selecting the first `n` of 16 lanes.
+__mmask16
+tail_mask(int n)
+{
+    return n >= 16 ? (__mmask16)0xffff : (__mmask16)((1u << n) - 1);
+}
+
+/// Loads the first `n` of 16 pixels at `p`, widened to f32. The other lanes
+/// are 0.
+template<typename T>
+__m512
+load16(const T* p, int n)
+{
+    const __mmask16 m = tail_mask(n);
+    if constexpr (std::is_same_v<T, int8_t>)
+        return _mm512_cvtepi32_ps(
+          _mm512_cvtepi8_epi32(_mm_maskz_loadu_epi8(m, p)));
+    else if constexpr (std::is_same_v<T, uint16_t>)
+        return _mm512_cvtepi32_ps(
+          _mm512_cvtepu16_epi32(_mm256_maskz_loadu_epi16(m, p)));
+    else if constexpr (std::is_same_v<T, int16_t>)
+        return _mm512_cvtepi32_ps(
+          _mm512_cvtepi16_epi32(_mm256_maskz_loadu_epi16(m, p)));
+    else if constexpr (std::is_same_v<T, float>)
+        return _mm512_maskz_loadu_ps(m, p);
+    else
+        return _mm512_cvtepi32_ps(
+          _mm512_cvtepu8_epi32(_mm_maskz_loadu_epi8(m, p)));
+}
+
+/// Rounds like `round_to()` and stores the first `n` of 16 pixels at `p`.
+template<typename T>
+void
+store16(T* p, int n, __m512 v)
+{
+    const __mmask16 m = tail_mask(n);
+    if constexpr (std::is_floating_point_v<T>) {
+        _mm512_mask_storeu_ps(p, m, v);
+    } else {
+        constexpr float lo = (float)std::numeric_limits<T>::min();
+        constexpr float hi = (float)std::numeric_limits<T>::max();
+        v = _mm512_min_ps(_mm512_max_ps(v, _mm512_set1_ps(lo)),
+                          _mm512_set1_ps(hi));
+        v = _mm512_roundscale_ps(_mm512_add_ps(v, _mm512_set1_ps(0.5f)),
+                                 _MM_FROUND_TO_NEG_INF | _MM_FROUND_NO_EXC);
+        const __m512i i = _mm512_cvttps_epi32(v);
+        if constexpr (sizeof(T) == 1)
+            _mm512_mask_cvtepi32_storeu_epi8(p, m, i);
+        else
+            _mm512_mask_cvtepi32_storeu_epi16(p, m, i);
+    }
+}
+
+/// AVX-512 version of `bin()`. For each chunk of an output row, the `factor`
+/// input rows are first summed into `acc`, 16 lanes at a time. Then adjacent
+/// pairs are added, halving the row, until each sum covers `factor` columns.
+/// Row tails use masked loads and stores.
+///
+/// Integer pixels sum exactly in f32, so this matches `bin()` exactly except
+/// for f32 pixels, which are summed in a different order.
+template<typename T>
+void
+bin_avx512(T* im, int w, int h, int factor)
+{
+    const int ow = w / factor, oh = h / factor;
+    const __m512 norm = _mm512_set1_ps(1.0f / (float)(factor * factor));
+    const __m512i even = _mm512_setr_epi32(
+      0, 2, 4, 6, 8, 10, 12, 14, 16, 18, 20, 22, 24, 26, 28, 30);
+    const __m512i odd = _mm512_setr_epi32(
+      1, 3, 5, 7, 9, 11, 13, 15, 17, 19, 21, 23, 25, 27, 29, 31);
+    // Pairs are added 32 lanes at a time, so leave room to read past the end.
+    alignas(64) float acc[chunk * 8 + 32];
+
+    for (int oy = 0; oy < oh; ++oy) {
+        T* const out = im + (size_t)oy * ow;
+        for (int ox0 = 0; ox0 < ow; ox0 += chunk) {
+            const int n = kernel_min(chunk, ow - ox0);
+            const int span = n * factor;
+            const T* const first =
+              im + (size_t)oy * factor * w + (size_t)ox0 * factor;
+            int x = 0;
+            for (; x < span; x += 16) {
+                __m512 v = _mm512_setzero_ps();
+                for (int k = 0; k < factor; ++k)
+                    v = _mm512_add_ps(
+                      v, load16(first + (size_t)k * w + x, span - x));
+                _mm512_store_ps(acc + x, v);
+            }
+            _mm512_store_ps(acc + x, _mm512_setzero_ps());
+
+            for (int len = span; len > n; len /= 2) {
+                for (int i = 0; 2 * i < len; i += 16) {
+                    const __m512 a = _mm512_load_ps(acc + 2 * i);
+                    const __m512 b = _mm512_load_ps(acc + 2 * i + 16);
+                    _mm512_store_ps(
+                      acc + i,
+                      _mm512_add_ps(_mm512_permutex2var_ps(a, even, b),
+                                    _mm512_permutex2var_ps(a, odd, b)));
+                }
+            }
+
+            for (int i = 0; i < n; i += 16)
+                store16(out + ox0 + i,
+                        n - i,
+                        _mm512_mul_ps(_mm512_load_ps(acc + i), norm));
+        }
+    }
+}
+#endif
+
+template<typename T>
+void
+bin(T* im, int w, int h, int factor)
+{
+#ifdef __AVX512BW__
+    if (factor <= 8) {
+        bin_avx512(im, w, h, factor);
+        return;
+    }
+#endif
+    const int ow = w / factor, oh = h / factor;
+    const float norm = 1.0f / (float)(factor * factor);
+    float acc[chunk];
+    for (int oy = 0; oy < oh; ++oy) {
+        T* const out = im + (size_t)oy * ow;
+        for (int ox0 = 0; ox0 < ow; ox0 += chunk) {
+            const int n = kernel_min(chunk, ow - ox0);
+            for (int i = 0; i < n; ++i)
+                acc[i] = 0.0f;
+            for (int k = 0; k < factor; ++k) {
+                const T* const row =
+                  im + (size_t)(oy * factor + k) * w + (size_t)ox0 * factor;
+                for (int i = 0; i < n; ++i)
+                    for (int j = 0; j < factor; ++j)
+                        acc[i] += (float)row[i * factor + j];
+            }
+            for (int i = 0; i < n; ++i)
+                out[ox0 + i] = round_to<T>(acc[i] * norm);
+        }
+    }
+}
+} // end namespace ::{anonymous}
+
+extern "C"
+{
+    void SIMD_NAME(bin_u8)(void* im, int w, int h, int factor)
+    {
+        for (int b = factor >> 1; b; b >>= 1) {
+            bin2((uint8_t*)im, w, h);
+            w >>= 1;
+            h >>= 1;
+        }
+    }
+
+    void SIMD_NAME(bin_i8)(void* im, int w, int h, int factor)
+    {
+        bin<int8_t>((int8_t*)im, w, h, factor);
+    }
+
+    void SIMD_NAME(bin_u16)(void* im, int w, int h, int factor)
+    {
+        bin<uint16_t>((uint16_t*)im, w, h, factor);
+    }
+
+    void SIMD_NAME(bin_i16)(void* im, int w, int h, int factor)
+    {
+        bin<int16_t>((int16_t*)im, w, h, factor);
+    }
+
+    void SIMD_NAME(bin_f32)(void* im, int w, int h, int factor)
+    {
+        bin<float>((float*)im, w, h, factor);
+    }
+};
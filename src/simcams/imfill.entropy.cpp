@@ -0,0 +1,181 @@
+#include "kernels.h"
+#include "splitmix64.h"
+
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+namespace {
+/// Frames with tunable compressibility.
+///
+/// Each pixel is a diagonal ramp, `x + y + origin`, with its low `bits`
+/// replaced by uniform random bits. With `bits` equal to 0 the frame is a
+/// smooth gradient; with `bits` equal to the width of the pixel type the
+/// frame is full-entropy noise. For f32 the random bits go into the low
+/// mantissa bits of a ramp that starts at 1 and rises by 1/`extent` per
+/// step, so the output is always finite.
+///
+/// A tile of a larger frame continues the frame's ramp when `origin` is the
+/// ramp index of the tile's first pixel.
+///
+/// Each row is rendered in two passes that stay in cache: random bits are
+/// streamed into the row from 8 xorshift32 generators (one AVX2 register),
+/// then the ramp is merged in with a mask.
+constexpr int lanes = 8;
+
+/// Unsigned integer type with the same width as T
+template<typename T>
+using bits_t = std::conditional_t<
+  sizeof(T) == 1,
+  uint8_t,
+  std::conditional_t<sizeof(T) == 2, uint16_t, uint32_t>>;
+
+template<typename T>
+constexpr unsigned
+max_entropy_bits()
+{
+    return std::is_floating_point_v<T> ? 23 : 8 * sizeof(T);
+}
+
+/// Ramp value for position `i` along the diagonal, as raw bits
+template<typename T>
+bits_t<T>
+ramp(uint32_t i, float inv_extent)
+{
+    if constexpr (std::is_floating_point_v<T>) {
+        const float v = 1.0f + (float)i * inv_extent;
+        uint32_t out;
+        memcpy(&out, &v, sizeof(out));
+        return out;
+    } else {
+        return (bits_t<T>)i;
+    }
+}
+
+/// Fills `nbytes` at `dst` with random bits, advancing the generators.
+void
+fill_random_bits(uint8_t* dst, size_t nbytes, uint32_t* state)
+{
+#ifdef __AVX2__
+    __m256i x = _mm256_loadu_si256((const __m256i*)state);
+    size_t i = 0;
+    for (; i < nbytes; i += sizeof(x)) {
+        x = _mm256_xor_si256(x, _mm256_slli_epi32(x, 13));
+        x = _mm256_xor_si256(x, _mm256_srli_epi32(x, 17));
+        x = _mm256_xor_si256(x, _mm256_slli_epi32(x, 5));
+        if (i + sizeof(x) <= nbytes)
+            _mm256_storeu_si256((__m256i*)(dst + i), x);
+        else
+            memcpy(dst + i, &x, nbytes - i); // NOLINT
+    }
+    _mm256_storeu_si256((__m256i*)state, x);
+#else
+    uint32_t x[lanes];
+    memcpy(x, state, sizeof(x)); // NOLINT
+    for (size_t i = 0; i < nbytes; i += sizeof(x)) {
+        for (int j = 0; j < lanes; ++j) {
+            x[j] ^= x[j] << 13;
+            x[j] ^= x[j] >> 17;
+            x[j] ^= x[j] << 5;
+        }
+        memcpy(dst + i, x, (i + sizeof(x) <= nbytes) ? sizeof(x) : nbytes - i);
+    }
+    memcpy(state, x, sizeof(x)); // NOLINT
+#endif
+}
+
+template<typename T>
+void
+im_fill_entropy(const struct ImageShape* const shape,
+                unsigned bits,
+                uint32_t origin,
+                uint32_t extent,
+                uint64_t seed,
+                T* buf)
+{
+    using U = bits_t<T>;
+    if (bits > max_entropy_bits<T>())
+        bits = max_entropy_bits<T>();
+    const U rand_mask = (U)((1ULL << bits) - 1);
+    const U ramp_mask = (U)~rand_mask;
+    const uint32_t w = shape->dims.width;
+    const uint32_t h = shape->dims.height;
+    const float inv_extent = 1.0f / (float)extent;
+
+    uint32_t state[lanes];
+    for (int j = 0; j < lanes; ++j)
+        state[j] = (uint32_t)splitmix64(&seed) | 1; // xorshift can't be 0
+
+    for (uint32_t y = 0; y < h; ++y) {
+        U* const row = (U*)buf + (size_t)shape->strides.height * y;
+        const uint32_t o = origin + y;
+        if (bits)
+            fill_random_bits((uint8_t*)row, sizeof(U) * w, state);
+        if (ramp_mask)
+            for (uint32_t x = 0; x < w; ++x)
+                row[x] = (U)((ramp<T>(o + x, inv_extent) & ramp_mask) |
+                             (row[x] & rand_mask));
+    }
+}
+} // end namespace ::{anonymous}
+
+extern "C"
+{
+    void SIMD_NAME(im_fill_entropy_u8)(const struct ImageShape* shape,
+                                       unsigned bits,
+                                       uint32_t origin,
+                                       uint32_t extent,
+                                       uint64_t seed,
+                                       void* buf)
+    {
+        im_fill_entropy<uint8_t>(
+          shape, bits, origin, extent, seed, (uint8_t*)buf);
+    }
+
+    void SIMD_NAME(im_fill_entropy_i8)(const struct ImageShape* shape,
+                                       unsigned bits,
+                                       uint32_t origin,
+                                       uint32_t extent,
+                                       uint64_t seed,
+                                       void* buf)
+    {
+        im_fill_entropy<int8_t>(
+          shape, bits, origin, extent, seed, (int8_t*)buf);
+    }
+
+    void SIMD_NAME(im_fill_entropy_u16)(const struct ImageShape* shape,
+                                        unsigned bits,
+                                        uint32_t origin,
+                                        uint32_t extent,
+                                        uint64_t seed,
+                                        void* buf)
+    {
+        im_fill_entropy<uint16_t>(
+          shape, bits, origin, extent, seed, (uint16_t*)buf);
+    }
+
+    void SIMD_NAME(im_fill_entropy_i16)(const struct ImageShape* shape,
+                                        unsigned bits,
+                                        uint32_t origin,
+                                        uint32_t extent,
+                                        uint64_t seed,
+                                        void* buf)
+    {
+        im_fill_entropy<int16_t>(
+          shape, bits, origin, extent, seed, (int16_t*)buf);
+    }
+
+    void SIMD_NAME(im_fill_entropy_f32)(const struct ImageShape* shape,
+                                        unsigned bits,
+                                        uint32_t origin,
+                                        uint32_t extent,
+                                        uint64_t seed,
+                                        void* buf)
+    {
+        im_fill_entropy<float>(shape, bits, origin, extent, seed, (float*)buf);
+    }
+};
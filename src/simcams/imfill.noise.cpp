@@ -0,0 +1,260 @@
+#include "kernels.h"
+#include "kernels.math.h"
+#include "splitmix64.h"
+
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <type_traits>
+
+namespace {
+/// Sensor noise model: each pixel value is treated as the expected number of
+/// photo-electrons times the conversion gain. The output is
+///
+///     gain * (Poisson(value / gain) + Normal(0, read_noise))
+///
+/// Sampling is done with branch-free table lookups so a block of pixels can be
+/// processed in SIMD lanes (gathers on AVX2):
+///
+/// - Normal deviates come from an inverse-CDF table indexed by 12 random bits.
+/// - Shot noise for small means comes from per-mean inverse-CDF tables
+///   indexed by 8 random bits. The means are quantized to 1/4 electron and the
+///   tables store the deviation from the quantized mean, so the mean of the
+///   output is exact.
+/// - From `poisson_lambda_max` on, Poisson(lambda) is replaced by its normal
+///   approximation, N(lambda, lambda). The last table row is all zeros and
+///   the normal term is masked in for that row, which keeps the selection
+///   branch-free.
+///
+/// Random bits come from one xorshift32 generator per lane.
+constexpr int lanes = 16;
+constexpr int gauss_bits = 12;
+constexpr uint32_t gauss_mask = (1 << gauss_bits) - 1;
+constexpr int poisson_bits = 8;
+constexpr int poisson_steps = 4; // per electron
+constexpr int poisson_lambda_max = 16;
+constexpr int poisson_tables = poisson_lambda_max * poisson_steps;
+
+struct NoiseTables
+{
+    float gauss[1 << gauss_bits];
+    float poisson[poisson_tables + 1][1 << poisson_bits];
+
+    NoiseTables() noexcept
+    {
+        // Normal inverse cdf by bisection on erfc. Only runs once.
+        for (int i = 0; i < (1 << gauss_bits); ++i) {
+            const double u = (i + 0.5) / (1 << gauss_bits);
+            double lo = -8.0, hi = 8.0;
+            for (int iter = 0; iter < 64; ++iter) {
+                const double mid = 0.5 * (lo + hi);
+                if (0.5 * std::erfc(-mid * 0.70710678118654752440) < u)
+                    lo = mid;
+                else
+                    hi = mid;
+            }
+            gauss[i] = (float)(0.5 * (lo + hi));
+        }
+
+        // Poisson inverse cdf for each quantized mean, minus the mean.
+        for (int k = 0; k <= poisson_tables; ++k) {
+            const double lambda = (double)k / poisson_steps;
+            double pmf = std::exp(-lambda), cdf = pmf;
+            int n = 0;
+            for (int i = 0; i < (1 << poisson_bits); ++i) {
+                const double u = (i + 0.5) / (1 << poisson_bits);
+                while (cdf < u && n < 255) {
+                    ++n;
+                    pmf *= lambda / n;
+                    cdf += pmf;
+                }
+                poisson[k][i] =
+                  (k < poisson_tables) ? (float)(n - lambda) : 0.0f;
+            }
+        }
+    }
+};
+
+const NoiseTables&
+noise_tables()
+{
+    static const NoiseTables tables;
+    return tables;
+}
+
+/// Replaces the expected values in `v` with noisy samples.
+/// Advances the per-lane generators in `state`.
+void
+sample_block(float* v,
+             uint32_t* state,
+             float inv_gain,
+             float gain,
+             float read_noise_e) noexcept
+{
+    const NoiseTables& tbl = noise_tables();
+#ifdef __AVX2__
+    for (int h = 0; h < lanes; h += 8) {
+        __m256i x = _mm256_loadu_si256((const __m256i*)(state + h));
+        x = _mm256_xor_si256(x, _mm256_slli_epi32(x, 13));
+        x = _mm256_xor_si256(x, _mm256_srli_epi32(x, 17));
+        x = _mm256_xor_si256(x, _mm256_slli_epi32(x, 5));
+        _mm256_storeu_si256((__m256i*)(state + h), x);
+
+        const __m256i mask = _mm256_set1_epi32(gauss_mask);
+        const __m256 lambda =
+          _mm256_mul_ps(_mm256_loadu_ps(v + h), _mm256_set1_ps(inv_gain));
+        const __m256i k = _mm256_cvttps_epi32(_mm256_min_ps(
+          _mm256_add_ps(_mm256_mul_ps(lambda, _mm256_set1_ps(poisson_steps)),
+                        _mm256_set1_ps(0.5f)),
+          _mm256_set1_ps(poisson_tables)));
+        const __m256 z_shot =
+          _mm256_i32gather_ps(tbl.gauss, _mm256_and_si256(x, mask), 4);
+        const __m256 z_read = _mm256_i32gather_ps(
+          tbl.gauss,
+          _mm256_and_si256(_mm256_srli_epi32(x, gauss_bits), mask),
+          4);
+        const __m256 poisson = _mm256_i32gather_ps(
+          &tbl.poisson[0][0],
+          _mm256_add_epi32(_mm256_slli_epi32(k, poisson_bits),
+                           _mm256_srli_epi32(x, 32 - poisson_bits)),
+          4);
+        const __m256 is_normal = _mm256_castsi256_ps(
+          _mm256_cmpeq_epi32(k, _mm256_set1_epi32(poisson_tables)));
+
+        const __m256 shot = _mm256_add_ps(
+          poisson,
+          _mm256_and_ps(is_normal,
+                        _mm256_mul_ps(_mm256_sqrt_ps(lambda), z_shot)));
+        const __m256 e = _mm256_add_ps(
+          _mm256_add_ps(lambda, shot),
+          _mm256_mul_ps(_mm256_set1_ps(read_noise_e), z_read));
+        _mm256_storeu_ps(v + h, _mm256_mul_ps(_mm256_set1_ps(gain), e));
+    }
+#else
+    for (int j = 0; j < lanes; ++j) {
+        uint32_t x = state[j];
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+        state[j] = x;
+
+        const float lambda = v[j] * inv_gain;
+        const int k = (int)kernel_min(lambda * poisson_steps + 0.5f,
+                                      (float)poisson_tables);
+        const float z_shot = tbl.gauss[x & gauss_mask];
+        const float z_read = tbl.gauss[(x >> gauss_bits) & gauss_mask];
+        const float is_normal = (k == poisson_tables) ? 1.0f : 0.0f;
+        const float shot = tbl.poisson[k][x >> (32 - poisson_bits)] +
+                           is_normal * kernel_sqrt(lambda) * z_shot;
+        v[j] = gain * (lambda + shot + read_noise_e * z_read);
+    }
+#endif
+}
+
+template<typename T>
+T
+saturate(float v)
+{
+    if constexpr (std::is_floating_point_v<T>) {
+        return (T)v;
+    } else {
+        constexpr float lo = (float)std::numeric_limits<T>::min();
+        constexpr float hi = (float)std::numeric_limits<T>::max();
+        return (T)kernel_floor(kernel_clamp(v, lo, hi) + 0.5f);
+    }
+}
+
+template<typename T>
+void
+im_add_sensor_noise(const struct ImageShape* const shape,
+                    float gain,
+                    float read_noise_e,
+                    uint64_t seed,
+                    T* buf)
+{
+    const float inv_gain = 1.0f / gain;
+    const size_t n = shape->dims.width;
+
+    uint32_t state[lanes];
+    for (int j = 0; j < lanes; ++j)
+        state[j] = (uint32_t)splitmix64(&seed) | 1; // xorshift can't be 0
+
+    for (uint32_t y = 0; y < shape->dims.height; ++y) {
+        T* const row = buf + (size_t)shape->strides.height * y;
+        size_t i = 0;
+        for (; i + lanes <= n; i += lanes) {
+            float v[lanes];
+            for (int j = 0; j < lanes; ++j)
+                v[j] = kernel_max((float)row[i + j], 0.0f);
+            sample_block(v, state, inv_gain, gain, read_noise_e);
+            for (int j = 0; j < lanes; ++j)
+                row[i + j] = saturate<T>(v[j]);
+        }
+        if (i < n) {
+            float v[lanes] = { 0 };
+            for (size_t j = 0; i + j < n; ++j)
+                v[j] = kernel_max((float)row[i + j], 0.0f);
+            sample_block(v, state, inv_gain, gain, read_noise_e);
+            for (size_t j = 0; i + j < n; ++j)
+                row[i + j] = saturate<T>(v[j]);
+        }
+    }
+}
+} // end namespace ::{anonymous}
+
+extern "C"
+{
+    void SIMD_NAME(im_add_sensor_noise_u8)(const struct ImageShape* shape,
+                                           float gain,
+                                           float read_noise_e,
+                                           uint64_t seed,
+                                           void* buf)
+    {
+        im_add_sensor_noise<uint8_t>(
+          shape, gain, read_noise_e, seed, (uint8_t*)buf);
+    }
+
+    void SIMD_NAME(im_add_sensor_noise_i8)(const struct ImageShape* shape,
+                                           float gain,
+                                           float read_noise_e,
+                                           uint64_t seed,
+                                           void* buf)
+    {
+        im_add_sensor_noise<int8_t>(
+          shape, gain, read_noise_e, seed, (int8_t*)buf);
+    }
+
+    void SIMD_NAME(im_add_sensor_noise_u16)(const struct ImageShape* shape,
+                                            float gain,
+                                            float read_noise_e,
+                                            uint64_t seed,
+                                            void* buf)
+    {
+        im_add_sensor_noise<uint16_t>(
+          shape, gain, read_noise_e, seed, (uint16_t*)buf);
+    }
+
+    void SIMD_NAME(im_add_sensor_noise_i16)(const struct ImageShape* shape,
+                                            float gain,
+                                            float read_noise_e,
+                                            uint64_t seed,
+                                            void* buf)
+    {
+        im_add_sensor_noise<int16_t>(
+          shape, gain, read_noise_e, seed, (int16_t*)buf);
+    }
+
+    void SIMD_NAME(im_add_sensor_noise_f32)(const struct ImageShape* shape,
+                                            float gain,
+                                            float read_noise_e,
+                                            uint64_t seed,
+                                            void* buf)
+    {
+        im_add_sensor_noise<float>(
+          shape, gain, read_noise_e, seed, (float*)buf);
+    }
+};
@@ -1,47 +1,107 @@
-#include "device/props/components.h"
-#include "platform.h"
+#include "kernels.h"
+
+#ifdef __AVX512F__
+#include <immintrin.h>
+#endif
 
 #include <cmath>
+#include <type_traits>
 
 namespace {
-/// This is used for animating the parameter in im_fill_pattern.
-/// This timebase gets shared between all "pattern" cameras and as a result they
-/// are synchronized.
+#if defined(__AVX512F__) && defined(__AVX512BW__)
+/// sin(x) for 16 lanes.
 ///
-/// Thread safety: Don't really need to worry about since we don't care who
-/// wins during initialization. Afterwards it's effectively read only.
-static struct
+/// `x` is reduced to `r` in [-pi/2, pi/2] with `x = k * pi + r`, using a
+/// three-part pi so the reduction stays accurate for the arguments the pattern
+/// produces, and `sin(r)` is evaluated with a degree 11 minimax polynomial.
+/// The sign is flipped for odd `k`. Within a few ulp of `sinf`.
+__m512
+sin16(__m512 x)
 {
-    struct clock clk;
-    int is_initialized;
-} g_animation_clk = { 0 };
+    const __m512 k = _mm512_roundscale_ps(
+      _mm512_mul_ps(x, _mm512_set1_ps(0.318309886f)),
+      _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+    __m512 r = _mm512_fnmadd_ps(k, _mm512_set1_ps(3.140625f), x);
+    r = _mm512_fnmadd_ps(k, _mm512_set1_ps(9.67502593994140625e-4f), r);
+    r = _mm512_fnmadd_ps(k, _mm512_set1_ps(1.509957990978376432e-7f), r);
+
+    const __m512 r2 = _mm512_mul_ps(r, r);
+    __m512 p = _mm512_set1_ps(-2.3889859e-8f);
+    p = _mm512_fmadd_ps(p, r2, _mm512_set1_ps(2.7525562e-6f));
+    p = _mm512_fmadd_ps(p, r2, _mm512_set1_ps(-1.9840874e-4f));
+    p = _mm512_fmadd_ps(p, r2, _mm512_set1_ps(8.3333310e-3f));
+    p = _mm512_fmadd_ps(p, r2, _mm512_set1_ps(-1.6666667e-1f));
+    p = _mm512_fmadd_ps(_mm512_mul_ps(p, r2), r, r);
 
-float
-get_animation_time_sec()
+    const __mmask16 odd =
+      _mm512_test_epi32_mask(_mm512_cvtps_epi32(k), _mm512_set1_epi32(1));
+    return _mm512_mask_sub_ps(p, odd, _mm512_setzero_ps(), p);
+}
+
+/// Converts like the scalar cast `(T)v` and stores the first `n` of 16
+/// pixels at `p`.
+template<typename T>
+void
+store16(T* p, int n, __m512 v)
 {
-    float t;
-    {
-        struct clock* const clk = &g_animation_clk.clk;
-        if (!g_animation_clk.is_initialized) {
-            clock_init(clk);
-            g_animation_clk.is_initialized = 1;
-        }
-        t = (float)clock_toc_ms(clk) * 1e-3f;
+    const __mmask16 m =
+      n >= 16 ? (__mmask16)0xffff : (__mmask16)((1u << n) - 1);
+    if constexpr (std::is_floating_point_v<T>) {
+        _mm512_mask_storeu_ps(p, m, v);
+    } else if constexpr (sizeof(T) == 1) {
+        _mm512_mask_cvtepi32_storeu_epi8(p, m, _mm512_cvttps_epi32(v));
+    } else {
+        _mm512_mask_cvtepi32_storeu_epi16(p, m, _mm512_cvttps_epi32(v));
     }
-    return t;
 }
 
+/// One row of the pattern, 16 pixels at a time. The row tail is written
+/// with a masked store.
+template<typename T>
+void
+fill_row(uint32_t width, float cx, float dy2, float t, T* row)
+{
+    const __m512 lanes = _mm512_setr_ps(
+      0.f, 1.f, 2.f, 3.f, 4.f, 5.f, 6.f, 7.f, 8.f, 9.f, 10.f, 11.f, 12.f, 13.f,
+      14.f, 15.f);
+    const __m512 t10 = _mm512_set1_ps(t * 10.0f);
+    for (uint32_t x = 0; x < width; x += 16) {
+        const __m512 dx = _mm512_sub_ps(
+          _mm512_add_ps(_mm512_set1_ps((float)x), lanes), _mm512_set1_ps(cx));
+        const __m512 r2 =
+          _mm512_add_ps(_mm512_mul_ps(dx, dx), _mm512_set1_ps(dy2));
+        const __m512 phase = _mm512_mul_ps(
+          _mm512_set1_ps(6.28f),
+          _mm512_add_ps(t10, _mm512_mul_ps(r2, _mm512_set1_ps(1e-2f))));
+        const __m512 v = _mm512_mul_ps(
+          _mm512_set1_ps(127.0f),
+          _mm512_add_ps(sin16(phase), _mm512_set1_ps(1.0f)));
+        store16(row + x, (int)(width - x), v);
+    }
+}
+#endif
+
 template<typename T>
 void
 im_fill_pattern(const struct ImageShape* const shape,
-                float ox,
-                float oy,
+                float cx,
+                float cy,
+                float t,
                 T* buf)
 {
-    float t = get_animation_time_sec();
-
-    const float cx = ox + 0.5f * (float)shape->dims.width;
-    const float cy = oy + 0.5f * (float)shape->dims.height;
+#if defined(__AVX512F__) && defined(__AVX512BW__)
+    if (shape->strides.width == 1) {
+        for (uint32_t y = 0; y < shape->dims.height; ++y) {
+            const float dy = y - cy;
+            fill_row(shape->dims.width,
+                     cx,
+                     dy * dy,
+                     t,
+                     buf + (size_t)shape->strides.height * y);
+        }
+        return;
+    }
+#endif
     for (uint32_t y = 0; y < shape->dims.height; ++y) {
         const float dy = y - cy;
         const float dy2 = dy * dy;
@@ -60,43 +120,48 @@ im_fill_pattern(const struct ImageShape* const shape,
 
 extern "C"
 {
-    void im_fill_pattern_u8(const struct ImageShape* shape,
-                            float ox,
-                            float oy,
-                            uint8_t* buf)
+    void SIMD_NAME(im_fill_pattern_u8)(const struct ImageShape* shape,
+                                       float cx,
+                                       float cy,
+                                       float t,
+                                       void* buf)
     {
-        im_fill_pattern<uint8_t>(shape, ox, oy, buf);
+        im_fill_pattern<uint8_t>(shape, cx, cy, t, (uint8_t*)buf);
     }
 
-    void im_fill_pattern_i8(const struct ImageShape* shape,
-                            float ox,
-                            float oy,
-                            int8_t* buf)
+    void SIMD_NAME(im_fill_pattern_i8)(const struct ImageShape* shape,
+                                       float cx,
+                                       float cy,
+                                       float t,
+                                       void* buf)
     {
-        im_fill_pattern<int8_t>(shape, ox, oy, buf);
+        im_fill_pattern<int8_t>(shape, cx, cy, t, (int8_t*)buf);
     }
 
-    void im_fill_pattern_u16(const struct ImageShape* shape,
-                             float ox,
-                             float oy,
-                             uint16_t* buf)
+    void SIMD_NAME(im_fill_pattern_u16)(const struct ImageShape* shape,
+                                        float cx,
+                                        float cy,
+                                        float t,
+                                        void* buf)
     {
-        im_fill_pattern<uint16_t>(shape, ox, oy, buf);
+        im_fill_pattern<uint16_t>(shape, cx, cy, t, (uint16_t*)buf);
     }
 
-    void im_fill_pattern_i16(const struct ImageShape* shape,
-                             float ox,
-                             float oy,
-                             int16_t* buf)
+    void SIMD_NAME(im_fill_pattern_i16)(const struct ImageShape* shape,
+                                        float cx,
+                                        float cy,
+                                        float t,
+                                        void* buf)
     {
-        im_fill_pattern<int16_t>(shape, ox, oy, buf);
+        im_fill_pattern<int16_t>(shape, cx, cy, t, (int16_t*)buf);
     }
 
-    void im_fill_pattern_f32(const struct ImageShape* shape,
-                             float ox,
-                             float oy,
-                             float* buf)
+    void SIMD_NAME(im_fill_pattern_f32)(const struct ImageShape* shape,
+                                        float cx,
+                                        float cy,
+                                        float t,
+                                        void* buf)
     {
-        im_fill_pattern<float>(shape, ox, oy, buf);
+        im_fill_pattern<float>(shape, cx, cy, t, (float*)buf);
     }
 };
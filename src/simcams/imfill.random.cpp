@@ -0,0 +1,137 @@
+#include "kernels.h"
+#include "splitmix64.h"
+
+#if defined(__AVX2__) || defined(__AVX512F__)
+#include <immintrin.h>
+#endif
+
+#include <cstdint>
+#include <cstring>
+
+namespace {
+/// Uniform random frames.
+///
+/// Bytes come from 16 interleaved xorshift32 generators seeded from `seed`.
+/// Each step advances all of them and emits 64 bytes. The AVX-512 build
+/// keeps the generators in one register, the AVX2 build in two, and the
+/// others in an array, but every build produces the same bytes.
+constexpr int lanes = 16;
+
+size_t
+bytes_of_type(enum SampleType type)
+{
+    switch (type) {
+        case SampleType_u8:
+        case SampleType_i8:
+            return 1;
+        case SampleType_f32:
+            return 4;
+        default:
+            return 2;
+    }
+}
+
+#if defined(__AVX512F__) && defined(__AVX512BW__)
+__m512i
+step(__m512i x)
+{
+    x = _mm512_xor_si512(x, _mm512_slli_epi32(x, 13));
+    x = _mm512_xor_si512(x, _mm512_srli_epi32(x, 17));
+    return _mm512_xor_si512(x, _mm512_slli_epi32(x, 5));
+}
+
+/// Fills `nbytes` at `dst`, advancing the generators. The row tail is
+/// written with a masked store.
+void
+fill_row(uint8_t* dst, size_t nbytes, uint32_t* state)
+{
+    __m512i x = _mm512_loadu_si512(state);
+    size_t i = 0;
+    for (; i + 64 <= nbytes; i += 64) {
+        x = step(x);
+        _mm512_storeu_si512(dst + i, x);
+    }
+    if (i < nbytes) {
+        x = step(x);
+        _mm512_mask_storeu_epi8(
+          dst + i, ((__mmask64)1 << (nbytes - i)) - 1, x);
+    }
+    _mm512_storeu_si512(state, x);
+}
+#elif defined(__AVX2__)
+__m256i
+step(__m256i x)
+{
+    x = _mm256_xor_si256(x, _mm256_slli_epi32(x, 13));
+    x = _mm256_xor_si256(x, _mm256_srli_epi32(x, 17));
+    return _mm256_xor_si256(x, _mm256_slli_epi32(x, 5));
+}
+
+/// Fills `nbytes` at `dst`, advancing the generators.
+void
+fill_row(uint8_t* dst, size_t nbytes, uint32_t* state)
+{
+    __m256i a = _mm256_loadu_si256((const __m256i*)state);
+    __m256i b = _mm256_loadu_si256((const __m256i*)(state + 8));
+    size_t i = 0;
+    for (; i + 64 <= nbytes; i += 64) {
+        a = step(a);
+        b = step(b);
+        _mm256_storeu_si256((__m256i*)(dst + i), a);
+        _mm256_storeu_si256((__m256i*)(dst + i + 32), b);
+    }
+    if (i < nbytes) {
+        alignas(32) uint8_t tail[64];
+        a = step(a);
+        b = step(b);
+        _mm256_store_si256((__m256i*)tail, a);
+        _mm256_store_si256((__m256i*)(tail + 32), b);
+        memcpy(dst + i, tail, nbytes - i); // NOLINT
+    }
+    _mm256_storeu_si256((__m256i*)state, a);
+    _mm256_storeu_si256((__m256i*)(state + 8), b);
+}
+#else
+/// Fills `nbytes` at `dst`, advancing the generators.
+void
+fill_row(uint8_t* dst, size_t nbytes, uint32_t* state)
+{
+    uint32_t x[lanes];
+    memcpy(x, state, sizeof(x)); // NOLINT
+    for (size_t i = 0; i < nbytes; i += sizeof(x)) {
+        for (int j = 0; j < lanes; ++j) {
+            x[j] ^= x[j] << 13;
+            x[j] ^= x[j] >> 17;
+            x[j] ^= x[j] << 5;
+        }
+        memcpy(dst + i, x, (i + sizeof(x) <= nbytes) ? sizeof(x) : nbytes - i);
+    }
+    memcpy(state, x, sizeof(x)); // NOLINT
+}
+#endif
+
+void
+im_fill_random(const struct ImageShape* const shape, uint64_t seed, void* buf)
+{
+    const size_t bpp = bytes_of_type(shape->type);
+    const size_t nbytes = bpp * shape->dims.width;
+    uint32_t state[lanes];
+    for (int j = 0; j < lanes; ++j)
+        state[j] = (uint32_t)splitmix64(&seed) | 1; // xorshift can't be 0
+
+    for (uint32_t y = 0; y < shape->dims.height; ++y)
+        fill_row((uint8_t*)buf + bpp * shape->strides.height * y,
+                 nbytes,
+                 state);
+}
+} // end namespace ::{anonymous}
+
+extern "C"
+{
+    void SIMD_NAME(im_fill_random)(const struct ImageShape* shape,
+                                   uint64_t seed,
+                                   void* buf)
+    {
+        im_fill_random(shape, seed, buf);
+    }
+};
@@ -0,0 +1,395 @@
+#include "device/props/components.h"
+#include "splitmix64.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <type_traits>
+#include <vector>
+
+namespace {
+/// A field of soft round sprites ("beads") drifting over a static background.
+///
+/// The frame is split into square tiles. Every render marks the tiles that
+/// overlap each sprite's footprint before and after it moved, even by a
+/// fraction of a pixel, and only those tiles are redrawn. Everything else is
+/// left untouched in the output buffer, so the cost of a frame scales with the
+/// area swept by the sprites rather than the area of the frame.
+///
+/// Sprite trajectories are a function of time only. Rendering the same time
+/// twice gives the same frame.
+constexpr uint32_t tile_size = 64;
+constexpr uint32_t max_sprites = 256;
+
+struct Sprite
+{
+    float cx, cy;   ///< center of the orbit in units of the frame size
+    float ax, ay;   ///< orbit amplitude in units of the frame size
+    float wx, wy;   ///< angular speed (rad/s)
+    float px, py;   ///< phase
+    float radius;   ///< pixels
+    float strength; ///< peak value added to the background
+};
+
+struct Box
+{
+    int32_t x0, y0, x1, y1; ///< half-open, pixels
+};
+
+/// Where a sprite was drawn.
+struct Placement
+{
+    float x, y; ///< center, pixels
+    Box box;    ///< footprint
+};
+
+template<typename T>
+T
+saturate(float v)
+{
+    if constexpr (std::is_floating_point_v<T>) {
+        return (T)v;
+    } else {
+        constexpr float lo = (float)std::numeric_limits<T>::min();
+        constexpr float hi = (float)std::numeric_limits<T>::max();
+        return (T)std::clamp(v + 0.5f, lo, hi);
+    }
+}
+
+} // end namespace ::{anonymous}
+
+struct SpriteScene
+{
+    std::vector<Sprite> sprites;
+    std::vector<Placement> last; ///< at the last render
+    std::vector<uint8_t> dirty;
+
+    // What the last render wrote to. A change forces a full redraw.
+    const void* last_buf;
+    uint32_t last_width, last_height;
+    enum SampleType last_type;
+
+    uint64_t tiles_drawn, tiles_total;
+
+    Placement place(const Sprite& s, float t, uint32_t w, uint32_t h) const
+    {
+        const float x = w * (s.cx + s.ax * std::sin(s.wx * t + s.px));
+        const float y = h * (s.cy + s.ay * std::sin(s.wy * t + s.py));
+        const float r = s.radius;
+        return Placement{ x,
+                          y,
+                          Box{ (int32_t)std::floor(x - r),
+                               (int32_t)std::floor(y - r),
+                               (int32_t)std::ceil(x + r) + 1,
+                               (int32_t)std::ceil(y + r) + 1 } };
+    }
+
+    void mark(const Box& b, uint32_t tw, uint32_t w, uint32_t h)
+    {
+        const int32_t x0 = std::max(b.x0, 0);
+        const int32_t y0 = std::max(b.y0, 0);
+        const int32_t x1 = std::min(b.x1, (int32_t)w);
+        const int32_t y1 = std::min(b.y1, (int32_t)h);
+        if (x0 >= x1 || y0 >= y1)
+            return;
+        for (uint32_t ty = y0 / tile_size; ty <= (y1 - 1) / tile_size; ++ty)
+            for (uint32_t tx = x0 / tile_size; tx <= (x1 - 1) / tile_size;
+                 ++tx)
+                dirty[(size_t)ty * tw + tx] = 1;
+    }
+
+    /// Draws the pixels in [x0,x1) x [y0,y1) of a `w` by `h` frame.
+    /// `dst` points at pixel (x0,y0) and advances by `sx` per column and `sy`
+    /// per row. The rectangle may be at most one tile.
+    template<typename T>
+    void draw_rect(uint32_t w,
+                   uint32_t h,
+                   uint32_t x0,
+                   uint32_t y0,
+                   uint32_t x1,
+                   uint32_t y1,
+                   float t,
+                   int64_t sx,
+                   int64_t sy,
+                   T* dst) const
+    {
+        // Background: a static, separable low-frequency texture.
+        float col[tile_size];
+        for (uint32_t x = x0; x < x1; ++x)
+            col[x - x0] = 10.0f * std::cos(x * 0.011f);
+
+        // Sprites touching this rectangle.
+        struct Local
+        {
+            float x, y, inv_r2, strength;
+        } near[max_sprites];
+        int n = 0;
+        for (const auto& s : sprites) {
+            const Placement p = place(s, t, w, h);
+            const Box& b = p.box;
+            if (b.x1 <= (int32_t)x0 || b.x0 >= (int32_t)x1 ||
+                b.y1 <= (int32_t)y0 || b.y0 >= (int32_t)y1)
+                continue;
+            near[n++] = { p.x, p.y, 1.0f / (s.radius * s.radius), s.strength };
+        }
+
+        for (uint32_t y = y0; y < y1; ++y) {
+            T* const row = dst + (size_t)sy * (y - y0);
+            const float bg = 40.0f + 10.0f * std::sin(y * 0.007f);
+            for (uint32_t x = x0; x < x1; ++x) {
+                float v = bg + col[x - x0];
+                for (int i = 0; i < n; ++i) {
+                    const float dx = x - near[i].x, dy = y - near[i].y;
+                    // smooth bump: (1 - d^2/r^2)^2 inside the radius
+                    const float q = std::max(
+                      0.0f, 1.0f - (dx * dx + dy * dy) * near[i].inv_r2);
+                    v += near[i].strength * q * q;
+                }
+                row[(size_t)sx * (x - x0)] = saturate<T>(v);
+            }
+        }
+    }
+
+    template<typename T>
+    void draw_tile(const struct ImageShape* shape,
+                   float t,
+                   uint32_t tx,
+                   uint32_t ty,
+                   T* buf) const
+    {
+        const uint32_t w = shape->dims.width;
+        const uint32_t h = shape->dims.height;
+        const uint32_t x0 = tx * tile_size, y0 = ty * tile_size;
+        draw_rect<T>(w,
+                     h,
+                     x0,
+                     y0,
+                     std::min(x0 + tile_size, w),
+                     std::min(y0 + tile_size, h),
+                     t,
+                     shape->strides.width,
+                     shape->strides.height,
+                     buf + (size_t)shape->strides.height * y0 +
+                       (size_t)shape->strides.width * x0);
+    }
+
+    /// Draws the region described by `shape` whose first pixel is at
+    /// (x0,y0) in a `w` by `h` frame. Does not use or update the dirty state.
+    template<typename T>
+    void draw_region(uint32_t w,
+                     uint32_t h,
+                     const struct ImageShape* shape,
+                     uint32_t x0,
+                     uint32_t y0,
+                     float t,
+                     T* buf) const
+    {
+        const uint32_t x1 = x0 + shape->dims.width;
+        const uint32_t y1 = y0 + shape->dims.height;
+        for (uint32_t y = y0; y < y1; y += tile_size)
+            for (uint32_t x = x0; x < x1; x += tile_size)
+                draw_rect<T>(w,
+                             h,
+                             x,
+                             y,
+                             std::min(x + tile_size, x1),
+                             std::min(y + tile_size, y1),
+                             t,
+                             shape->strides.width,
+                             shape->strides.height,
+                             buf + (size_t)shape->strides.height * (y - y0) +
+                               (size_t)shape->strides.width * (x - x0));
+    }
+
+    template<typename T>
+    size_t render(const struct ImageShape* shape, float t, T* buf)
+    {
+        const uint32_t w = shape->dims.width;
+        const uint32_t h = shape->dims.height;
+        const uint32_t tw = (w + tile_size - 1) / tile_size;
+        const uint32_t th = (h + tile_size - 1) / tile_size;
+        const bool full = buf != last_buf || w != last_width ||
+                          h != last_height || shape->type != last_type;
+
+        dirty.assign((size_t)tw * th, full ? 1 : 0);
+        last.resize(sprites.size());
+        for (size_t i = 0; i < sprites.size(); ++i) {
+            // Sprites are drawn at their exact center, so moving one even a
+            // fraction of a pixel changes the pixels under its footprint.
+            const Placement now = place(sprites[i], t, w, h);
+            const Placement& was = last[i];
+            if (!full && (now.x != was.x || now.y != was.y)) {
+                mark(was.box, tw, w, h);
+                mark(now.box, tw, w, h);
+            }
+            last[i] = now;
+        }
+
+        size_t ndrawn = 0;
+        for (uint32_t ty = 0; ty < th; ++ty)
+            for (uint32_t tx = 0; tx < tw; ++tx)
+                if (dirty[(size_t)ty * tw + tx]) {
+                    draw_tile<T>(shape, t, tx, ty, buf);
+                    ++ndrawn;
+                }
+
+        last_buf = buf;
+        last_width = w;
+        last_height = h;
+        last_type = shape->type;
+        tiles_drawn += ndrawn;
+        tiles_total += (size_t)tw * th;
+        return ndrawn;
+    }
+};
+
+extern "C"
+{
+    /// At most 256 sprites are kept.
+    struct SpriteScene* sprite_scene_create(uint32_t nsprites, uint64_t seed)
+    {
+        SpriteScene* self = nullptr;
+        try {
+            self = new SpriteScene{};
+            self->last_type = SampleTypeCount;
+            self->sprites.resize(std::min(nsprites, max_sprites));
+            auto uniform = [&seed](float lo, float hi) {
+                return lo + (hi - lo) * (float)(splitmix64(&seed) >> 40) *
+                              (1.0f / (float)(1 << 24));
+            };
+            for (auto& s : self->sprites) {
+                s = Sprite{ .cx = uniform(0.3f, 0.7f),
+                            .cy = uniform(0.3f, 0.7f),
+                            .ax = uniform(0.05f, 0.35f),
+                            .ay = uniform(0.05f, 0.35f),
+                            .wx = uniform(0.1f, 0.6f),
+                            .wy = uniform(0.1f, 0.6f),
+                            .px = uniform(0.0f, 6.28f),
+                            .py = uniform(0.0f, 6.28f),
+                            .radius = uniform(4.0f, 16.0f),
+                            .strength = uniform(80.0f, 200.0f) };
+            }
+        } catch (...) {
+            delete self;
+            return nullptr;
+        }
+        return self;
+    }
+
+    void sprite_scene_destroy(struct SpriteScene* self) { delete self; }
+
+    /// Forget what was rendered so the next render redraws every tile.
+    void sprite_scene_invalidate(struct SpriteScene* self)
+    {
+        self->last_buf = nullptr;
+    }
+
+    /// @returns the fraction of tiles that were redrawn since creation.
+    float sprite_scene_redraw_fraction(const struct SpriteScene* self)
+    {
+        return self->tiles_total
+                 ? (float)self->tiles_drawn / (float)self->tiles_total
+                 : 0.0f;
+    }
+
+    /// Renders the part of a `width` by `height` frame at time `t` that is
+    /// described by `shape` and starts at (x0,y0). Every pixel is drawn; the
+    /// incremental state used by `sprite_scene_render()` is not touched.
+    void sprite_scene_draw_region(const struct SpriteScene* self,
+                                  uint32_t width,
+                                  uint32_t height,
+                                  const struct ImageShape* shape,
+                                  uint32_t x0,
+                                  uint32_t y0,
+                                  float t,
+                                  uint8_t* buf)
+    {
+        switch (shape->type) {
+            case SampleType_u8:
+                self->draw_region<uint8_t>(
+                  width, height, shape, x0, y0, t, buf);
+                break;
+            case SampleType_i8:
+                self->draw_region<int8_t>(
+                  width, height, shape, x0, y0, t, (int8_t*)buf);
+                break;
+            case SampleType_u16:
+                self->draw_region<uint16_t>(
+                  width, height, shape, x0, y0, t, (uint16_t*)buf);
+                break;
+            case SampleType_i16:
+                self->draw_region<int16_t>(
+                  width, height, shape, x0, y0, t, (int16_t*)buf);
+                break;
+            case SampleType_f32:
+                self->draw_region<float>(
+                  width, height, shape, x0, y0, t, (float*)buf);
+                break;
+            default:;
+        }
+    }
+
+    /// Renders the scene at time `t` (seconds) into `buf`.
+    /// `buf` must hold the previous render for the incremental update to be
+    /// correct; otherwise call `sprite_scene_invalidate()` first.
+    /// @returns the number of tiles that were redrawn.
+    size_t sprite_scene_render(struct SpriteScene* self,
+                               const struct ImageShape* shape,
+                               float t,
+                               uint8_t* buf)
+    {
+        switch (shape->type) {
+            case SampleType_u8:
+                return self->render<uint8_t>(shape, t, buf);
+            case SampleType_i8:
+                return self->render<int8_t>(shape, t, (int8_t*)buf);
+            case SampleType_u16:
+                return self->render<uint16_t>(shape, t, (uint16_t*)buf);
+            case SampleType_i16:
+                return self->render<int16_t>(shape, t, (int16_t*)buf);
+            case SampleType_f32:
+                return self->render<float>(shape, t, (float*)buf);
+            default:
+                return 0;
+        }
+    }
+};
+
+#ifndef NO_UNIT_TESTS
+#include "device/kit/driver.h"
+#include "logger.h"
+
+#define LOGE(...) aq_logger(1, __FILE__, __LINE__, __FUNCTION__, __VA_ARGS__)
+
+/// Sprites moving by a fraction of a pixel per frame still change the
+/// pixels they cover, so incremental renders must match full ones.
+extern "C" acquire_export int
+unit_test_sprite_scene_incremental()
+{
+    constexpr uint32_t w = 300, h = 200;
+    const struct ImageShape shape = {
+        .dims = { .channels = 1, .width = w, .height = h, .planes = 1 },
+        .strides = { .channels = 1, .width = 1, .height = w, .planes = w * h },
+        .type = SampleType_f32,
+    };
+    std::vector<float> incremental(w * h), full(w * h);
+    SpriteScene* a = sprite_scene_create(64, 7);
+    SpriteScene* b = sprite_scene_create(64, 7);
+    int ok = a && b;
+    // 2 ms apart, the fastest sprites move about a tenth of a pixel.
+    for (int i = 0; ok && i < 20; ++i) {
+        const float t = 10.0f + 0.002f * i;
+        sprite_scene_render(a, &shape, t, (uint8_t*)incremental.data());
+        sprite_scene_invalidate(b);
+        sprite_scene_render(b, &shape, t, (uint8_t*)full.data());
+        if (incremental != full) {
+            LOGE("Incremental render differs from a full one at frame %d", i);
+            ok = 0;
+        }
+    }
+    sprite_scene_destroy(a);
+    sprite_scene_destroy(b);
+    return ok;
+}
+#endif // NO_UNIT_TESTS
@@ -0,0 +1,385 @@
+#include "kernels.h"
+#include "../common/options.h"
+
+#include "device/kit/driver.h"
+#include "logger.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define LOG(...) aq_logger(0, __FILE__, __LINE__, __FUNCTION__, __VA_ARGS__)
+#define LOGE(...) aq_logger(1, __FILE__, __LINE__, __FUNCTION__, __VA_ARGS__)
+#define EXPECT(e, ...)                                                         \
+    do {                                                                       \
+        if (!(e)) {                                                            \
+            LOGE(__VA_ARGS__);                                                 \
+            goto Error;                                                        \
+        }                                                                      \
+    } while (0)
+#define CHECK(e) EXPECT(e, "Expression evaluated as false:\n\t%s", #e)
+
+/// One table per instruction set build. `SIMD_HAVE_<ISA>` is defined for
+/// each build by `target_simd_kernels()`.
+extern const struct SimcamKernels simcam_kernel_table_scalar;
+#ifdef SIMD_HAVE_NEON
+extern const struct SimcamKernels simcam_kernel_table_neon;
+#endif
+#ifdef SIMD_HAVE_SSE41
+extern const struct SimcamKernels simcam_kernel_table_sse41;
+#endif
+#ifdef SIMD_HAVE_AVX2
+extern const struct SimcamKernels simcam_kernel_table_avx2;
+#endif
+#ifdef SIMD_HAVE_AVX512
+extern const struct SimcamKernels simcam_kernel_table_avx512;
+#endif
+
+/// Thread safety: the driver selects the kernels when it's initialized,
+/// before any camera runs. Afterwards this is read only.
+static struct
+{
+    const struct SimcamKernels* kernels;
+    enum SimdIsa isa;
+} g_selected;
+
+static const struct SimcamKernels*
+built_kernels(enum SimdIsa isa)
+{
+    switch (isa) {
+        case SimdIsa_Scalar:
+            return &simcam_kernel_table_scalar;
+#ifdef SIMD_HAVE_NEON
+        case SimdIsa_NEON:
+            return &simcam_kernel_table_neon;
+#endif
+#ifdef SIMD_HAVE_SSE41
+        case SimdIsa_SSE41:
+            return &simcam_kernel_table_sse41;
+#endif
+#ifdef SIMD_HAVE_AVX2
+        case SimdIsa_AVX2:
+            return &simcam_kernel_table_avx2;
+#endif
+#ifdef SIMD_HAVE_AVX512
+        case SimdIsa_AVX512:
+            return &simcam_kernel_table_avx512;
+#endif
+        default:
+            return 0;
+    }
+}
+
+const struct SimcamKernels*
+simcam_kernels_for(enum SimdIsa isa)
+{
+    return simd_isa_is_supported(isa) ? built_kernels(isa) : 0;
+}
+
+void
+simcam_kernels_init(void)
+{
+    enum SimdIsa isa = SimdIsa_Scalar;
+    for (int i = SimdIsaCount - 1; i > SimdIsa_Scalar; --i) {
+        if (simcam_kernels_for((enum SimdIsa)i)) {
+            isa = (enum SimdIsa)i;
+            break;
+        }
+    }
+
+    // Overrides the choice, e.g. to compare instruction sets.
+    const char* name = options_get_string("ACQUIRE_SIMD");
+    if (name) {
+        enum SimdIsa requested = SimdIsa_Scalar;
+        if (!simd_isa_from_string(name, &requested)) {
+            LOGE("Unknown ACQUIRE_SIMD \"%s\". Expected scalar, neon, sse4.1, "
+                 "avx2 or avx512. Using %s.",
+                 name,
+                 simd_isa_to_string(isa));
+        } else if (!simcam_kernels_for(requested)) {
+            LOGE("ACQUIRE_SIMD=%s was not built or isn't supported by this "
+                 "cpu. Using %s.",
+                 name,
+                 simd_isa_to_string(isa));
+        } else {
+            isa = requested;
+            LOG("Using %s kernels.", simd_isa_to_string(isa));
+        }
+    }
+
+    g_selected.isa = isa;
+    g_selected.kernels = simcam_kernels_for(isa);
+}
+
+const struct SimcamKernels*
+simcam_kernels(void)
+{
+    if (!g_selected.kernels)
+        simcam_kernels_init();
+    return g_selected.kernels;
+}
+
+enum SimdIsa
+simcam_kernels_isa(void)
+{
+    simcam_kernels();
+    return g_selected.isa;
+}
+
+#ifndef NO_UNIT_TESTS
+
+acquire_export int
+unit_test_im_reverse()
+{
+    uint8_t src[4 * 97], copy[4 * 97], inplace[4 * 97];
+    for (size_t i = 0; i < sizeof(src); ++i)
+        src[i] = (uint8_t)(i * 7 + 3);
+
+    for (int isa = 0; isa < SimdIsaCount; ++isa) {
+        const struct SimcamKernels* k = simcam_kernels_for(isa);
+        if (!k)
+            continue;
+        for (size_t bpp = 1; bpp <= 4; bpp *= 2) {
+            // Sizes below, at and above whole blocks, odd and even.
+            for (size_t n = 0; n <= sizeof(src) / bpp; ++n) {
+                k->reverse_copy(copy, src, n, bpp);
+                memcpy(inplace, src, n * bpp); // NOLINT
+                k->reverse_inplace(inplace, n, bpp);
+                for (size_t i = 0; i < n; ++i) {
+                    EXPECT(memcmp(copy + i * bpp,
+                                  src + (n - 1 - i) * bpp,
+                                  bpp) == 0,
+                           "%s reverse_copy: mismatch at %d of %d (bpp %d)",
+                           simd_isa_to_string(isa),
+                           (int)i,
+                           (int)n,
+                           (int)bpp);
+                    EXPECT(memcmp(inplace + i * bpp, copy + i * bpp, bpp) == 0,
+                           "%s reverse_inplace: mismatch at %d of %d (bpp %d)",
+                           simd_isa_to_string(isa),
+                           (int)i,
+                           (int)n,
+                           (int)bpp);
+                }
+            }
+        }
+    }
+    return 1;
+Error:
+    return 0;
+}
+
+static size_t
+bytes_of_sample(enum SampleType type)
+{
+    return type == SampleType_f32                                ? 4
+           : (type == SampleType_u16 || type == SampleType_i16) ? 2
+                                                                 : 1;
+}
+
+/// @returns the largest difference between the pixels of `a` and `b`.
+static double
+max_abs_diff(enum SampleType type, const void* a, const void* b, size_t n)
+{
+    double out = 0;
+    for (size_t i = 0; i < n; ++i) {
+        double x = 0, y = 0;
+        switch (type) {
+#define CASE(T, V)                                                             \
+    case SampleType_##T:                                                       \
+        x = ((const V*)a)[i];                                                  \
+        y = ((const V*)b)[i];                                                  \
+        break
+            CASE(u8, uint8_t);
+            CASE(i8, int8_t);
+            CASE(u16, uint16_t);
+            CASE(i16, int16_t);
+            CASE(f32, float);
+#undef CASE
+            default:;
+        }
+        const double d = x > y ? x - y : y - x;
+        out = d > out ? d : out;
+    }
+    return out;
+}
+
+/// Every instruction set the cpu supports computes the same frames as the
+/// scalar kernels. u8 binning may round differently by 1, f32 binning sums in
+/// a different order, and the vector sine behind the AVX-512 pattern may
+/// differ from `sinf` in the last bits.
+acquire_export int
+unit_test_simd_kernels_agree()
+{
+    enum
+    {
+        W = 256,
+        H = 16,
+        N = W * H
+    };
+    const enum SampleType types[] = {
+        SampleType_u8,  SampleType_i8,  SampleType_u16,
+        SampleType_i16, SampleType_f32,
+    };
+    const struct SimcamKernels* const ref = simcam_kernels_for(SimdIsa_Scalar);
+    // 32-byte aligned, as the binning kernels need
+    void* alloc = malloc(2 * 4 * N + 32);
+    uint8_t* const expected = (uint8_t*)(((uintptr_t)alloc + 31) & ~31ULL);
+    uint8_t* const actual = expected + 4 * N;
+    float dark[N], gain[N];
+    CHECK(alloc);
+    CHECK(ref);
+
+    for (int i = 0; i < N; ++i) {
+        dark[i] = (float)(i % 37) - 8.0f;
+        gain[i] = 0.5f + (float)(i % 11) * 0.25f;
+    }
+
+    for (int isa = SimdIsa_Scalar + 1; isa < SimdIsaCount; ++isa) {
+        const struct SimcamKernels* k = simcam_kernels_for(isa);
+        if (!k)
+            continue;
+        for (int it = 0; it < (int)(sizeof(types) / sizeof(*types)); ++it) {
+            const enum SampleType type = types[it];
+            const size_t bpp = bytes_of_sample(type);
+            const struct ImageShape shape = {
+                .dims = { .channels = 1, .width = W, .height = H, .planes = 1 },
+                .strides = { .channels = 1,
+                             .width = 1,
+                             .height = W,
+                             .planes = N },
+                .type = type,
+            };
+
+            ref->fill_random(&shape, 42, expected);
+            k->fill_random(&shape, 42, actual);
+            EXPECT(memcmp(expected, actual, bpp * N) == 0,
+                   "%s fill_random: mismatch for type %d",
+                   simd_isa_to_string(isa),
+                   (int)type);
+
+            ref->fill_pattern[type](
+              &shape, W / 3.0f, H / 2.0f, 0.37f, expected);
+            k->fill_pattern[type](&shape, W / 3.0f, H / 2.0f, 0.37f, actual);
+            EXPECT(max_abs_diff(type, expected, actual, N) <=
+                     (type == SampleType_f32 ? 0.01 : 1),
+                   "%s fill_pattern: mismatch for type %d",
+                   simd_isa_to_string(isa),
+                   (int)type);
+
+            // A noiseless entropy frame is a deterministic ramp.
+            ref->fill_entropy[type](&shape, 0, 3, W + H + 1, 1, expected);
+            k->fill_entropy[type](&shape, 0, 3, W + H + 1, 1, actual);
+            EXPECT(max_abs_diff(type, expected, actual, N) == 0,
+                   "%s fill_entropy: mismatch for type %d",
+                   simd_isa_to_string(isa),
+                   (int)type);
+
+            // Same seed, same random numbers.
+            ref->fill_entropy[type](&shape, 0, 3, W + H + 1, 1, expected);
+            memcpy(actual, expected, bpp * N); // NOLINT
+            ref->add_sensor_noise[type](&shape, 2.0f, 3.0f, 42, expected);
+            k->add_sensor_noise[type](&shape, 2.0f, 3.0f, 42, actual);
+            EXPECT(max_abs_diff(type, expected, actual, N) <=
+                     (type == SampleType_f32 ? 1e-3 : 0),
+                   "%s add_sensor_noise: mismatch for type %d",
+                   simd_isa_to_string(isa),
+                   (int)type);
+
+            ref->correct[type](expected, dark, gain, N);
+            k->correct[type](actual, dark, gain, N);
+            EXPECT(max_abs_diff(type, expected, actual, N) == 0,
+                   "%s correct: mismatch for type %d",
+                   simd_isa_to_string(isa),
+                   (int)type);
+
+            for (int factor = 2; factor <= 8; factor *= 2) {
+                ref->fill_entropy[type](&shape, 0, 0, W + H + 1, 1, expected);
+                memcpy(actual, expected, bpp * N); // NOLINT
+                ref->bin[type](expected, W, H, factor);
+                k->bin[type](actual, W, H, factor);
+                EXPECT(max_abs_diff(type,
+                                    expected,
+                                    actual,
+                                    N / (factor * factor)) <=
+                         (type == SampleType_u8    ? 1
+                          : type == SampleType_f32 ? 1e-3
+                                                   : 0),
+                       "%s bin: mismatch for type %d, factor %d",
+                       simd_isa_to_string(isa),
+                       (int)type,
+                       factor);
+            }
+        }
+    }
+    free(alloc);
+    return 1;
+Error:
+    free(alloc);
+    return 0;
+}
+
+/// A flat frame of `signal` DN comes out with mean `signal` and variance
+/// `gain * signal + (gain * read_noise_e)^2`: shot noise plus read noise.
+/// Both a signal with Poisson shot noise from the tables and one past
+/// `poisson_lambda_max` electrons, where it's normal, are checked.
+acquire_export int
+unit_test_sensor_noise_statistics()
+{
+    enum
+    {
+        W = 256,
+        H = 256,
+        N = W * H
+    };
+    const float gain = 2.0f, read_noise_e = 3.0f;
+    const float signals[] = { 10.0f, 200.0f };
+    const struct ImageShape shape = {
+        .dims = { .channels = 1, .width = W, .height = H, .planes = 1 },
+        .strides = { .channels = 1, .width = 1, .height = W, .planes = N },
+        .type = SampleType_f32,
+    };
+    float* frame = malloc(sizeof(float) * N);
+    CHECK(frame);
+
+    for (int isa = SimdIsa_Scalar; isa < SimdIsaCount; ++isa) {
+        const struct SimcamKernels* k = simcam_kernels_for(isa);
+        if (!k)
+            continue;
+        for (int is = 0; is < (int)(sizeof(signals) / sizeof(*signals));
+             ++is) {
+            const double signal = signals[is];
+            const double expected_var =
+              gain * signal + (gain * read_noise_e) * (gain * read_noise_e);
+            double sum = 0, sum2 = 0;
+            for (int i = 0; i < N; ++i)
+                frame[i] = (float)signal;
+            k->add_sensor_noise[SampleType_f32](
+              &shape, gain, read_noise_e, 1234 + is, frame);
+            for (int i = 0; i < N; ++i) {
+                sum += frame[i];
+                sum2 += (double)frame[i] * frame[i];
+            }
+            const double mean = sum / N;
+            const double var = sum2 / N - mean * mean;
+            // Five standard errors for the mean. The variance of a sample
+            // this size is good to about 1%, less the tables' resolution.
+            EXPECT(fabs(mean - signal) < 5.0 * sqrt(expected_var / N),
+                   "%s add_sensor_noise: mean %f for a signal of %f",
+                   simd_isa_to_string(isa),
+                   mean,
+                   signal);
+            EXPECT(fabs(var - expected_var) < 0.05 * expected_var,
+                   "%s add_sensor_noise: variance %f, expected %f",
+                   simd_isa_to_string(isa),
+                   var,
+                   expected_var);
+        }
+    }
+    free(frame);
+    return 1;
+Error:
+    free(frame);
+    return 0;
+}
+#endif // NO_UNIT_TESTS
@@ -0,0 +1,92 @@
+#ifndef H_ACQUIRE_DRIVER_BASICS_SIMCAM_KERNELS_V0
+#define H_ACQUIRE_DRIVER_BASICS_SIMCAM_KERNELS_V0
+
+#include "../common/cpu.features.h"
+#include "device/props/components.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/// Kernel sources are compiled once per instruction set (see
+/// `target_simd_kernels()` in cmake/simd.cmake) with `SIMD_ISA` set to the
+/// name of the build. Their entry points are named with `SIMD_NAME()` so the
+/// builds can be linked together, e.g. `SIMD_NAME(im_correct_u8)` is
+/// `im_correct_u8_avx2` in the AVX2 build.
+#define SIMD_CAT_(a, b) a##_##b
+#define SIMD_CAT(a, b) SIMD_CAT_(a, b)
+#define SIMD_NAME(name) SIMD_CAT(name, SIMD_ISA)
+
+    /// The pixel kernels used by the simulated cameras, for one instruction
+    /// set. Per-type entries are indexed by `enum SampleType` and are NULL
+    /// for unsupported types.
+    struct SimcamKernels
+    {
+        /// Uniform random bits, whatever the pixel type.
+        void (*fill_random)(const struct ImageShape* shape,
+                            uint64_t seed,
+                            void* buf);
+
+        void (*fill_pattern[SampleTypeCount])(const struct ImageShape* shape,
+                                              float cx,
+                                              float cy,
+                                              float t,
+                                              void* buf);
+
+        void (*add_sensor_noise[SampleTypeCount])(
+          const struct ImageShape* shape,
+          float gain,
+          float read_noise_e,
+          uint64_t seed,
+          void* buf);
+
+        void (*fill_entropy[SampleTypeCount])(const struct ImageShape* shape,
+                                              unsigned bits,
+                                              uint32_t origin,
+                                              uint32_t extent,
+                                              uint64_t seed,
+                                              void* buf);
+
+        void (*correct[SampleTypeCount])(void* buf,
+                                         const float* dark,
+                                         const float* gain,
+                                         size_t n);
+
+        /// Averages `factor` x `factor` blocks of the contiguous `w` by `h`
+        /// image in place. `factor` is a power of two. For u8, `im` must be
+        /// 32-byte aligned and `w` a multiple of `32 * factor`.
+        void (*bin[SampleTypeCount])(void* im, int w, int h, int factor);
+
+        void (*reverse_copy)(void* dst,
+                             const void* src,
+                             size_t npixels,
+                             size_t bpp);
+
+        void (*reverse_inplace)(void* buf, size_t npixels, size_t bpp);
+    };
+
+    /// Selects the kernels for the rest of the process: the best instruction
+    /// set that was built and that the cpu supports, unless `ACQUIRE_SIMD`
+    /// names another one. Called when the driver is initialized.
+    void simcam_kernels_init(void);
+
+    /// @returns the selected kernels. Calls `simcam_kernels_init()` if that
+    /// hasn't happened yet.
+    const struct SimcamKernels* simcam_kernels(void);
+
+    /// @returns the kernels built for `isa`, or NULL if `isa` wasn't built or
+    /// isn't supported by the cpu.
+    const struct SimcamKernels* simcam_kernels_for(enum SimdIsa isa);
+
+    /// @returns the instruction set of the selected kernels.
+    enum SimdIsa simcam_kernels_isa(void);
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif // H_ACQUIRE_DRIVER_BASICS_SIMCAM_KERNELS_V0
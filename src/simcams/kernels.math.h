@@ -0,0 +1,61 @@
+#ifndef H_ACQUIRE_DRIVER_BASICS_SIMCAM_KERNELS_MATH_V0
+#define H_ACQUIRE_DRIVER_BASICS_SIMCAM_KERNELS_MATH_V0
+
+#include <math.h>
+
+/// Scalar helpers for the C++ kernel sources. Use these instead of their
+/// `std::` counterparts there.
+///
+/// The kernel sources are compiled once per instruction set. An inline
+/// function with external linkage, like `std::min` or `std::floor`, is
+/// emitted by every build that doesn't inline it (e.g. in Debug) as a weak
+/// symbol, and the linker keeps one arbitrary copy for all of them. The
+/// scalar kernels could then call a copy built for AVX-512 and crash on older
+/// cpus. These are `static`, so each build keeps its own.
+///
+/// For the same reason, only read `std::numeric_limits` in constant
+/// expressions, e.g. to initialize a `constexpr` variable.
+
+template<typename T>
+static inline T
+kernel_min(T a, T b)
+{
+    return b < a ? b : a;
+}
+
+template<typename T>
+static inline T
+kernel_max(T a, T b)
+{
+    return a < b ? b : a;
+}
+
+static inline float
+kernel_clamp(float v, float lo, float hi)
+{
+    return v < lo ? lo : hi < v ? hi : v;
+}
+
+// The C functions, not the `std::` overloads. The compiler expands them as
+// builtins where the instruction set allows, and otherwise calls the C
+// library, which doesn't depend on the build.
+
+static inline float
+kernel_floor(float v)
+{
+    return floorf(v);
+}
+
+static inline float
+kernel_nearbyint(float v)
+{
+    return nearbyintf(v);
+}
+
+static inline float
+kernel_sqrt(float v)
+{
+    return sqrtf(v);
+}
+
+#endif // H_ACQUIRE_DRIVER_BASICS_SIMCAM_KERNELS_MATH_V0
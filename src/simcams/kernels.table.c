@@ -0,0 +1,60 @@
+#include "kernels.h"
+
+/// Collects the entry points of one instruction set build into its table.
+/// Compiled once per instruction set, like the kernels themselves.
+
+#define DECLARE(T)                                                             \
+    void SIMD_NAME(im_fill_pattern_##T)(                                       \
+      const struct ImageShape*, float, float, float, void*);                   \
+    void SIMD_NAME(im_add_sensor_noise_##T)(                                   \
+      const struct ImageShape*, float, float, uint64_t, void*);                \
+    void SIMD_NAME(im_fill_entropy_##T)(const struct ImageShape*,              \
+                                        unsigned,                              \
+                                        uint32_t,                              \
+                                        uint32_t,                              \
+                                        uint64_t,                              \
+                                        void*);                                \
+    void SIMD_NAME(im_correct_##T)(                                            \
+      void*, const float*, const float*, size_t);                              \
+    void SIMD_NAME(bin_##T)(void*, int, int, int)
+
+DECLARE(u8);
+DECLARE(i8);
+DECLARE(u16);
+DECLARE(i16);
+DECLARE(f32);
+#undef DECLARE
+
+void
+SIMD_NAME(im_fill_random)(const struct ImageShape* shape,
+                          uint64_t seed,
+                          void* buf);
+
+void
+SIMD_NAME(im_reverse_copy)(void* dst,
+                           const void* src,
+                           size_t npixels,
+                           size_t bpp);
+
+void
+SIMD_NAME(im_reverse_inplace)(void* buf, size_t npixels, size_t bpp);
+
+#define PER_TYPE(f)                                                            \
+    {                                                                          \
+        [SampleType_u8] = SIMD_NAME(f##_u8),                                   \
+        [SampleType_i8] = SIMD_NAME(f##_i8),                                   \
+        [SampleType_u16] = SIMD_NAME(f##_u16),                                 \
+        [SampleType_i16] = SIMD_NAME(f##_i16),                                 \
+        [SampleType_f32] = SIMD_NAME(f##_f32),                                 \
+    }
+
+const struct SimcamKernels SIMD_NAME(simcam_kernel_table) = {
+    .fill_random = SIMD_NAME(im_fill_random),
+    .fill_pattern = PER_TYPE(im_fill_pattern),
+    .add_sensor_noise = PER_TYPE(im_add_sensor_noise),
+    .fill_entropy = PER_TYPE(im_fill_entropy),
+    .correct = PER_TYPE(im_correct),
+    .bin = PER_TYPE(bin),
+    .reverse_copy = SIMD_NAME(im_reverse_copy),
+    .reverse_inplace = SIMD_NAME(im_reverse_inplace),
+};
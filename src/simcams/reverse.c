@@ -0,0 +1,122 @@
+#include "kernels.h"
+#include "../common/frame.copy.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+/// Pixel order reversal for backward readout.
+///
+/// Reversing the pixel order of a whole frame flips it both vertically and
+/// horizontally, which is what a sensor read out from its last pixel
+/// produces. 1, 2 and 4-byte pixels are supported.
+///
+/// With AVX2 each 32-byte block is reversed by a shuffle within the 128-bit
+/// lanes followed by a swap of the lanes (or a single cross-lane permute for
+/// 4-byte pixels). Like `frame_copy()`, large copies use streaming stores.
+
+#ifdef __AVX2__
+static __m256i
+reverse_block(__m256i v, size_t bpp)
+{
+    switch (bpp) {
+        case 1: {
+            const __m256i m = _mm256_setr_epi8(15, 14, 13, 12, 11, 10, 9, 8,
+                                               7, 6, 5, 4, 3, 2, 1, 0,
+                                               15, 14, 13, 12, 11, 10, 9, 8,
+                                               7, 6, 5, 4, 3, 2, 1, 0);
+            return _mm256_permute4x64_epi64(_mm256_shuffle_epi8(v, m), 0x4e);
+        }
+        case 2: {
+            const __m256i m = _mm256_setr_epi8(14, 15, 12, 13, 10, 11, 8, 9,
+                                               6, 7, 4, 5, 2, 3, 0, 1,
+                                               14, 15, 12, 13, 10, 11, 8, 9,
+                                               6, 7, 4, 5, 2, 3, 0, 1);
+            return _mm256_permute4x64_epi64(_mm256_shuffle_epi8(v, m), 0x4e);
+        }
+        default:
+            return _mm256_permutevar8x32_epi32(
+              v, _mm256_setr_epi32(7, 6, 5, 4, 3, 2, 1, 0));
+    }
+}
+#endif
+
+static void
+swap_pixels(uint8_t* a, uint8_t* b, size_t bpp)
+{
+    uint8_t t[4];
+    memcpy(t, a, bpp); // NOLINT
+    memcpy(a, b, bpp); // NOLINT
+    memcpy(b, t, bpp); // NOLINT
+}
+
+/// Writes the `npixels` pixels of `src` to `dst` in reverse order.
+/// `dst` and `src` must not overlap.
+void
+SIMD_NAME(im_reverse_copy)(void* dst_,
+                           const void* src_,
+                           size_t npixels,
+                           size_t bpp)
+{
+    uint8_t* dst = (uint8_t*)dst_;
+    const uint8_t* src = (const uint8_t*)src_ + npixels * bpp;
+    size_t i = 0;
+#ifdef __AVX2__
+    // Align the stores when the pixel size allows it.
+    for (; i < npixels && ((uintptr_t)dst & 31) && ((uintptr_t)dst % bpp) == 0;
+         ++i) {
+        src -= bpp;
+        memcpy(dst, src, bpp); // NOLINT
+        dst += bpp;
+    }
+    const int stream = ((uintptr_t)dst & 31) == 0 &&
+                       npixels * bpp >= frame_copy_threshold();
+    const size_t per_block = 32 / bpp;
+    for (; i + per_block <= npixels; i += per_block) {
+        src -= 32;
+        _mm_prefetch((const char*)src - 1024, _MM_HINT_T0);
+        const __m256i v =
+          reverse_block(_mm256_loadu_si256((const __m256i*)src), bpp);
+        if (stream)
+            _mm256_stream_si256((__m256i*)dst, v);
+        else
+            _mm256_storeu_si256((__m256i*)dst, v);
+        dst += 32;
+    }
+    if (stream)
+        _mm_sfence();
+#endif
+    for (; i < npixels; ++i) {
+        src -= bpp;
+        memcpy(dst, src, bpp); // NOLINT
+        dst += bpp;
+    }
+}
+
+/// Reverses the order of the `npixels` pixels in `buf`.
+void
+SIMD_NAME(im_reverse_inplace)(void* buf, size_t npixels, size_t bpp)
+{
+    uint8_t* lo = (uint8_t*)buf;
+    uint8_t* hi = lo + npixels * bpp;
+#ifdef __AVX2__
+    // Swap blocks from both ends until they would overlap.
+    while (hi - lo >= 64) {
+        hi -= 32;
+        const __m256i a = _mm256_loadu_si256((const __m256i*)lo);
+        const __m256i b = _mm256_loadu_si256((const __m256i*)hi);
+        _mm256_storeu_si256((__m256i*)lo, reverse_block(b, bpp));
+        _mm256_storeu_si256((__m256i*)hi, reverse_block(a, bpp));
+        lo += 32;
+    }
+#endif
+    while (hi - lo >= (ptrdiff_t)(2 * bpp)) {
+        hi -= bpp;
+        swap_pixels(lo, hi, bpp);
+        lo += bpp;
+    }
+}
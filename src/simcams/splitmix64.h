@@ -0,0 +1,20 @@
+#ifndef H_ACQUIRE_DRIVER_BASICS_SIMCAM_SPLITMIX64_V0
+#define H_ACQUIRE_DRIVER_BASICS_SIMCAM_SPLITMIX64_V0
+
+#include <stdint.h>
+
+/// Advances `state` and returns 64 well mixed bits. The simulated cameras
+/// seed their per-lane generators with it.
+///
+/// `static` so that sources built more than once with different compiler
+/// flags each keep their own copy.
+static inline uint64_t
+splitmix64(uint64_t* state)
+{
+    uint64_t z = (*state += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+#endif // H_ACQUIRE_DRIVER_BASICS_SIMCAM_SPLITMIX64_V0
@@ -0,0 +1,321 @@
+#include "crc32c.h"
+
+#include <string.h>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#include <nmmintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define HW_TARGET
+#else
+#include <cpuid.h>
+#define HW_TARGET __attribute__((target("sse4.2")))
+#endif
+#define HAVE_HW 1
+#define CRC_U64(crc, v) ((uint32_t)_mm_crc32_u64((crc), (v)))
+#define CRC_U8(crc, v) _mm_crc32_u8((crc), (v))
+#elif defined(__ARM_FEATURE_CRC32) || defined(_M_ARM64)
+#include <arm_acle.h>
+#define HW_TARGET
+#define HAVE_HW 1
+#define CRC_U64(crc, v) __crc32cd((crc), (v))
+#define CRC_U8(crc, v) __crc32cb((crc), (v))
+#elif defined(__aarch64__) && defined(__linux__)
+// Built for any ARMv8 core. The crc instructions are optional there, so the
+// hardware path is built for them and only taken if the kernel reports them.
+#include <sys/auxv.h>
+#ifndef HWCAP_CRC32
+#define HWCAP_CRC32 (1 << 7)
+#endif
+#define HAVE_HWCAP 1
+#define HAVE_HW 1
+#ifdef __clang__
+#define HW_TARGET __attribute__((target("crc")))
+#define CRC_U64(crc, v) __builtin_arm_crc32cd((crc), (v))
+#define CRC_U8(crc, v) __builtin_arm_crc32cb((crc), (v))
+#else
+#include <arm_acle.h>
+#define HW_TARGET __attribute__((target("+crc")))
+#define CRC_U64(crc, v) __crc32cd((crc), (v))
+#define CRC_U8(crc, v) __crc32cb((crc), (v))
+#endif
+#endif
+
+/// The hardware path runs three independent streams over consecutive lanes
+/// of this many bytes, which hides the latency of the crc instruction, and
+/// then merges their CRCs with `g_shift`.
+#define LANE (8192)
+
+// The state is bit reflected, so the polynomial is 0x82f63b78.
+// `g_table[v]` is the state after a zero state takes in the byte `v`, and
+// `g_shift[j][v]` the state after `v << 4 * j` takes in `LANE` zero bytes.
+// clang-format off
+static const uint32_t g_table[256] = {
+    0x00000000, 0xf26b8303, 0xe13b70f7, 0x1350f3f4, 0xc79a971f, 0x35f1141c,
+    0x26a1e7e8, 0xd4ca64eb, 0x8ad958cf, 0x78b2dbcc, 0x6be22838, 0x9989ab3b,
+    0x4d43cfd0, 0xbf284cd3, 0xac78bf27, 0x5e133c24, 0x105ec76f, 0xe235446c,
+    0xf165b798, 0x030e349b, 0xd7c45070, 0x25afd373, 0x36ff2087, 0xc494a384,
+    0x9a879fa0, 0x68ec1ca3, 0x7bbcef57, 0x89d76c54, 0x5d1d08bf, 0xaf768bbc,
+    0xbc267848, 0x4e4dfb4b, 0x20bd8ede, 0xd2d60ddd, 0xc186fe29, 0x33ed7d2a,
+    0xe72719c1, 0x154c9ac2, 0x061c6936, 0xf477ea35, 0xaa64d611, 0x580f5512,
+    0x4b5fa6e6, 0xb93425e5, 0x6dfe410e, 0x9f95c20d, 0x8cc531f9, 0x7eaeb2fa,
+    0x30e349b1, 0xc288cab2, 0xd1d83946, 0x23b3ba45, 0xf779deae, 0x05125dad,
+    0x1642ae59, 0xe4292d5a, 0xba3a117e, 0x4851927d, 0x5b016189, 0xa96ae28a,
+    0x7da08661, 0x8fcb0562, 0x9c9bf696, 0x6ef07595, 0x417b1dbc, 0xb3109ebf,
+    0xa0406d4b, 0x522bee48, 0x86e18aa3, 0x748a09a0, 0x67dafa54, 0x95b17957,
+    0xcba24573, 0x39c9c670, 0x2a993584, 0xd8f2b687, 0x0c38d26c, 0xfe53516f,
+    0xed03a29b, 0x1f682198, 0x5125dad3, 0xa34e59d0, 0xb01eaa24, 0x42752927,
+    0x96bf4dcc, 0x64d4cecf, 0x77843d3b, 0x85efbe38, 0xdbfc821c, 0x2997011f,
+    0x3ac7f2eb, 0xc8ac71e8, 0x1c661503, 0xee0d9600, 0xfd5d65f4, 0x0f36e6f7,
+    0x61c69362, 0x93ad1061, 0x80fde395, 0x72966096, 0xa65c047d, 0x5437877e,
+    0x4767748a, 0xb50cf789, 0xeb1fcbad, 0x197448ae, 0x0a24bb5a, 0xf84f3859,
+    0x2c855cb2, 0xdeeedfb1, 0xcdbe2c45, 0x3fd5af46, 0x7198540d, 0x83f3d70e,
+    0x90a324fa, 0x62c8a7f9, 0xb602c312, 0x44694011, 0x5739b3e5, 0xa55230e6,
+    0xfb410cc2, 0x092a8fc1, 0x1a7a7c35, 0xe811ff36, 0x3cdb9bdd, 0xceb018de,
+    0xdde0eb2a, 0x2f8b6829, 0x82f63b78, 0x709db87b, 0x63cd4b8f, 0x91a6c88c,
+    0x456cac67, 0xb7072f64, 0xa457dc90, 0x563c5f93, 0x082f63b7, 0xfa44e0b4,
+    0xe9141340, 0x1b7f9043, 0xcfb5f4a8, 0x3dde77ab, 0x2e8e845f, 0xdce5075c,
+    0x92a8fc17, 0x60c37f14, 0x73938ce0, 0x81f80fe3, 0x55326b08, 0xa759e80b,
+    0xb4091bff, 0x466298fc, 0x1871a4d8, 0xea1a27db, 0xf94ad42f, 0x0b21572c,
+    0xdfeb33c7, 0x2d80b0c4, 0x3ed04330, 0xccbbc033, 0xa24bb5a6, 0x502036a5,
+    0x4370c551, 0xb11b4652, 0x65d122b9, 0x97baa1ba, 0x84ea524e, 0x7681d14d,
+    0x2892ed69, 0xdaf96e6a, 0xc9a99d9e, 0x3bc21e9d, 0xef087a76, 0x1d63f975,
+    0x0e330a81, 0xfc588982, 0xb21572c9, 0x407ef1ca, 0x532e023e, 0xa145813d,
+    0x758fe5d6, 0x87e466d5, 0x94b49521, 0x66df1622, 0x38cc2a06, 0xcaa7a905,
+    0xd9f75af1, 0x2b9cd9f2, 0xff56bd19, 0x0d3d3e1a, 0x1e6dcdee, 0xec064eed,
+    0xc38d26c4, 0x31e6a5c7, 0x22b65633, 0xd0ddd530, 0x0417b1db, 0xf67c32d8,
+    0xe52cc12c, 0x1747422f, 0x49547e0b, 0xbb3ffd08, 0xa86f0efc, 0x5a048dff,
+    0x8ecee914, 0x7ca56a17, 0x6ff599e3, 0x9d9e1ae0, 0xd3d3e1ab, 0x21b862a8,
+    0x32e8915c, 0xc083125f, 0x144976b4, 0xe622f5b7, 0xf5720643, 0x07198540,
+    0x590ab964, 0xab613a67, 0xb831c993, 0x4a5a4a90, 0x9e902e7b, 0x6cfbad78,
+    0x7fab5e8c, 0x8dc0dd8f, 0xe330a81a, 0x115b2b19, 0x020bd8ed, 0xf0605bee,
+    0x24aa3f05, 0xd6c1bc06, 0xc5914ff2, 0x37faccf1, 0x69e9f0d5, 0x9b8273d6,
+    0x88d28022, 0x7ab90321, 0xae7367ca, 0x5c18e4c9, 0x4f48173d, 0xbd23943e,
+    0xf36e6f75, 0x0105ec76, 0x12551f82, 0xe03e9c81, 0x34f4f86a, 0xc69f7b69,
+    0xd5cf889d, 0x27a40b9e, 0x79b737ba, 0x8bdcb4b9, 0x988c474d, 0x6ae7c44e,
+    0xbe2da0a5, 0x4c4623a6, 0x5f16d052, 0xad7d5351,
+};
+
+#ifdef HAVE_HW
+static const uint32_t g_shift[8][16] = {
+    { 0x00000000, 0xe040e0ac, 0xc56db7a9, 0x252d5705, 0x8f3719a3,
+      0x6f77f90f, 0x4a5aae0a, 0xaa1a4ea6, 0x1b8245b7, 0xfbc2a51b,
+      0xdeeff21e, 0x3eaf12b2, 0x94b55c14, 0x74f5bcb8, 0x51d8ebbd,
+      0xb1980b11 },
+    { 0x00000000, 0x37048b6e, 0x6e0916dc, 0x590d9db2, 0xdc122db8,
+      0xeb16a6d6, 0xb21b3b64, 0x851fb00a, 0xbdc82d81, 0x8acca6ef,
+      0xd3c13b5d, 0xe4c5b033, 0x61da0039, 0x56de8b57, 0x0fd316e5,
+      0x38d79d8b },
+    { 0x00000000, 0x7e7c2df3, 0xfcf85be6, 0x82847615, 0xfc1cc13d,
+      0x8260ecce, 0x00e49adb, 0x7e98b728, 0xfdd5f48b, 0x83a9d978,
+      0x012daf6d, 0x7f51829e, 0x01c935b6, 0x7fb51845, 0xfd316e50,
+      0x834d43a3 },
+    { 0x00000000, 0xfe479fe7, 0xf963493f, 0x0724d6d8, 0xf72ae48f,
+      0x096d7b68, 0x0e49adb0, 0xf00e3257, 0xebb9bfef, 0x15fe2008,
+      0x12daf6d0, 0xec9d6937, 0x1c935b60, 0xe2d4c487, 0xe5f0125f,
+      0x1bb78db8 },
+    { 0x00000000, 0xd29f092f, 0xa0d264af, 0x724d6d80, 0x4448bfaf,
+      0x96d7b680, 0xe49adb00, 0x3605d22f, 0x88917f5e, 0x5a0e7671,
+      0x28431bf1, 0xfadc12de, 0xccd9c0f1, 0x1e46c9de, 0x6c0ba45e,
+      0xbe94ad71 },
+    { 0x00000000, 0x14ce884d, 0x299d109a, 0x3d5398d7, 0x533a2134,
+      0x47f4a979, 0x7aa731ae, 0x6e69b9e3, 0xa6744268, 0xb2baca25,
+      0x8fe952f2, 0x9b27dabf, 0xf54e635c, 0xe180eb11, 0xdcd373c6,
+      0xc81dfb8b },
+    { 0x00000000, 0x4904f221, 0x9209e442, 0xdb0d1663, 0x21ffbe75,
+      0x68fb4c54, 0xb3f65a37, 0xfaf2a816, 0x43ff7cea, 0x0afb8ecb,
+      0xd1f698a8, 0x98f26a89, 0x6200c29f, 0x2b0430be, 0xf00926dd,
+      0xb90dd4fc },
+    { 0x00000000, 0x87fef9d4, 0x0a118559, 0x8def7c8d, 0x14230ab2,
+      0x93ddf366, 0x1e328feb, 0x99cc763f, 0x28461564, 0xafb8ecb0,
+      0x2257903d, 0xa5a969e9, 0x3c651fd6, 0xbb9be602, 0x36749a8f,
+      0xb18a635b },
+};
+#endif
+// clang-format on
+
+static uint32_t
+crc32c_sw(uint32_t crc, const uint8_t* p, size_t n)
+{
+    for (; n; ++p, --n)
+        crc = (crc >> 8) ^ g_table[(crc ^ *p) & 0xff];
+    return crc;
+}
+
+#ifdef HAVE_HW
+/// @returns the state after `crc` takes in `LANE` zero bytes. The state
+///          after `a` takes in some bytes is that for as many zero bytes,
+///          xor the state after 0 takes in them.
+static uint32_t
+shift(uint32_t crc)
+{
+    uint32_t out = 0;
+    for (int j = 0; j < 8; ++j)
+        out ^= g_shift[j][(crc >> (4 * j)) & 0xf];
+    return out;
+}
+
+static uint64_t
+load64(const uint8_t* p)
+{
+    uint64_t v;
+    memcpy(&v, p, sizeof(v)); // NOLINT
+    return v;
+}
+
+static HW_TARGET uint32_t
+crc32c_hw(uint32_t crc, const uint8_t* p, size_t n)
+{
+    while (n >= 3 * LANE) {
+        uint32_t a = crc, b = 0, c = 0;
+        for (size_t i = 0; i < LANE; i += 8) {
+            a = CRC_U64(a, load64(p + i));
+            b = CRC_U64(b, load64(p + LANE + i));
+            c = CRC_U64(c, load64(p + 2 * LANE + i));
+        }
+        crc = shift(shift(a) ^ b) ^ c;
+        p += 3 * LANE;
+        n -= 3 * LANE;
+    }
+    for (; n >= 8; p += 8, n -= 8)
+        crc = CRC_U64(crc, load64(p));
+    for (; n; ++p, --n)
+        crc = CRC_U8(crc, *p);
+    return crc;
+}
+
+static int
+detect(void)
+{
+#if defined(__x86_64__) || defined(_M_X64)
+    // SSE4.2
+#ifdef _MSC_VER
+    int r[4];
+    __cpuid(r, 1);
+    return (r[2] >> 20) & 1;
+#else
+    unsigned a, b, c, d;
+    return __get_cpuid(1, &a, &b, &c, &d) && ((c >> 20) & 1);
+#endif
+#elif defined(HAVE_HWCAP)
+    return (getauxval(AT_HWCAP) & HWCAP_CRC32) != 0;
+#else
+    return 1;
+#endif
+}
+#endif
+
+int
+crc32c_is_accelerated(void)
+{
+#ifdef HAVE_HW
+    // Thread safety: every caller computes the same value, so it doesn't
+    // matter who wins.
+    static int supported = -1;
+    if (supported < 0)
+        supported = detect();
+    return supported;
+#else
+    return 0;
+#endif
+}
+
+uint32_t
+crc32c(uint32_t crc, const void* data, size_t n)
+{
+    crc = ~crc;
+#ifdef HAVE_HW
+    if (crc32c_is_accelerated())
+        return ~crc32c_hw(crc, data, n);
+#endif
+    return ~crc32c_sw(crc, data, n);
+}
+
+/// @returns `a` times `b` modulo the polynomial. Both are bit reflected like
+///          the state, so `1u << 31` is 1 and `1u << (31 - k)` is x^k.
+static uint32_t
+multiply(uint32_t a, uint32_t b)
+{
+    uint32_t p = 0;
+    for (uint32_t m = 1u << 31; m; m >>= 1) {
+        if (a & m)
+            p ^= b;
+        b = (b >> 1) ^ ((b & 1) ? 0x82f63b78 : 0);
+    }
+    return p;
+}
+
+uint32_t
+crc32c_combine(uint32_t crc_a, uint32_t crc_b, uint64_t nbytes_b)
+{
+    // Taking in a zero byte multiplies the state by x^8. The conditioning
+    // before and after cancels, so crc(ab) = crc(a) x^(8n) + crc(b).
+    uint32_t shift = 1u << 31, square = 1u << 23;
+    for (; nbytes_b; nbytes_b >>= 1) {
+        if (nbytes_b & 1)
+            shift = multiply(square, shift);
+        square = multiply(square, square);
+    }
+    return multiply(shift, crc_a) ^ crc_b;
+}
+
+#ifndef NO_UNIT_TESTS
+#include "device/kit/driver.h"
+#include "logger.h"
+
+#include <stdlib.h>
+
+#define LOGE(...) aq_logger(1, __FILE__, __LINE__, __FUNCTION__, __VA_ARGS__)
+#define EXPECT(e, ...)                                                         \
+    do {                                                                       \
+        if (!(e)) {                                                            \
+            LOGE(__VA_ARGS__);                                                 \
+            goto Error;                                                        \
+        }                                                                      \
+    } while (0)
+
+acquire_export int
+unit_test_crc32c()
+{
+    const size_t cap = 4 * LANE + 100;
+    uint8_t* buf = malloc(cap);
+    uint64_t state = 1;
+    EXPECT(buf, "Allocation failed");
+    EXPECT(crc32c(0, "123456789", 9) == 0xe3069283, "Wrong check value");
+    for (size_t i = 0; i < cap; ++i) {
+        state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+        buf[i] = (uint8_t)(state >> 56);
+    }
+    EXPECT(crc32c(0, buf, 0) == 0, "Wrong CRC of nothing");
+
+    // Unaligned starts, and lengths around the lanes of the hardware path,
+    // against the table. Then in two pieces, continued and combined.
+    const size_t lengths[] = { 1, 7, 8, 9, 1000, 3 * LANE - 1, 3 * LANE,
+                               3 * LANE + 13, 4 * LANE };
+    for (size_t k = 0; k < sizeof(lengths) / sizeof(*lengths); ++k) {
+        for (size_t at = 0; at < 4; ++at) {
+            const size_t n = lengths[k];
+            const uint32_t expected = ~crc32c_sw(~0u, buf + at, n);
+            EXPECT(crc32c(0, buf + at, n) == expected,
+                   "Wrong CRC of %d bytes at %d",
+                   (int)n,
+                   (int)at);
+            const size_t m = n / 3;
+            EXPECT(crc32c(crc32c(0, buf + at, m), buf + at + m, n - m) ==
+                     expected,
+                   "Wrong CRC of %d bytes in two pieces",
+                   (int)n);
+            EXPECT(crc32c_combine(crc32c(0, buf + at, m),
+                                  crc32c(0, buf + at + m, n - m),
+                                  n - m) == expected,
+                   "Wrong combined CRC of %d bytes",
+                   (int)n);
+        }
+    }
+    free(buf);
+    return 1;
+Error:
+    free(buf);
+    return 0;
+}
+#endif // NO_UNIT_TESTS
@@ -0,0 +1,38 @@
+#ifndef H_ACQUIRE_DRIVER_BASICS_STORAGE_CRC32C_V0
+#define H_ACQUIRE_DRIVER_BASICS_STORAGE_CRC32C_V0
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    /// CRC-32C (Castagnoli), the checksum of iSCSI, ext4 and btrfs, for
+    /// checking that frames read back are the frames that were written.
+    ///
+    /// Uses the SSE4.2 crc32 instruction or the ARMv8 CRC instructions when
+    /// the cpu has them. They're detected at run time on x86-64 and on
+    /// Linux on ARMv8, and assumed when the compiler targets them (e.g.
+    /// `-march=armv8-a+crc`, and on Apple silicon). Otherwise it falls back
+    /// to a table, which is much slower.
+    ///
+    /// Like the reader, this doesn't depend on the rest of the driver.
+
+    /// @returns the CRC of `[data,data+n)`. Pass 0 for `crc`, or the CRC of
+    ///          the bytes that came before them to continue it.
+    uint32_t crc32c(uint32_t crc, const void* data, size_t n);
+
+    /// @returns the CRC of the bytes of `a` followed by the `nbytes_b` bytes
+    ///          of `b`, given their CRCs, so pieces can be done in parallel.
+    uint32_t crc32c_combine(uint32_t crc_a, uint32_t crc_b, uint64_t nbytes_b);
+
+    /// @returns 1 if `crc32c()` uses crc instructions, otherwise 0.
+    int crc32c_is_accelerated(void);
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif // H_ACQUIRE_DRIVER_BASICS_STORAGE_CRC32C_V0
@@ -0,0 +1,504 @@
+#ifdef __linux__
+#define _GNU_SOURCE // fallocate
+#endif
+
+#include "io.h"
+#include "io.uring.h"
+#include "io.direct.h"
+#include "../common/options.h"
+#include "platform.h"
+#include "logger.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __linux__
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#endif
+
+#define LOG(...) aq_logger(0, __FILE__, __LINE__, __FUNCTION__, __VA_ARGS__)
+#define LOGE(...) aq_logger(1, __FILE__, __LINE__, __FUNCTION__, __VA_ARGS__)
+#define EXPECT(e, ...)                                                         \
+    do {                                                                       \
+        if (!(e)) {                                                            \
+            LOGE(__VA_ARGS__);                                                 \
+            goto Error;                                                        \
+        }                                                                      \
+    } while (0)
+#define CHECK(e) EXPECT(e, "Expression evaluated as false:\n\t%s", #e)
+
+struct IoFile
+{
+    enum IoEngine engine;
+    struct file file;           ///< IoEngine_Sync
+    struct UringWriter* uring;  ///< IoEngine_Uring
+    struct DirectWriter* direct; ///< IoEngine_Sync with direct I/O
+    int failed;
+
+    uint64_t preallocate_bytes; ///< 0 once preallocation is off
+    uint64_t allocated;         ///< bytes reserved so far
+    uint64_t end;               ///< largest offset written
+};
+
+/// @returns the descriptor of the open file, or -1 where there's none.
+static int
+io_file_fd(const struct IoFile* self)
+{
+    if (self->uring)
+        return uring_writer_fd(self->uring);
+    if (self->direct)
+        return direct_writer_fd(self->direct);
+#ifdef __linux__
+    return self->file.fid;
+#else
+    return -1;
+#endif
+}
+
+/// Reserves space for writes up to `end`, a whole number of extents at a
+/// time. Failing to reserve isn't an error. It only turns preallocation off.
+///
+/// The file's size isn't changed, so while it's being written it never looks
+/// longer than the data in it, and a crash doesn't leave a tail of zeros.
+static void
+preallocate(struct IoFile* self, uint64_t end)
+{
+#ifdef __linux__
+    const uint64_t extent = self->preallocate_bytes;
+    const uint64_t target = (end + extent - 1) / extent * extent;
+    const int fd = io_file_fd(self);
+    int r;
+    while ((r = fallocate(fd,
+                          FALLOC_FL_KEEP_SIZE,
+                          (off_t)self->allocated,
+                          (off_t)(target - self->allocated))) < 0 &&
+           errno == EINTR)
+        ;
+    if (r == 0) {
+        self->allocated = target;
+        return;
+    }
+    LOG("Couldn't preallocate space: %s. Continuing without.",
+        strerror(errno));
+#endif
+    self->preallocate_bytes = 0;
+}
+
+/// Drops the space preallocated beyond the last write.
+static int
+trim(struct IoFile* self)
+{
+#ifdef __linux__
+    if (self->allocated > self->end &&
+        ftruncate(io_file_fd(self), (off_t)self->end) < 0) {
+        LOGE("Failed to trim preallocated space: %s", strerror(errno));
+        return 0;
+    }
+#endif
+    return 1;
+}
+
+const char*
+io_engine_to_string(enum IoEngine engine)
+{
+    switch (engine) {
+        case IoEngine_Sync:
+            return "sync";
+        case IoEngine_Uring:
+            return "uring";
+        default:
+            return "(unknown)";
+    }
+}
+
+enum IoEngine
+io_engine_from_options(const char* name)
+{
+    const char* value = options_get_string(name);
+    if (!value)
+        return IoEngine_Sync;
+    for (int i = 0; i < IoEngineCount; ++i)
+        if (!strcmp(value, io_engine_to_string((enum IoEngine)i)))
+            return (enum IoEngine)i;
+    LOGE("Unknown %s \"%s\". Expected sync or uring. Using sync.", name, value);
+    return IoEngine_Sync;
+}
+
+static void
+get_buffer_options(int64_t* depth, int64_t* buffer_mib)
+{
+    *depth = 8;
+    *buffer_mib = 4;
+    options_get_int("ACQUIRE_STORAGE_IO_DEPTH", depth);
+    options_get_int("ACQUIRE_STORAGE_IO_BUFFER_MIB", buffer_mib);
+    if (*depth < 1 || *depth > 1024)
+        *depth = 8;
+    if (*buffer_mib < 1 || *buffer_mib > 1024)
+        *buffer_mib = 4;
+}
+
+static struct UringWriter*
+open_uring(const char* path, int direct)
+{
+    int64_t depth, buffer_mib;
+    get_buffer_options(&depth, &buffer_mib);
+    if (direct && depth < 2)
+        depth = 2;
+    struct UringWriter* out = uring_writer_create(path,
+                                                  (unsigned)depth,
+                                                  (size_t)buffer_mib << 20,
+                                                  direct ? IO_DIRECT_ALIGN : 0);
+    if (out)
+        LOG("Writing \"%s\" with io_uring%s: %d writes of up to %d MiB in "
+            "flight.",
+            path,
+            direct ? " and direct I/O" : "",
+            (int)depth,
+            (int)buffer_mib);
+    return out;
+}
+
+static struct DirectWriter*
+open_direct(const char* path)
+{
+    int64_t depth, buffer_mib;
+    get_buffer_options(&depth, &buffer_mib);
+    struct DirectWriter* out =
+      direct_writer_create(path, (size_t)buffer_mib << 20);
+    if (out)
+        LOG("Writing \"%s\" with direct I/O through a %d MiB buffer.",
+            path,
+            (int)buffer_mib);
+    return out;
+}
+
+struct IoFile*
+io_file_create(const char* filename,
+               size_t bytes_of_filename,
+               const struct IoFileOptions* options)
+{
+    struct IoFile* self = 0;
+    char* path = 0;
+    enum IoEngine engine = options->engine;
+    const int direct = options->direct;
+    CHECK(self = malloc(sizeof(*self)));
+    memset(self, 0, sizeof(*self)); // NOLINT
+
+    // The platform api takes counted strings, open() wants a terminated one.
+    CHECK(path = malloc(bytes_of_filename + 1));
+    memcpy(path, filename, bytes_of_filename); // NOLINT
+    path[bytes_of_filename] = '\0';
+
+    if (engine == IoEngine_Uring && !(self->uring = open_uring(path, direct))) {
+        LOGE("io_uring isn't available. Writing \"%s\" synchronously.", path);
+        engine = IoEngine_Sync;
+    }
+    self->engine = engine;
+    if (engine == IoEngine_Sync && direct &&
+        !(self->direct = open_direct(path)))
+        LOGE("Direct I/O isn't available. Writing \"%s\" through the page "
+             "cache.",
+             path);
+    if (engine == IoEngine_Sync && !self->direct)
+        CHECK(file_create(&self->file, filename, bytes_of_filename));
+    self->preallocate_bytes = options->preallocate_bytes;
+    free(path);
+    return self;
+Error:
+    free(path);
+    free(self);
+    return 0;
+}
+
+int
+io_file_write(struct IoFile* self,
+              uint64_t offset,
+              const uint8_t* beg,
+              const uint8_t* end)
+{
+    if (self->failed)
+        return 0;
+    const uint64_t last = offset + (uint64_t)(end - beg);
+    if (self->preallocate_bytes && last > self->allocated)
+        preallocate(self, last);
+    if (last > self->end)
+        self->end = last;
+    int ok;
+    if (self->uring)
+        ok = uring_writer_write(self->uring, offset, beg, end);
+    else if (self->direct)
+        ok = direct_writer_write(self->direct, offset, beg, end);
+    else
+        ok = file_write(&self->file, offset, beg, end);
+    self->failed = !ok;
+    return ok;
+}
+
+#ifdef __linux__
+/// Writes `spans` from `offset` with as few `pwritev()` calls as it takes,
+/// picking up after short writes.
+static int
+pwrite_spans(int fd,
+             uint64_t offset,
+             const struct IoSpan* spans,
+             size_t nspans)
+{
+    struct iovec iov[256];
+    size_t skip = 0; // bytes of spans[0] already written
+    for (;;) {
+        while (nspans && (size_t)(spans->end - spans->beg) == skip) {
+            ++spans;
+            --nspans;
+            skip = 0;
+        }
+        if (!nspans)
+            return 1;
+        int n = 0;
+        size_t bytes = 0;
+        for (; n < (int)(sizeof(iov) / sizeof(*iov)) && (size_t)n < nspans;
+             ++n) {
+            const uint8_t* beg = spans[n].beg + (n ? 0 : skip);
+            iov[n].iov_base = (void*)beg;
+            iov[n].iov_len = (size_t)(spans[n].end - beg);
+            bytes += iov[n].iov_len;
+        }
+        const ssize_t r = pwritev(fd, iov, n, (off_t)offset);
+        if (r < 0 && errno == EINTR)
+            continue;
+        if (r <= 0) {
+            LOGE("Failed to write %llu bytes at offset %llu: %s",
+                 (unsigned long long)bytes,
+                 (unsigned long long)offset,
+                 r < 0 ? strerror(errno) : "nothing written");
+            return 0;
+        }
+        offset += (uint64_t)r;
+        for (size_t left = (size_t)r; left;) {
+            const size_t rest = (size_t)(spans->end - spans->beg) - skip;
+            if (left < rest) {
+                skip += left;
+                break;
+            }
+            left -= rest;
+            ++spans;
+            --nspans;
+            skip = 0;
+        }
+    }
+}
+#endif
+
+int
+io_file_writev(struct IoFile* self,
+               uint64_t offset,
+               const struct IoSpan* spans,
+               size_t nspans)
+{
+    if (self->failed)
+        return 0;
+    uint64_t last = offset;
+    for (size_t i = 0; i < nspans; ++i)
+        last += (uint64_t)(spans[i].end - spans[i].beg);
+    if (self->preallocate_bytes && last > self->allocated)
+        preallocate(self, last);
+    if (last > self->end)
+        self->end = last;
+    int ok = 1;
+#ifdef __linux__
+    if (!self->uring && !self->direct) {
+        ok = pwrite_spans(io_file_fd(self), offset, spans, nspans);
+        self->failed = !ok;
+        return ok;
+    }
+#endif
+    // The other engines stage writes, and merge consecutive ones.
+    for (size_t i = 0; ok && i < nspans; ++i) {
+        const uint8_t *beg = spans[i].beg, *end = spans[i].end;
+        if (beg == end)
+            continue;
+        if (self->uring)
+            ok = uring_writer_write(self->uring, offset, beg, end);
+        else if (self->direct)
+            ok = direct_writer_write(self->direct, offset, beg, end);
+        else
+            ok = file_write(&self->file, offset, beg, end);
+        offset += (uint64_t)(end - beg);
+    }
+    self->failed = !ok;
+    return ok;
+}
+
+int
+io_file_flush(struct IoFile* self)
+{
+    if (self->uring && !uring_writer_flush(self->uring))
+        self->failed = 1;
+    if (self->direct && !direct_writer_flush(self->direct))
+        self->failed = 1;
+    return !self->failed;
+}
+
+int
+io_file_close(struct IoFile* self)
+{
+    if (!self)
+        return 1;
+    // The direct writers' last block is padded when they're destroyed, and
+    // they trim it afterwards. Everything else must be on disk before trim().
+    int ok = (self->uring ? uring_writer_flush(self->uring) : 1) &&
+             !self->failed;
+    ok = trim(self) && ok;
+    if (self->uring)
+        ok = uring_writer_destroy(self->uring) && ok;
+    else if (self->direct)
+        ok = direct_writer_destroy(self->direct) && ok;
+    else
+        file_close(&self->file);
+    free(self);
+    return ok;
+}
+
+enum IoEngine
+io_file_engine(const struct IoFile* self)
+{
+    return self->engine;
+}
+
+#ifndef NO_UNIT_TESTS
+#include "device/kit/driver.h"
+
+#include <stdio.h>
+
+/// Writes in odd sizes, some spanning staging buffers, some out of order,
+/// then rewrites a range after a flush.
+static int
+write_test_file(const char* path,
+                const struct IoFileOptions* options,
+                const uint8_t* in)
+{
+    struct IoFile* f = 0;
+    const size_t n = 3 << 20;
+    CHECK(f = io_file_create(path, strlen(path), options));
+    size_t at = 4096;
+    for (size_t step = 1; at < n; step = step * 3 + 7) {
+        const size_t end = at + step < n ? at + step : n;
+        CHECK(io_file_write(f, at, in + at, in + end));
+        at = end;
+    }
+    // The first block goes in more spans than one pwritev() takes, the
+    // shortest of them empty.
+    struct IoSpan spans[300];
+    const size_t nspans = sizeof(spans) / sizeof(*spans);
+    for (size_t i = 0; i < nspans; ++i)
+        spans[i] = (struct IoSpan){
+            .beg = in + i * i * 4096 / (nspans * nspans),
+            .end = in + (i + 1) * (i + 1) * 4096 / (nspans * nspans),
+        };
+    CHECK(io_file_writev(f, 0, spans, nspans));
+    CHECK(io_file_flush(f));
+    CHECK(io_file_write(f, 100, in + 5000, in + 5100));
+    return io_file_close(f);
+Error:
+    io_file_close(f);
+    return 0;
+}
+
+/// Sequential writes in odd sizes with a flush part way, so the direct
+/// writers carry partial blocks, then a file size that isn't whole blocks.
+static int
+write_direct_test_file(const char* path,
+                       const struct IoFileOptions* options,
+                       const uint8_t* in,
+                       size_t n)
+{
+    struct IoFile* f = 0;
+    CHECK(f = io_file_create(path, strlen(path), options));
+    size_t at = 0;
+    for (size_t step = 5; at < n; step = step * 3 + 1) {
+        const size_t end = at + step < n ? at + step : n;
+        CHECK(io_file_write(f, at, in + at, in + end));
+        at = end;
+        if (step > 1000 && step < 10000)
+            CHECK(io_file_flush(f));
+    }
+    return io_file_close(f);
+Error:
+    io_file_close(f);
+    return 0;
+}
+
+static int
+read_test_file(const char* path, uint8_t* out, size_t nbytes)
+{
+    FILE* fp = fopen(path, "rb");
+    if (!fp)
+        return 0;
+    const size_t n = fread(out, 1, nbytes + 1, fp);
+    fclose(fp);
+    return n == nbytes;
+}
+
+acquire_export int
+unit_test_io_engines_agree()
+{
+    const size_t n = 3 << 20;
+    const char* paths[] = { "io-test.sync.bin", "io-test.uring.bin" };
+    uint8_t *in = 0, *out = 0;
+    int ok = 0;
+    CHECK(in = malloc(n));
+    CHECK(out = malloc(n + 1));
+    for (size_t i = 0; i < n; ++i)
+        in[i] = (uint8_t)(i * 31 + (i >> 12));
+
+    // Preallocated space past the last write must be trimmed.
+    for (int i = 0; i < 2 * IoEngineCount; ++i) {
+        const int e = i % IoEngineCount;
+        const struct IoFileOptions options = {
+            .engine = (enum IoEngine)e,
+            .preallocate_bytes = i < IoEngineCount ? 0 : 1 << 20,
+        };
+        CHECK(write_test_file(paths[e], &options, in));
+        CHECK(read_test_file(paths[e], out, n));
+        CHECK(memcmp(out, in, 100) == 0);
+        CHECK(memcmp(out + 100, in + 5000, 100) == 0);
+        CHECK(memcmp(out + 200, in + 200, n - 200) == 0);
+    }
+    // Space reserved ahead of the writes doesn't show in the file's size.
+    for (int e = 0; e < IoEngineCount; ++e) {
+        const struct IoFileOptions options = {
+            .engine = (enum IoEngine)e,
+            .preallocate_bytes = 1 << 20,
+        };
+        struct IoFile* f = 0;
+        CHECK(f = io_file_create(paths[e], strlen(paths[e]), &options));
+        const int sized = io_file_write(f, 0, in, in + 1000) &&
+                          io_file_flush(f) &&
+                          read_test_file(paths[e], out, 1000);
+        CHECK(io_file_close(f) && sized);
+    }
+    // Falls back to buffered writes where the file system can't do direct
+    // I/O. Either way the file must hold exactly the bytes written.
+    for (int i = 0; i < 2 * IoEngineCount; ++i) {
+        const int e = i % IoEngineCount;
+        const struct IoFileOptions options = {
+            .engine = (enum IoEngine)e,
+            .direct = 1,
+            .preallocate_bytes = i < IoEngineCount ? 0 : 1 << 20,
+        };
+        const size_t m = n - 4096 + 123;
+        CHECK(write_direct_test_file(paths[e], &options, in, m));
+        CHECK(read_test_file(paths[e], out, m));
+        CHECK(memcmp(out, in, m) == 0);
+    }
+    ok = 1;
+Error:
+    for (int e = 0; e < IoEngineCount; ++e)
+        remove(paths[e]);
+    free(in);
+    free(out);
+    return ok;
+}
+#endif
@@ -0,0 +1,200 @@
+#ifdef __linux__
+#define _GNU_SOURCE // O_DIRECT
+#endif
+
+#include "io.direct.h"
+#include "logger.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define LOG(...) aq_logger(0, __FILE__, __LINE__, __FUNCTION__, __VA_ARGS__)
+#define LOGE(...) aq_logger(1, __FILE__, __LINE__, __FUNCTION__, __VA_ARGS__)
+#define EXPECT(e, ...)                                                         \
+    do {                                                                       \
+        if (!(e)) {                                                            \
+            LOGE(__VA_ARGS__);                                                 \
+            goto Error;                                                        \
+        }                                                                      \
+    } while (0)
+#define CHECK(e) EXPECT(e, "Expression evaluated as false:\n\t%s", #e)
+
+#ifdef __linux__
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+struct DirectWriter
+{
+    int fd;
+    uint8_t* buf; ///< page aligned
+    size_t buffer_bytes;
+    size_t len;      ///< bytes staged in `buf`
+    uint64_t offset; ///< file offset of `buf[0]`, always aligned
+    int failed;
+};
+
+/// Writes the first `nbytes` of the staging buffer, a multiple of the block
+/// size, at `self->offset`.
+static int
+write_out(struct DirectWriter* self, size_t nbytes)
+{
+    const uint8_t* p = self->buf;
+    uint64_t offset = self->offset;
+    while (nbytes) {
+        const ssize_t r = pwrite(self->fd, p, nbytes, (off_t)offset);
+        if (r < 0 && errno == EINTR)
+            continue;
+        EXPECT(r > 0,
+               "Direct write of %llu bytes at offset %llu failed: %s",
+               (unsigned long long)nbytes,
+               (unsigned long long)offset,
+               r < 0 ? strerror(errno) : "no progress");
+        p += r;
+        offset += (uint64_t)r;
+        nbytes -= (size_t)r;
+    }
+    return 1;
+Error:
+    self->failed = 1;
+    return 0;
+}
+
+struct DirectWriter*
+direct_writer_create(const char* path, size_t buffer_bytes)
+{
+    struct DirectWriter* self = 0;
+    CHECK(buffer_bytes && buffer_bytes % IO_DIRECT_ALIGN == 0);
+    CHECK(self = malloc(sizeof(*self)));
+    memset(self, 0, sizeof(*self)); // NOLINT
+    self->buffer_bytes = buffer_bytes;
+    EXPECT((self->fd = open(path,
+                            O_WRONLY | O_CREAT | O_TRUNC | O_DIRECT,
+                            0666)) >= 0,
+           "Failed to open \"%s\" for direct I/O: %s",
+           path,
+           strerror(errno));
+    EXPECT(!posix_memalign((void**)&self->buf, IO_DIRECT_ALIGN, buffer_bytes),
+           "Failed to allocate a %llu byte staging buffer.",
+           (unsigned long long)buffer_bytes);
+    return self;
+Error:
+    if (self && self->fd >= 0)
+        close(self->fd);
+    free(self);
+    return 0;
+}
+
+int
+direct_writer_write(struct DirectWriter* self,
+                    uint64_t offset,
+                    const uint8_t* beg,
+                    const uint8_t* end)
+{
+    if (self->failed)
+        return 0;
+    EXPECT(offset == self->offset + self->len,
+           "Direct writes must be sequential. Expected offset %llu, got %llu.",
+           (unsigned long long)(self->offset + self->len),
+           (unsigned long long)offset);
+    while (beg < end) {
+        size_t n = self->buffer_bytes - self->len;
+        if (n > (size_t)(end - beg))
+            n = (size_t)(end - beg);
+        memcpy(self->buf + self->len, beg, n); // NOLINT
+        self->len += n;
+        beg += n;
+        if (self->len == self->buffer_bytes) {
+            CHECK(write_out(self, self->len));
+            self->offset += self->len;
+            self->len = 0;
+        }
+    }
+    return 1;
+Error:
+    self->failed = 1;
+    return 0;
+}
+
+int
+direct_writer_flush(struct DirectWriter* self)
+{
+    const size_t whole = self->len - self->len % IO_DIRECT_ALIGN;
+    if (self->failed || !whole)
+        return !self->failed;
+    CHECK(write_out(self, whole));
+    memmove(self->buf, self->buf + whole, self->len - whole); // NOLINT
+    self->offset += whole;
+    self->len -= whole;
+    return 1;
+Error:
+    return 0;
+}
+
+int
+direct_writer_fd(const struct DirectWriter* self)
+{
+    return self->fd;
+}
+
+int
+direct_writer_destroy(struct DirectWriter* self)
+{
+    if (!self)
+        return 1;
+    if (self->len && !self->failed) {
+        const uint64_t size = self->offset + self->len;
+        const size_t rem = self->len % IO_DIRECT_ALIGN;
+        const size_t pad = rem ? IO_DIRECT_ALIGN - rem : 0;
+        memset(self->buf + self->len, 0, pad); // NOLINT
+        if (write_out(self, self->len + pad) && pad &&
+            ftruncate(self->fd, (off_t)size) < 0) {
+            LOGE("Failed to trim the padding from a direct write: %s",
+                 strerror(errno));
+            self->failed = 1;
+        }
+    }
+    const int ok = !self->failed;
+    close(self->fd);
+    free(self->buf);
+    free(self);
+    return ok;
+}
+
+#else
+
+struct DirectWriter*
+direct_writer_create(const char* path, size_t buffer_bytes)
+{
+    LOGE("Direct I/O is only available on Linux.");
+    return 0;
+}
+
+int
+direct_writer_write(struct DirectWriter* self,
+                    uint64_t offset,
+                    const uint8_t* beg,
+                    const uint8_t* end)
+{
+    return 0;
+}
+
+int
+direct_writer_flush(struct DirectWriter* self)
+{
+    return 0;
+}
+
+int
+direct_writer_fd(const struct DirectWriter* self)
+{
+    return -1;
+}
+
+int
+direct_writer_destroy(struct DirectWriter* self)
+{
+    return 1;
+}
+
+#endif
@@ -0,0 +1,49 @@
+#ifndef H_ACQUIRE_DRIVER_BASICS_STORAGE_IO_DIRECT_V0
+#define H_ACQUIRE_DRIVER_BASICS_STORAGE_IO_DIRECT_V0
+
+#include <stddef.h>
+#include <stdint.h>
+
+/// Offsets, lengths and buffer addresses of direct writes are multiples of
+/// this. It covers both 512 byte and 4 KiB sector devices.
+#define IO_DIRECT_ALIGN (4096)
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    /// Sequential writes that bypass the page cache (O_DIRECT), for the
+    /// synchronous engine behind `IoFile`. See io.h.
+    ///
+    /// Bytes are collected in a page-aligned staging buffer and written in
+    /// whole blocks. The last partial block is held back until the writer is
+    /// destroyed, when it's zero padded, written, and the file is trimmed to
+    /// the bytes actually written.
+    struct DirectWriter;
+
+    /// @returns NULL if direct I/O isn't available for `path`, e.g. on a
+    ///          tmpfs, or the setup failed.
+    struct DirectWriter* direct_writer_create(const char* path,
+                                              size_t buffer_bytes);
+
+    /// `offset` must be where the previous write ended.
+    int direct_writer_write(struct DirectWriter* self,
+                            uint64_t offset,
+                            const uint8_t* beg,
+                            const uint8_t* end);
+
+    /// Writes every whole block staged so far.
+    int direct_writer_flush(struct DirectWriter* self);
+
+    /// @returns the file descriptor being written.
+    int direct_writer_fd(const struct DirectWriter* self);
+
+    /// Writes the rest, trims the file and frees the writer. Accepts NULL.
+    int direct_writer_destroy(struct DirectWriter* self);
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif // H_ACQUIRE_DRIVER_BASICS_STORAGE_IO_DIRECT_V0
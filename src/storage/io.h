@@ -0,0 +1,99 @@
+#ifndef H_ACQUIRE_DRIVER_BASICS_STORAGE_IO_V0
+#define H_ACQUIRE_DRIVER_BASICS_STORAGE_IO_V0
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    /// How a storage device's file is written.
+    enum IoEngine
+    {
+        /// Blocking `file_write()` calls, one at a time.
+        IoEngine_Sync,
+        /// Linux io_uring: writes are staged in registered buffers and
+        /// several are kept in flight.
+        IoEngine_Uring,
+        IoEngineCount
+    };
+
+    const char* io_engine_to_string(enum IoEngine engine);
+
+    /// Reads the engine from the variable `name` ("sync" or "uring").
+    /// @returns `IoEngine_Sync` if it isn't set or isn't valid.
+    enum IoEngine io_engine_from_options(const char* name);
+
+    /// An output file written through one of the engines.
+    ///
+    /// Writes may complete out of order and after `io_file_write()`
+    /// returns, so writes to overlapping ranges must be separated by
+    /// `io_file_flush()`. The caller's bytes are copied before it returns.
+    struct IoFile;
+
+    struct IoFileOptions
+    {
+        /// If this engine isn't available `io_file_create()` logs why and
+        /// falls back to `IoEngine_Sync`. The io_uring engine keeps
+        /// `ACQUIRE_STORAGE_IO_DEPTH` writes of up to
+        /// `ACQUIRE_STORAGE_IO_BUFFER_MIB` in flight.
+        enum IoEngine engine;
+
+        /// If not 0 the file is written with direct I/O, bypassing the page
+        /// cache, where the platform and file system allow it. Writes must
+        /// then be sequential, and the last partial block is only written by
+        /// `io_file_close()`.
+        int direct;
+
+        /// If not 0, disk space is reserved ahead of the writes this many
+        /// bytes at a time (Linux `fallocate()`), so the file is laid out in
+        /// large extents. The file is trimmed to what was written when it's
+        /// closed.
+        uint64_t preallocate_bytes;
+    };
+
+    /// Creates (or truncates) the file.
+    /// @returns NULL on failure.
+    struct IoFile* io_file_create(const char* filename,
+                                  size_t bytes_of_filename,
+                                  const struct IoFileOptions* options);
+
+    /// @returns 0 if this or an earlier write failed, otherwise 1.
+    int io_file_write(struct IoFile* self,
+                      uint64_t offset,
+                      const uint8_t* beg,
+                      const uint8_t* end);
+
+    /// A run of the caller's bytes, `[beg,end)`.
+    struct IoSpan
+    {
+        const uint8_t *beg, *end;
+    };
+
+    /// Writes `spans` back to back from `offset`, as one `io_file_write()`
+    /// of their concatenation would. The sync engine hands them to the
+    /// kernel together (`pwritev()` on Linux) instead of one at a time.
+    /// @returns 0 if this or an earlier write failed, otherwise 1.
+    int io_file_writev(struct IoFile* self,
+                       uint64_t offset,
+                       const struct IoSpan* spans,
+                       size_t nspans);
+
+    /// Waits for every write so far to complete.
+    /// @returns 0 if any write failed, otherwise 1.
+    int io_file_flush(struct IoFile* self);
+
+    /// Flushes and closes the file. Accepts NULL.
+    /// @returns 0 if any write failed, otherwise 1.
+    int io_file_close(struct IoFile* self);
+
+    /// @returns the engine actually in use.
+    enum IoEngine io_file_engine(const struct IoFile* self);
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif // H_ACQUIRE_DRIVER_BASICS_STORAGE_IO_V0
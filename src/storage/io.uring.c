@@ -0,0 +1,479 @@
+#ifdef __linux__
+#define _GNU_SOURCE // O_DIRECT
+#endif
+
+#include "io.uring.h"
+#include "logger.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define LOG(...) aq_logger(0, __FILE__, __LINE__, __FUNCTION__, __VA_ARGS__)
+#define LOGE(...) aq_logger(1, __FILE__, __LINE__, __FUNCTION__, __VA_ARGS__)
+#define EXPECT(e, ...)                                                         \
+    do {                                                                       \
+        if (!(e)) {                                                            \
+            LOGE(__VA_ARGS__);                                                 \
+            goto Error;                                                        \
+        }                                                                      \
+    } while (0)
+#define CHECK(e) EXPECT(e, "Expression evaluated as false:\n\t%s", #e)
+
+#ifdef __linux__
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+/// The ring is driven with raw system calls, so there's no dependency on
+/// liburing. One thread submits and reaps; the kernel is the only other
+/// party, so only the ring indices it shares need atomics.
+///
+/// Writes are copied into a staging buffer. Consecutive writes fill the same
+/// buffer, which is submitted when it's full or the next write isn't
+/// contiguous. Buffers and the file are registered with the ring when the
+/// kernel allows, so submissions skip the per-write page pinning and file
+/// lookup. Otherwise plain writes are used.
+
+struct Slot
+{
+    uint64_t offset;
+    uint32_t len;  ///< bytes staged
+    uint32_t done; ///< bytes the kernel has written
+};
+
+struct UringWriter
+{
+    int ring_fd, fd;
+
+    struct
+    {
+        unsigned *head, *tail, *mask, *array;
+        struct io_uring_sqe* sqes;
+    } sq;
+    struct
+    {
+        unsigned *head, *tail, *mask;
+        struct io_uring_cqe* cqes;
+    } cq;
+    void *sq_map, *cq_map;
+    size_t sq_map_bytes, cq_map_bytes, sqes_bytes;
+
+    uint8_t* memory; ///< `nslots` buffers of `buffer_bytes`
+    size_t buffer_bytes;
+    unsigned nslots;
+    struct Slot* slots;
+    unsigned* free; ///< stack of idle slots
+    unsigned nfree;
+    unsigned in_flight;
+    int staged; ///< slot being filled, or -1
+
+    int fixed_buffers, fixed_file;
+    int failed;
+
+    size_t align; ///< O_DIRECT block size, or 0 for buffered writes
+    uint64_t end; ///< where the last write ended, for direct writes
+
+};
+
+static int
+sys_setup(unsigned entries, struct io_uring_params* p)
+{
+    return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int
+sys_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags)
+{
+    return (int)syscall(
+      __NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+static int
+sys_register(int fd, unsigned opcode, const void* arg, unsigned nargs)
+{
+    return (int)syscall(__NR_io_uring_register, fd, opcode, arg, nargs);
+}
+
+static uint8_t*
+buffer(struct UringWriter* self, unsigned slot)
+{
+    return self->memory + (size_t)slot * self->buffer_bytes;
+}
+
+/// Queues the unwritten part of `slot` and tells the kernel.
+static int
+submit(struct UringWriter* self, unsigned slot)
+{
+    const struct Slot* s = self->slots + slot;
+    const unsigned tail = *self->sq.tail;
+    const unsigned i = tail & *self->sq.mask;
+    struct io_uring_sqe* sqe = self->sq.sqes + i;
+    memset(sqe, 0, sizeof(*sqe)); // NOLINT
+    sqe->opcode = self->fixed_buffers ? IORING_OP_WRITE_FIXED : IORING_OP_WRITE;
+    sqe->fd = self->fixed_file ? 0 : self->fd;
+    sqe->flags = self->fixed_file ? IOSQE_FIXED_FILE : 0;
+    sqe->addr = (uint64_t)(uintptr_t)(buffer(self, slot) + s->done);
+    sqe->len = s->len - s->done;
+    sqe->off = s->offset + s->done;
+    sqe->buf_index = self->fixed_buffers ? (uint16_t)slot : 0;
+    sqe->user_data = slot;
+    self->sq.array[i] = i;
+    __atomic_store_n(self->sq.tail, tail + 1, __ATOMIC_RELEASE);
+
+    int r;
+    while ((r = sys_enter(self->ring_fd, 1, 0, 0)) < 0 && errno == EINTR)
+        ;
+    EXPECT(r == 1, "io_uring_enter failed: %s", strerror(errno));
+    return 1;
+Error:
+    self->failed = 1;
+    return 0;
+}
+
+/// Handles the completions that are ready. Short writes are resubmitted.
+static void
+reap(struct UringWriter* self)
+{
+    unsigned head = *self->cq.head;
+    const unsigned tail = __atomic_load_n(self->cq.tail, __ATOMIC_ACQUIRE);
+    for (; head != tail; ++head) {
+        const struct io_uring_cqe* cqe =
+          self->cq.cqes + (head & *self->cq.mask);
+        const unsigned slot = (unsigned)cqe->user_data;
+        struct Slot* s = self->slots + slot;
+        if (cqe->res < 0) {
+            LOGE("Write of %u bytes at offset %llu failed: %s",
+                 s->len - s->done,
+                 (unsigned long long)(s->offset + s->done),
+                 strerror(-cqe->res));
+            self->failed = 1;
+        } else if (cqe->res == 0) {
+            LOGE("Write at offset %llu made no progress.",
+                 (unsigned long long)(s->offset + s->done));
+            self->failed = 1;
+        } else {
+            s->done += (uint32_t)cqe->res;
+            if (s->done < s->len && !self->failed && submit(self, slot))
+                continue; // still in flight
+        }
+        self->free[self->nfree++] = slot;
+        --self->in_flight;
+    }
+    __atomic_store_n(self->cq.head, head, __ATOMIC_RELEASE);
+}
+
+/// Blocks until at least one write completes, then reaps.
+static void
+wait_one(struct UringWriter* self)
+{
+    int r;
+    while ((r = sys_enter(self->ring_fd, 0, 1, IORING_ENTER_GETEVENTS)) < 0 &&
+           errno == EINTR)
+        ;
+    if (r < 0) {
+        LOGE("io_uring_enter failed: %s", strerror(errno));
+        self->failed = 1;
+        return;
+    }
+    reap(self);
+}
+
+/// Direct writes must be whole blocks. Unless this is the `last` write, a
+/// partial block at the end of the staged buffer is carried over to a new
+/// one. The last is zero padded; the file is trimmed afterwards.
+static int
+submit_staged(struct UringWriter* self, int last)
+{
+    if (self->staged < 0)
+        return 1;
+    const unsigned slot = (unsigned)self->staged;
+    struct Slot* s = self->slots + slot;
+    const uint32_t rem = self->align ? s->len % (uint32_t)self->align : 0;
+    if (rem && last) {
+        const uint32_t pad = (uint32_t)self->align - rem;
+        memset(buffer(self, slot) + s->len, 0, pad); // NOLINT
+        s->len += pad;
+    } else if (rem) {
+        if (s->len == rem)
+            return 1; // nothing whole to write yet
+        while (!self->nfree && !self->failed)
+            wait_one(self);
+        if (self->failed)
+            return 0;
+        const unsigned next = self->free[--self->nfree];
+        s->len -= rem;
+        self->slots[next] = (struct Slot){ .offset = s->offset + s->len,
+                                           .len = rem };
+        memcpy(buffer(self, next), buffer(self, slot) + s->len, rem); // NOLINT
+        self->staged = (int)next;
+    }
+    if (!rem || last)
+        self->staged = -1;
+    if (!s->len) {
+        self->free[self->nfree++] = slot;
+        return 1;
+    }
+    ++self->in_flight;
+    return submit(self, slot);
+}
+
+struct UringWriter*
+uring_writer_create(const char* path,
+                    unsigned depth,
+                    size_t buffer_bytes,
+                    size_t align)
+{
+    struct UringWriter* self = 0;
+    struct iovec* iov = 0;
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p)); // NOLINT
+    CHECK(self = malloc(sizeof(*self)));
+    memset(self, 0, sizeof(*self)); // NOLINT
+    self->ring_fd = self->fd = -1;
+    self->staged = -1;
+    self->nslots = depth;
+    self->buffer_bytes = buffer_bytes;
+    self->align = align;
+    // A partial block is carried to a free buffer before the full one goes.
+    CHECK(!align || (depth >= 2 && buffer_bytes % align == 0));
+
+    EXPECT((self->ring_fd = sys_setup(depth, &p)) >= 0,
+           "io_uring_setup failed: %s",
+           strerror(errno));
+    EXPECT(p.sq_entries >= depth, "io_uring queue is too small.");
+
+    self->sq_map_bytes = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    self->cq_map_bytes =
+      p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        if (self->cq_map_bytes > self->sq_map_bytes)
+            self->sq_map_bytes = self->cq_map_bytes;
+        self->cq_map_bytes = 0;
+    }
+    self->sq_map = mmap(0,
+                        self->sq_map_bytes,
+                        PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_POPULATE,
+                        self->ring_fd,
+                        IORING_OFF_SQ_RING);
+    EXPECT(self->sq_map != MAP_FAILED, "mmap failed: %s", strerror(errno));
+    if (self->cq_map_bytes) {
+        self->cq_map = mmap(0,
+                            self->cq_map_bytes,
+                            PROT_READ | PROT_WRITE,
+                            MAP_SHARED | MAP_POPULATE,
+                            self->ring_fd,
+                            IORING_OFF_CQ_RING);
+        EXPECT(self->cq_map != MAP_FAILED, "mmap failed: %s", strerror(errno));
+    } else {
+        self->cq_map = self->sq_map;
+    }
+    self->sqes_bytes = p.sq_entries * sizeof(struct io_uring_sqe);
+    self->sq.sqes = mmap(0,
+                         self->sqes_bytes,
+                         PROT_READ | PROT_WRITE,
+                         MAP_SHARED | MAP_POPULATE,
+                         self->ring_fd,
+                         IORING_OFF_SQES);
+    EXPECT(self->sq.sqes != MAP_FAILED, "mmap failed: %s", strerror(errno));
+
+    {
+        uint8_t* sq = self->sq_map;
+        uint8_t* cq = self->cq_map;
+        self->sq.head = (unsigned*)(sq + p.sq_off.head);
+        self->sq.tail = (unsigned*)(sq + p.sq_off.tail);
+        self->sq.mask = (unsigned*)(sq + p.sq_off.ring_mask);
+        self->sq.array = (unsigned*)(sq + p.sq_off.array);
+        self->cq.head = (unsigned*)(cq + p.cq_off.head);
+        self->cq.tail = (unsigned*)(cq + p.cq_off.tail);
+        self->cq.mask = (unsigned*)(cq + p.cq_off.ring_mask);
+        self->cq.cqes = (struct io_uring_cqe*)(cq + p.cq_off.cqes);
+    }
+
+    EXPECT((self->fd = open(path,
+                            O_WRONLY | O_CREAT | O_TRUNC |
+                              (align ? O_DIRECT : 0),
+                            0666)) >= 0,
+           "Failed to open \"%s\"%s: %s",
+           path,
+           align ? " for direct I/O" : "",
+           strerror(errno));
+
+    // Page aligned, so the buffers also suit O_DIRECT.
+    EXPECT(!posix_memalign(
+             (void**)&self->memory, 4096, (size_t)depth * buffer_bytes),
+           "Failed to allocate %u io buffers of %llu bytes.",
+           depth,
+           (unsigned long long)buffer_bytes);
+    CHECK(self->slots = calloc(depth, sizeof(*self->slots)));
+    CHECK(self->free = malloc(depth * sizeof(*self->free)));
+    for (unsigned i = 0; i < depth; ++i)
+        self->free[self->nfree++] = depth - 1 - i;
+
+    // Registering is an optimization; it can fail e.g. on RLIMIT_MEMLOCK.
+    CHECK(iov = malloc(depth * sizeof(*iov)));
+    for (unsigned i = 0; i < depth; ++i)
+        iov[i] = (struct iovec){ .iov_base = buffer(self, i),
+                                 .iov_len = buffer_bytes };
+    self->fixed_buffers =
+      sys_register(self->ring_fd, IORING_REGISTER_BUFFERS, iov, depth) == 0;
+    if (!self->fixed_buffers)
+        LOG("Couldn't register io_uring buffers (%s). Using plain writes.",
+            strerror(errno));
+    self->fixed_file =
+      sys_register(self->ring_fd, IORING_REGISTER_FILES, &self->fd, 1) == 0;
+    free(iov);
+    return self;
+Error:
+    free(iov);
+    uring_writer_destroy(self);
+    return 0;
+}
+
+int
+uring_writer_write(struct UringWriter* self,
+                   uint64_t offset,
+                   const uint8_t* beg,
+                   const uint8_t* end)
+{
+    reap(self);
+    if (self->align && offset != self->end) {
+        LOGE("Direct writes must be sequential. Expected offset %llu, got "
+             "%llu.",
+             (unsigned long long)self->end,
+             (unsigned long long)offset);
+        self->failed = 1;
+    }
+    while (beg < end && !self->failed) {
+        struct Slot* s = self->staged >= 0 ? self->slots + self->staged : 0;
+        if (!s || s->offset + s->len != offset ||
+            s->len == self->buffer_bytes) {
+            if (!submit_staged(self, 0))
+                break;
+            while (!self->nfree && !self->failed)
+                wait_one(self);
+            if (self->failed)
+                break;
+            self->staged = (int)self->free[--self->nfree];
+            s = self->slots + self->staged;
+            *s = (struct Slot){ .offset = offset };
+        }
+        size_t n = self->buffer_bytes - s->len;
+        if (n > (size_t)(end - beg))
+            n = (size_t)(end - beg);
+        memcpy(buffer(self, (unsigned)self->staged) + s->len, beg, n); // NOLINT
+        s->len += (uint32_t)n;
+        beg += n;
+        offset += n;
+        self->end = offset;
+        if (s->len == self->buffer_bytes && !submit_staged(self, 0))
+            break;
+    }
+    return !self->failed;
+}
+
+/// Waits for everything submitted, after submitting what's staged.
+static int
+drain(struct UringWriter* self, int last)
+{
+    submit_staged(self, last);
+    while (self->in_flight && !self->failed)
+        wait_one(self);
+    // After a failure, still wait for what the kernel holds.
+    while (self->in_flight) {
+        int r = sys_enter(self->ring_fd, 0, 1, IORING_ENTER_GETEVENTS);
+        if (r < 0 && errno != EINTR)
+            break;
+        reap(self);
+    }
+    return !self->failed;
+}
+
+int
+uring_writer_flush(struct UringWriter* self)
+{
+    return drain(self, 0);
+}
+
+int
+uring_writer_fd(const struct UringWriter* self)
+{
+    return self->fd;
+}
+
+int
+uring_writer_destroy(struct UringWriter* self)
+{
+    if (!self)
+        return 1;
+    int ok = 1;
+    if (self->ring_fd >= 0 && self->sq.sqes && self->sq.sqes != MAP_FAILED &&
+        self->fd >= 0 && self->slots && self->free) {
+        ok = drain(self, 1);
+        if (ok && self->align && ftruncate(self->fd, (off_t)self->end) < 0) {
+            LOGE("Failed to trim the padding from a direct write: %s",
+                 strerror(errno));
+            ok = 0;
+        }
+    }
+    if (self->sq.sqes && self->sq.sqes != MAP_FAILED)
+        munmap(self->sq.sqes, self->sqes_bytes);
+    if (self->cq_map_bytes && self->cq_map && self->cq_map != MAP_FAILED)
+        munmap(self->cq_map, self->cq_map_bytes);
+    if (self->sq_map && self->sq_map != MAP_FAILED)
+        munmap(self->sq_map, self->sq_map_bytes);
+    if (self->ring_fd >= 0)
+        close(self->ring_fd);
+    if (self->fd >= 0)
+        close(self->fd);
+    free(self->memory);
+    free(self->slots);
+    free(self->free);
+    free(self);
+    return ok;
+}
+
+#else
+
+struct UringWriter*
+uring_writer_create(const char* path,
+                    unsigned depth,
+                    size_t buffer_bytes,
+                    size_t align)
+{
+    LOGE("io_uring is only available on Linux.");
+    return 0;
+}
+
+int
+uring_writer_write(struct UringWriter* self,
+                   uint64_t offset,
+                   const uint8_t* beg,
+                   const uint8_t* end)
+{
+    return 0;
+}
+
+int
+uring_writer_flush(struct UringWriter* self)
+{
+    return 0;
+}
+
+int
+uring_writer_fd(const struct UringWriter* self)
+{
+    return -1;
+}
+
+int
+uring_writer_destroy(struct UringWriter* self)
+{
+    return 1;
+}
+
+#endif
@@ -0,0 +1,45 @@
+#ifndef H_ACQUIRE_DRIVER_BASICS_STORAGE_IO_URING_V0
+#define H_ACQUIRE_DRIVER_BASICS_STORAGE_IO_URING_V0
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    /// The io_uring engine behind `IoFile`. See io.h.
+    struct UringWriter;
+
+    /// Opens `path` for writing, creating or truncating it, with `depth`
+    /// staging buffers of `buffer_bytes` each.
+    ///
+    /// If `align` isn't 0 the file is opened with O_DIRECT, writes must be
+    /// sequential, and only whole blocks of `align` bytes are submitted. As
+    /// for `DirectWriter` the last partial block is held back until the
+    /// writer is destroyed, then padded and trimmed.
+    /// @returns NULL if io_uring isn't available or the setup failed.
+    struct UringWriter* uring_writer_create(const char* path,
+                                            unsigned depth,
+                                            size_t buffer_bytes,
+                                            size_t align);
+
+    int uring_writer_write(struct UringWriter* self,
+                           uint64_t offset,
+                           const uint8_t* beg,
+                           const uint8_t* end);
+
+    int uring_writer_flush(struct UringWriter* self);
+
+    /// @returns the file descriptor being written.
+    int uring_writer_fd(const struct UringWriter* self);
+
+    /// Flushes, closes the file and frees the writer. Accepts NULL.
+    int uring_writer_destroy(struct UringWriter* self);
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif // H_ACQUIRE_DRIVER_BASICS_STORAGE_IO_URING_V0
@@ -2,9 +2,18 @@
 #include "device/kit/storage.h"
 #include "platform.h"
 #include "logger.h"
+#include "write.queue.h"
+#include "io.h"
+#include "raw.index.h"
+#include "raw.codec.h"
+#include "crc32c.h"
+#include "../common/options.h"
+#include "../common/worker.pool.h"
 
 #include <string.h>
 #include <stdlib.h>
+#include <stdio.h>
+#include <stdarg.h>
 
 #define LOG(...) aq_logger(0, __FILE__, __LINE__, __FUNCTION__, __VA_ARGS__)
 #define LOGE(...) aq_logger(1, __FILE__, __LINE__, __FUNCTION__, __VA_ARGS__)
@@ -21,16 +30,1177 @@
         goto Error;                                                            \
     } while (0)
 
+#define countof(e) (sizeof(e) / sizeof(*(e)))
 #define containerof(ptr, T, V) ((T*)(((char*)(ptr)) - offsetof(T, V)))
 
+/// Appended bytes form one stream. `offset` is a position in it. With
+/// rollover the stream is cut, at frame boundaries, into files of about
+/// `rollover_bytes` named like `out.000.raw`, `out.001.raw`, ...
+///
+/// `raw_append()` decides where the cuts go and queues them in `splits`.
+/// Whoever writes the stream, the write queue's thread or `raw_append()`
+/// itself, opens the next file when it reaches a cut. A cut is always queued
+/// before the bytes after it, so the writer can't pass one.
+///
+/// `raw_append()` also writes the index for each file, see raw.index.h.
+/// Entries are written when frames are appended, so the index can run ahead
+/// of the raw file until the device stops.
+///
+/// With the split layout the stream only holds pixels, each frame's padded
+/// to `RAW_SPLIT_ALIGN`, and the frame headers go to a header file next to
+/// each raw file, written like the index.
+///
+/// With compression, `raw_append()` compresses each batch first and the rest
+/// only sees compressed frames, see raw_compress().
+///
+/// A striped device doesn't write frames itself. It deals them out to a
+/// `Raw` per target directory and keeps a manifest, see raw_start_stripes().
 struct Raw
 {
     struct Storage writer;
     struct StorageProperties properties;
-    struct file file;
-    size_t offset;
+    size_t offset; ///< bytes added to the stream, not counting dropped ones
+
+    /// Writes appended frames from a separate thread. NULL when appends
+    /// write synchronously.
+    struct WriteQueue* queue;
+
+    struct IoFileOptions io;
+    uint64_t rollover_bytes; ///< 0 writes a single file
+    uint64_t file_fill;      ///< bytes appended since the last cut
+    unsigned plan_file;      ///< file the next appended frame goes to
+
+    struct lock lock; ///< guards `splits`
+    struct
+    {
+        uint64_t* offsets;
+        size_t head, end, capacity;
+    } splits;
+
+    // Used by the writer
+    struct IoFile* file;
+    unsigned file_index;
+    uint64_t file_base; ///< stream offset of the open file's first byte
+
+    // Index and headers, used by raw_append()
+    int indexing;
+    int checksumming; ///< index entries get a CRC-32C of the pixels
+    int split;        ///< `ACQUIRE_RAW_LAYOUT=split`
+    struct
+    {
+        unsigned file;
+        struct RawIndexEntry entry;
+        struct VideoFrame header;
+    }* planned; ///< entries for the batch being appended
+    size_t nplanned, planned_capacity;
+    struct WriteQueueSpan* spans; ///< the split batch's pixels and padding
+    size_t nspans, spans_capacity;
+    struct RawSidecar
+    {
+        const char* suffix; ///< appended to the raw file's name
+        struct RawIndexHeader header;
+        struct file file;
+        int is_open;
+        unsigned file_index;
+        uint64_t offset;
+        size_t n; ///< records buffered in `records`
+        uint8_t records[1 << 16];
+    } index, headers;
+
+    // Compression, see raw_compress()
+    struct
+    {
+        int enabled;
+        enum RawShuffle shuffle;
+        uint32_t bytes_per_block;
+        struct WorkerPool* pool;
+        struct RawCodecBlock
+        {
+            const uint8_t* src;
+            uint8_t* dst;
+            uint8_t* scratch;
+            size_t n, nout;
+            unsigned bpe, shuffle;
+        }* blocks;
+        size_t nblocks, blocks_capacity;
+        uint8_t* out; ///< the compressed batch
+        size_t out_capacity;
+        uint8_t* scratch; ///< as big as the batch
+        size_t scratch_capacity;
+        uint64_t bytes_in, bytes_out;
+    } codec;
+
+    // Striping, see raw_start_stripes()
+    int is_target; ///< set on the devices a striped device writes through
+    /// The number of targets splitting `ACQUIRE_RAW_QUEUE_MIB` between them
+    unsigned queue_shares;
+    struct
+    {
+        struct Raw** targets; ///< NULL when not striping
+        unsigned n;
+        unsigned frames_per_stripe;
+        unsigned target; ///< where the next frame goes
+        unsigned frames; ///< frames given to `target` in the current stripe
+        unsigned run_target;
+        uint64_t run_frames; ///< frames in the run not yet in the manifest
+        struct file manifest;
+        int manifest_is_open;
+        uint64_t manifest_offset;
+        size_t len;
+        char text[1 << 16]; ///< manifest text not yet written
+    } stripes;
 };
 
+struct Storage*
+raw_init();
+
+/// @returns the name of file number `index`, or the one file without
+///          rollover, with `suffix` appended. The caller frees it.
+static char*
+raw_file_name(const struct Raw* self, unsigned index, const char* suffix)
+{
+    const char* filename = self->properties.filename.str;
+    const size_t len = strlen(filename);
+    const size_t cap = len + strlen(suffix) + 16;
+    char* name = 0;
+    CHECK(name = malloc(cap));
+    if (!self->rollover_bytes) {
+        snprintf(name, cap, "%s%s", filename, suffix);
+        return name;
+    }
+
+    // out.raw -> out.000.raw
+    size_t stem = len;
+    for (size_t i = len; i > 0; --i) {
+        const char c = filename[i - 1];
+        if (c == '/' || c == '\\')
+            break;
+        if (c == '.') {
+            stem = i - 1;
+            break;
+        }
+    }
+    snprintf(name,
+             cap,
+             "%.*s.%03u%s%s",
+             (int)stem,
+             filename,
+             index,
+             filename + stem,
+             suffix);
+    return name;
+Error:
+    return 0;
+}
+
+/// Opens file number `self->file_index`.
+static int
+raw_open_file(struct Raw* self)
+{
+    char* name = 0;
+    CHECK(name = raw_file_name(self, self->file_index, ""));
+    self->file = io_file_create(name, strlen(name) + 1, &self->io);
+    free(name);
+    CHECK(self->file);
+    return 1;
+Error:
+    return 0;
+}
+
+/// Sidecars are the files next to each raw file, the index and the header
+/// file: a `RawIndexHeader` followed by records of its `bytes_of_entry`.
+
+static int
+raw_sidecar_flush(struct RawSidecar* sidecar)
+{
+    const size_t nbytes = sidecar->n * sidecar->header.bytes_of_entry;
+    CHECK(file_write(&sidecar->file,
+                     sidecar->offset,
+                     sidecar->records,
+                     sidecar->records + nbytes));
+    sidecar->offset += nbytes;
+    sidecar->n = 0;
+    return 1;
+Error:
+    return 0;
+}
+
+static int
+raw_sidecar_close(struct RawSidecar* sidecar)
+{
+    int ok = 1;
+    if (sidecar->is_open) {
+        ok = raw_sidecar_flush(sidecar);
+        file_close(&sidecar->file);
+        sidecar->is_open = 0;
+    }
+    return ok;
+}
+
+static int
+raw_sidecar_open(struct Raw* self,
+                 struct RawSidecar* sidecar,
+                 unsigned file_index)
+{
+    char* name = 0;
+    CHECK(name = raw_file_name(self, file_index, sidecar->suffix));
+    CHECK(file_create(&sidecar->file, name, strlen(name) + 1));
+    free(name);
+    name = 0;
+    sidecar->is_open = 1;
+    sidecar->file_index = file_index;
+    sidecar->n = 0;
+    CHECK(file_write(&sidecar->file,
+                     0,
+                     (const uint8_t*)&sidecar->header,
+                     (const uint8_t*)&sidecar->header +
+                       sizeof(sidecar->header)));
+    sidecar->offset = sizeof(sidecar->header);
+    return 1;
+Error:
+    free(name);
+    return 0;
+}
+
+/// Adds `record` to the sidecar of file number `file_index`.
+static int
+raw_sidecar_add(struct Raw* self,
+                struct RawSidecar* sidecar,
+                unsigned file_index,
+                const void* record)
+{
+    const size_t bytes = sidecar->header.bytes_of_entry;
+    if (!sidecar->is_open || file_index != sidecar->file_index) {
+        CHECK(raw_sidecar_close(sidecar));
+        CHECK(raw_sidecar_open(self, sidecar, file_index));
+    }
+    memcpy(sidecar->records + sidecar->n++ * bytes, record, bytes); // NOLINT
+    if ((sidecar->n + 1) * bytes > sizeof(sidecar->records))
+        CHECK(raw_sidecar_flush(sidecar));
+    return 1;
+Error:
+    return 0;
+}
+
+/// Adds the entries planned for an appended batch to the index, and their
+/// headers to the header file. Index failures don't fail the acquisition.
+/// They turn indexing off.
+/// @returns 0 if the headers could not be written.
+static int
+raw_commit(struct Raw* self)
+{
+    for (size_t i = 0; i < self->nplanned; ++i) {
+        const unsigned file = self->planned[i].file;
+        if (self->indexing &&
+            !raw_sidecar_add(
+              self, &self->index, file, &self->planned[i].entry)) {
+            LOGE("RAW: Failed to write the index. Continuing without it.");
+            raw_sidecar_close(&self->index);
+            self->indexing = 0;
+        }
+        if (self->split)
+            CHECK(raw_sidecar_add(
+              self, &self->headers, file, &self->planned[i].header));
+    }
+    return 1;
+Error:
+    LOGE("RAW: Failed to write the frame headers.");
+    return 0;
+}
+
+/// @returns 1 and the first cut the writer hasn't reached, if any.
+static int
+raw_next_split(struct Raw* self, uint64_t* split)
+{
+    lock_acquire(&self->lock);
+    const int any = self->splits.head < self->splits.end;
+    if (any)
+        *split = self->splits.offsets[self->splits.head];
+    lock_release(&self->lock);
+    return any;
+}
+
+static void
+raw_pop_split(struct Raw* self)
+{
+    lock_acquire(&self->lock);
+    if (++self->splits.head == self->splits.end)
+        self->splits.head = self->splits.end = 0;
+    lock_release(&self->lock);
+}
+
+static int
+raw_push_split(struct Raw* self, uint64_t offset)
+{
+    int ok = 0;
+    lock_acquire(&self->lock);
+    if (self->splits.end == self->splits.capacity) {
+        const size_t capacity =
+          self->splits.capacity ? 2 * self->splits.capacity : 16;
+        uint64_t* offsets = realloc(self->splits.offsets,
+                                    capacity * sizeof(*self->splits.offsets));
+        CHECK(offsets);
+        self->splits.offsets = offsets;
+        self->splits.capacity = capacity;
+    }
+    self->splits.offsets[self->splits.end++] = offset;
+    ok = 1;
+Error:
+    lock_release(&self->lock);
+    return ok;
+}
+
+/// Zeros to pad split frames with.
+static const uint8_t g_zeros[RAW_SPLIT_ALIGN];
+
+/// Adds `[beg,end)` to the spans of the split batch.
+static int
+raw_add_span(struct Raw* self, const uint8_t* beg, const uint8_t* end)
+{
+    if (self->nspans == self->spans_capacity) {
+        const size_t capacity =
+          self->spans_capacity ? 2 * self->spans_capacity : 64;
+        void* spans = realloc(self->spans, capacity * sizeof(*self->spans));
+        CHECK(spans);
+        self->spans = spans;
+        self->spans_capacity = capacity;
+    }
+    self->spans[self->nspans++] = (struct WriteQueueSpan){ beg, end };
+    return 1;
+Error:
+    return 0;
+}
+
+/// Walks the frames of a batch. Queues a cut before each frame that would
+/// take the current file past `rollover_bytes`, and notes where each frame
+/// lands for the index. With the split layout, also lays out the frames'
+/// pixels and padding in `spans`.
+/// @returns the number of cuts queued, or -1 on failure. Sets `nstream` to
+///          the number of bytes the batch adds to the stream.
+static int
+raw_plan(struct Raw* self,
+         const struct VideoFrame* frames,
+         size_t nbytes,
+         uint64_t* nstream)
+{
+    int n = 0;
+    size_t at = 0;
+    uint64_t out = 0;
+    self->nplanned = 0;
+    self->nspans = 0;
+    while (at < nbytes) {
+        const struct VideoFrame* frame =
+          (const struct VideoFrame*)((const uint8_t*)frames + at);
+        size_t bytes = nbytes - at;
+        const int has_header = bytes >= sizeof(*frame) &&
+                               frame->bytes_of_frame >= sizeof(*frame) &&
+                               frame->bytes_of_frame <= bytes;
+        if (has_header)
+            bytes = frame->bytes_of_frame;
+        else if (self->split)
+            break; // nothing to split
+        const size_t npx = bytes - sizeof(*frame);
+        const uint64_t stream_bytes =
+          self->split ? (npx + RAW_SPLIT_ALIGN - 1) / RAW_SPLIT_ALIGN *
+                          RAW_SPLIT_ALIGN
+                      : bytes;
+        if (self->rollover_bytes && self->file_fill &&
+            self->file_fill + stream_bytes > self->rollover_bytes) {
+            CHECK(raw_push_split(self, self->offset + out));
+            self->file_fill = 0;
+            ++self->plan_file;
+            ++n;
+        }
+        if ((self->indexing || self->split) && has_header) {
+            if (self->nplanned == self->planned_capacity) {
+                const size_t capacity =
+                  self->planned_capacity ? 2 * self->planned_capacity : 64;
+                void* planned =
+                  realloc(self->planned, capacity * sizeof(*self->planned));
+                CHECK(planned);
+                self->planned = planned;
+                self->planned_capacity = capacity;
+            }
+            self->planned[self->nplanned].file = self->plan_file;
+            self->planned[self->nplanned].entry = (struct RawIndexEntry){
+                .offset = self->file_fill,
+                .bytes_of_frame = frame->bytes_of_frame,
+                .frame_id = frame->frame_id,
+                .hardware_frame_id = frame->hardware_frame_id,
+                .timestamp_hardware = frame->timestamps.hardware,
+                .timestamp_acq_thread = frame->timestamps.acq_thread,
+                .flags = self->split ? RawIndex_Split : 0,
+            };
+            if (self->checksumming) {
+                struct RawIndexEntry* e = &self->planned[self->nplanned].entry;
+                e->crc32c = crc32c(0, frame->data, npx);
+                e->flags |= RawIndex_Crc32c;
+            }
+            self->planned[self->nplanned].header = *frame;
+            ++self->nplanned;
+        }
+        if (self->split) {
+            CHECK(raw_add_span(self, frame->data, frame->data + npx));
+            if (stream_bytes > npx)
+                CHECK(raw_add_span(
+                  self, g_zeros, g_zeros + (stream_bytes - npx)));
+        }
+        self->file_fill += stream_bytes;
+        out += stream_bytes;
+        at += bytes;
+    }
+    *nstream = out;
+    return n;
+Error:
+    return -1;
+}
+
+/// Forgets the last `n` cuts, planned for a batch that was dropped.
+static void
+raw_unplan_splits(struct Raw* self, int n)
+{
+    lock_acquire(&self->lock);
+    self->splits.end -= (size_t)n;
+    lock_release(&self->lock);
+}
+
+/// Writes `[beg,end)` at stream position `offset`, moving on to the next
+/// file at each cut.
+static int
+raw_write(void* ctx, uint64_t offset, const uint8_t* beg, const uint8_t* end)
+{
+    struct Raw* self = ctx;
+    while (beg < end) {
+        uint64_t split = 0;
+        const int has_split = raw_next_split(self, &split);
+        if (has_split && split == offset) {
+            raw_pop_split(self);
+            const int ok = io_file_close(self->file);
+            self->file = 0;
+            CHECK(ok);
+            ++self->file_index;
+            self->file_base = offset;
+            CHECK(raw_open_file(self));
+            continue;
+        }
+        CHECK(self->file);
+        size_t n = (size_t)(end - beg);
+        if (has_split && split - offset < n)
+            n = (size_t)(split - offset);
+        CHECK(
+          io_file_write(self->file, offset - self->file_base, beg, beg + n));
+        beg += n;
+        offset += n;
+    }
+    return 1;
+Error:
+    return 0;
+}
+
+/// Appends `nbytes` of frames to this device's stream. Sets `dropped` if the
+/// write queue dropped them.
+static int
+raw_append_bytes(struct Raw* self,
+                 const struct VideoFrame* frames,
+                 size_t nbytes,
+                 int* dropped)
+{
+    const uint64_t file_fill = self->file_fill;
+    const unsigned plan_file = self->plan_file;
+    const struct WriteQueueSpan batch = {
+        .beg = (const uint8_t*)frames,
+        .end = (const uint8_t*)frames + nbytes,
+    };
+    uint64_t nstream = nbytes;
+    int nsplits = 0;
+    *dropped = 0;
+    if (self->rollover_bytes || self->indexing || self->split)
+        CHECK((nsplits = raw_plan(self, frames, nbytes, &nstream)) >= 0);
+    const struct WriteQueueSpan* spans = self->split ? self->spans : &batch;
+    const size_t nspans = self->split ? self->nspans : 1;
+    if (self->queue) {
+        CHECK(write_queue_pushv(self->queue, spans, nspans, dropped));
+        if (*dropped) {
+            raw_unplan_splits(self, nsplits);
+            self->file_fill = file_fill;
+            self->plan_file = plan_file;
+            return 1;
+        }
+    } else {
+        uint64_t offset = self->offset;
+        for (size_t i = 0; i < nspans; ++i) {
+            CHECK(raw_write(self, offset, spans[i].beg, spans[i].end));
+            offset += (uint64_t)(spans[i].end - spans[i].beg);
+        }
+    }
+    self->offset += nstream;
+    if (self->indexing || self->split)
+        CHECK(raw_commit(self));
+    return 1;
+Error:
+    return 0;
+}
+
+/// Starts the write-behind queue configured by `ACQUIRE_RAW_QUEUE_MIB` and
+/// `ACQUIRE_RAW_BACKPRESSURE`, unless its size is 0. The size is for the
+/// whole device, so stripe targets each get their share of it.
+static int
+raw_start_queue(struct Raw* self)
+{
+    int64_t mib = 128;
+    options_get_int("ACQUIRE_RAW_QUEUE_MIB", &mib);
+    if (mib <= 0)
+        return 1;
+    if (self->queue_shares > 1) {
+        mib /= self->queue_shares;
+        if (mib < 1)
+            mib = 1;
+    }
+
+    enum WriteQueueBackpressure backpressure = WriteQueue_Block;
+    const char* policy = options_get_string("ACQUIRE_RAW_BACKPRESSURE");
+    if (policy && !strcmp(policy, "drop"))
+        backpressure = WriteQueue_Drop;
+    else if (policy && strcmp(policy, "block"))
+        LOGE("Unknown ACQUIRE_RAW_BACKPRESSURE \"%s\". Expected block or "
+             "drop. Using block.",
+             policy);
+
+    CHECK(self->queue = write_queue_create(
+            (size_t)mib << 20, backpressure, raw_write, self, 0));
+    return 1;
+Error:
+    return 0;
+}
+
+/// Flushes and stops the write-behind queue, if any, and logs how it did.
+/// @returns 0 if any queued write failed.
+static int
+raw_stop_queue(struct Raw* self)
+{
+    if (!self->queue)
+        return 1;
+    struct WriteQueueStats stats = { 0 };
+    const int ok = write_queue_destroy(self->queue, &stats);
+    self->queue = 0;
+    LOG("RAW: %llu appends, %llu dropped. Queue depth: mean %.1f MiB, max "
+        "%.1f MiB. Appends stalled %.1f ms in total, %.1f ms at most. %llu "
+        "writes: mean %.2f ms, max %.2f ms.",
+        (unsigned long long)stats.pushes,
+        (unsigned long long)stats.dropped,
+        stats.mean_depth / (1 << 20),
+        (double)stats.max_depth / (1 << 20),
+        stats.stall_ms,
+        stats.max_stall_ms,
+        (unsigned long long)stats.writes,
+        stats.writes ? stats.write_ms / (double)stats.writes : 0.0,
+        stats.max_write_ms);
+    return ok;
+}
+
+/// Reads `ACQUIRE_RAW_IO`, `ACQUIRE_RAW_DIRECT`, `ACQUIRE_RAW_PREALLOCATE_MIB`,
+/// `ACQUIRE_RAW_ROLLOVER_MIB`, `ACQUIRE_RAW_INDEX`, `ACQUIRE_RAW_CRC32C` and
+/// `ACQUIRE_RAW_LAYOUT`.
+static void
+raw_read_options(struct Raw* self)
+{
+    int64_t direct = 0, preallocate_mib = 0, rollover_mib = 0, index = 0,
+            crc = 0;
+    options_get_int("ACQUIRE_RAW_DIRECT", &direct);
+    options_get_int("ACQUIRE_RAW_CRC32C", &crc);
+    // The index is off unless asked for, or needed to hold the CRC-32Cs.
+    index = crc != 0;
+    options_get_int("ACQUIRE_RAW_INDEX", &index);
+    options_get_int("ACQUIRE_RAW_PREALLOCATE_MIB", &preallocate_mib);
+    options_get_int("ACQUIRE_RAW_ROLLOVER_MIB", &rollover_mib);
+    self->io = (struct IoFileOptions){
+        .engine = io_engine_from_options("ACQUIRE_RAW_IO"),
+        .direct = direct != 0,
+        .preallocate_bytes =
+          preallocate_mib > 0 ? (uint64_t)preallocate_mib << 20 : 0,
+    };
+    self->rollover_bytes = rollover_mib > 0 ? (uint64_t)rollover_mib << 20 : 0;
+    // Rolled files are about `rollover_bytes` long. Reserving more for each
+    // would only be trimmed again when it's closed.
+    if (self->rollover_bytes &&
+        self->io.preallocate_bytes > self->rollover_bytes)
+        self->io.preallocate_bytes = self->rollover_bytes;
+    self->indexing = index != 0;
+    self->checksumming = self->indexing && crc != 0;
+    if (crc && !self->indexing)
+        LOGE("RAW: ACQUIRE_RAW_CRC32C needs the index. Ignoring it.");
+    else if (crc && !crc32c_is_accelerated())
+        LOG("RAW: No crc instructions. CRC-32Cs will be slow to compute.");
+
+    const char* layout = options_get_string("ACQUIRE_RAW_LAYOUT");
+    const char* codec = options_get_string("ACQUIRE_RAW_COMPRESS");
+    self->split = layout && !strcmp(layout, "split");
+    if (layout && !self->split && strcmp(layout, "interleaved"))
+        LOGE("Unknown ACQUIRE_RAW_LAYOUT \"%s\". Expected interleaved or "
+             "split. Using interleaved.",
+             layout);
+    if (self->split && codec && strcmp(codec, "none")) {
+        LOGE("RAW: Compressed frames can't be split. Writing them "
+             "interleaved.");
+        self->split = 0;
+    }
+}
+
+/// Writes out everything appended and closes the files.
+/// @returns 0 if any frames could not be written.
+static int
+raw_finish(struct Raw* self)
+{
+    int ok = raw_stop_queue(self);
+    ok = io_file_close(self->file) && ok;
+    if (!raw_sidecar_close(&self->index))
+        LOGE("RAW: Failed to write the index.");
+    if (!raw_sidecar_close(&self->headers)) {
+        LOGE("RAW: Failed to write the frame headers.");
+        ok = 0;
+    }
+    if (self->file && self->rollover_bytes)
+        LOG("RAW: Wrote %u files.", self->file_index + 1);
+    self->file = 0;
+    return ok;
+}
+
+static int
+raw_manifest_flush(struct Raw* self)
+{
+    const uint8_t* beg = (const uint8_t*)self->stripes.text;
+    CHECK(file_write(&self->stripes.manifest,
+                     self->stripes.manifest_offset,
+                     beg,
+                     beg + self->stripes.len));
+    self->stripes.manifest_offset += self->stripes.len;
+    self->stripes.len = 0;
+    return 1;
+Error:
+    return 0;
+}
+
+/// Adds a line to the manifest.
+static int
+raw_manifest_line(struct Raw* self, const char* fmt, ...)
+{
+    for (int attempt = 0; attempt < 2; ++attempt) {
+        const size_t room = sizeof(self->stripes.text) - self->stripes.len;
+        va_list args;
+        va_start(args, fmt);
+        const int n =
+          vsnprintf(self->stripes.text + self->stripes.len, room, fmt, args);
+        va_end(args);
+        CHECK(n >= 0);
+        if ((size_t)n < room) {
+            self->stripes.len += (size_t)n;
+            return 1;
+        }
+        CHECK(raw_manifest_flush(self));
+    }
+    LOGE("RAW: Line too long for the stripe manifest.");
+Error:
+    return 0;
+}
+
+/// Notes that the next `nframes` frames went to `target`. Consecutive runs
+/// on the same target share a line.
+static int
+raw_manifest_run(struct Raw* self, unsigned target, uint64_t nframes)
+{
+    if (self->stripes.run_frames && self->stripes.run_target != target) {
+        CHECK(raw_manifest_line(self,
+                                "run %u %llu\n",
+                                self->stripes.run_target,
+                                (unsigned long long)self->stripes.run_frames));
+        self->stripes.run_frames = 0;
+    }
+    self->stripes.run_target = target;
+    self->stripes.run_frames += nframes;
+    return 1;
+Error:
+    return 0;
+}
+
+/// @returns `dir` joined with the last component of the device's filename.
+///          The caller frees it.
+static char*
+raw_stripe_file_name(const struct Raw* self, const char* dir, size_t ndir)
+{
+    const char* base = self->properties.filename.str;
+    for (const char* c = base; *c; ++c)
+        if (*c == '/' || *c == '\\')
+            base = c + 1;
+    const int has_separator = dir[ndir - 1] == '/' || dir[ndir - 1] == '\\';
+    const size_t cap = ndir + strlen(base) + 2;
+    char* name = 0;
+    CHECK(name = malloc(cap));
+    snprintf(name,
+             cap,
+             "%.*s%s%s",
+             (int)ndir,
+             dir,
+             has_separator ? "" : "/",
+             base);
+    return name;
+Error:
+    return 0;
+}
+
+/// @returns the absolute path of the existing file `name`, so that the
+///          manifest doesn't depend on the working directory of the writer.
+///          The caller frees it.
+static char*
+raw_absolute_path(const char* name)
+{
+    char* path = 0;
+#ifdef _WIN32
+    path = _fullpath(0, name, 0);
+#else
+    path = realpath(name, 0);
+#endif
+    if (!path)
+        LOGE("RAW: Couldn't find the absolute path of \"%s\".", name);
+    return path;
+}
+
+/// Starts a target device writing into the directory `[dir,dir+ndir)`.
+static int
+raw_add_stripe(struct Raw* self,
+               const char* dir,
+               size_t ndir,
+               unsigned queue_shares)
+{
+    const struct PixelScale pixel_scale_um = { 1, 1 };
+    struct StorageProperties props = { 0 };
+    struct Storage* target = 0;
+    char* name = 0;
+    int ok = 0;
+    struct Raw** targets =
+      realloc(self->stripes.targets,
+              (self->stripes.n + 1) * sizeof(*self->stripes.targets));
+    CHECK(targets);
+    self->stripes.targets = targets;
+    CHECK(name = raw_stripe_file_name(self, dir, ndir));
+    CHECK(storage_properties_init(
+      &props, 0, name, strlen(name) + 1, 0, 0, pixel_scale_um));
+    CHECK(target = raw_init());
+    targets[self->stripes.n] = containerof(target, struct Raw, writer);
+    targets[self->stripes.n]->is_target = 1;
+    targets[self->stripes.n++]->queue_shares = queue_shares;
+    CHECK(target->set(target, &props) == DeviceState_Armed);
+    CHECK(target->start(target) == DeviceState_Running);
+    ok = 1;
+Error:
+    if (!ok)
+        LOGE("RAW: Failed to start a stripe in \"%.*s\"", (int)ndir, dir);
+    storage_properties_destroy(&props);
+    free(name);
+    return ok;
+}
+
+/// Striping is turned on by `ACQUIRE_RAW_STRIPES`, a list of directories
+/// separated by ';', ideally on different disks. Frames are dealt out
+/// round-robin, `ACQUIRE_RAW_STRIPE_FRAMES` at a time, to a raw device per
+/// directory that writes a file with the same name as this device's. Each
+/// has its own write queue and thread, rollover and index. The queues split
+/// `ACQUIRE_RAW_QUEUE_MIB` evenly.
+///
+/// This device's file becomes the manifest, a text file that puts the frames
+/// back in order:
+///
+///     acquire raw stripes 1
+///     run <target> <frames>   the next <frames> frames are on <target>
+///     ...
+///     file <target> <path>    the files of <target>, in order
+///     ...
+///
+/// Paths are written absolute. Readers take relative ones to be relative to
+/// the manifest's directory, so a manifest can be edited to point at files
+/// that were moved along with it.
+///
+/// Targets are numbered from 0 in the order they're listed. Runs are written
+/// as frames are appended; files when the device stops. Frames dropped by a
+/// target's queue aren't in any run. raw_stripes_open() reads a manifest.
+static int
+raw_start_stripes(struct Raw* self, const char* dirs)
+{
+    int64_t frames_per_stripe = 1;
+    options_get_int("ACQUIRE_RAW_STRIPE_FRAMES", &frames_per_stripe);
+    self->stripes.frames_per_stripe =
+      frames_per_stripe > 0 ? (unsigned)frames_per_stripe : 1;
+    self->stripes.target = 0;
+    self->stripes.frames = 0;
+    self->stripes.run_frames = 0;
+    self->stripes.manifest_offset = 0;
+    self->stripes.len = 0;
+
+    // The targets split the queue between them, so count them first.
+    unsigned ndirs = 0;
+    for (const char* c = dirs; *c; ++c)
+        ndirs += *c != ';' && (c == dirs || c[-1] == ';');
+
+    const char* beg = dirs;
+    while (*beg) {
+        const char* end = strchr(beg, ';');
+        if (!end)
+            end = beg + strlen(beg);
+        if (end > beg)
+            CHECK(raw_add_stripe(self, beg, (size_t)(end - beg), ndirs));
+        beg = *end ? end + 1 : end;
+    }
+    CHECK(self->stripes.n);
+
+    CHECK(file_create(&self->stripes.manifest,
+                      self->properties.filename.str,
+                      self->properties.filename.nbytes));
+    self->stripes.manifest_is_open = 1;
+    CHECK(raw_manifest_line(self, "acquire raw stripes 1\n"));
+    LOG("RAW: Striping across %u directories, %u frames at a time.",
+        self->stripes.n,
+        self->stripes.frames_per_stripe);
+    return 1;
+Error:
+    return 0;
+}
+
+/// Stops the targets and finishes the manifest.
+/// @returns 0 if any frames, or the manifest, could not be written.
+static int
+raw_stop_stripes(struct Raw* self)
+{
+    char *name = 0, *path = 0;
+    int ok = 1, manifest_ok = 0;
+    if (!self->stripes.targets)
+        return 1;
+    for (unsigned i = 0; i < self->stripes.n; ++i)
+        ok = raw_finish(self->stripes.targets[i]) && ok;
+
+    CHECK(self->stripes.manifest_is_open);
+    if (self->stripes.run_frames)
+        CHECK(raw_manifest_line(self,
+                                "run %u %llu\n",
+                                self->stripes.run_target,
+                                (unsigned long long)self->stripes.run_frames));
+    for (unsigned i = 0; i < self->stripes.n; ++i) {
+        const struct Raw* target = self->stripes.targets[i];
+        const unsigned nfiles =
+          target->rollover_bytes ? target->file_index + 1 : 1;
+        for (unsigned k = 0; k < nfiles; ++k) {
+            CHECK(name = raw_file_name(target, k, ""));
+            CHECK(path = raw_absolute_path(name));
+            CHECK(raw_manifest_line(self, "file %u %s\n", i, path));
+            free(name);
+            free(path);
+            name = path = 0;
+        }
+    }
+    CHECK(raw_manifest_flush(self));
+    manifest_ok = 1;
+Error:
+    if (!manifest_ok)
+        LOGE("RAW: Failed to write the stripe manifest.");
+    free(name);
+    free(path);
+    if (self->stripes.manifest_is_open)
+        file_close(&self->stripes.manifest);
+    self->stripes.manifest_is_open = 0;
+    for (unsigned i = 0; i < self->stripes.n; ++i)
+        self->stripes.targets[i]->writer.destroy(
+          &self->stripes.targets[i]->writer);
+    free(self->stripes.targets);
+    self->stripes.targets = 0;
+    self->stripes.n = 0;
+    return ok && manifest_ok;
+}
+
+/// Deals the frames of a batch out to the targets.
+static int
+raw_stripe_append(struct Raw* self,
+                  const struct VideoFrame* frames,
+                  size_t nbytes)
+{
+    const uint8_t* beg = (const uint8_t*)frames;
+    const uint8_t* const end = beg + nbytes;
+    while (beg < end) {
+        // The frames that finish the current stripe
+        const uint8_t* cur = beg;
+        unsigned n = 0;
+        while (cur < end &&
+               self->stripes.frames + n < self->stripes.frames_per_stripe) {
+            const struct VideoFrame* frame = (const struct VideoFrame*)cur;
+            size_t bytes = (size_t)(end - cur);
+            if (bytes >= sizeof(*frame) &&
+                frame->bytes_of_frame >= sizeof(*frame) &&
+                frame->bytes_of_frame <= bytes)
+                bytes = frame->bytes_of_frame;
+            cur += bytes;
+            ++n;
+        }
+
+        const unsigned t = self->stripes.target;
+        int dropped = 0;
+        CHECK(raw_append_bytes(self->stripes.targets[t],
+                               (const struct VideoFrame*)beg,
+                               (size_t)(cur - beg),
+                               &dropped));
+        if (!dropped)
+            CHECK(raw_manifest_run(self, t, n));
+        self->stripes.frames += n;
+        if (self->stripes.frames == self->stripes.frames_per_stripe) {
+            self->stripes.frames = 0;
+            self->stripes.target = (t + 1) % self->stripes.n;
+        }
+        beg = cur;
+    }
+    return 1;
+Error:
+    return 0;
+}
+
+/// Grows `*buf` to hold at least `nbytes`. The contents aren't kept.
+static int
+raw_reserve(uint8_t** buf, size_t* capacity, size_t nbytes)
+{
+    if (*capacity >= nbytes)
+        return 1;
+    free(*buf);
+    *capacity = 0;
+    CHECK(*buf = malloc(nbytes));
+    *capacity = nbytes;
+    return 1;
+Error:
+    return 0;
+}
+
+static unsigned
+raw_bytes_per_sample(enum SampleType type)
+{
+    switch (type) {
+        case SampleType_u16:
+        case SampleType_i16:
+        case SampleType_u10:
+        case SampleType_u12:
+        case SampleType_u14:
+            return 2;
+        case SampleType_f32:
+            return 4;
+        default:
+            return 1;
+    }
+}
+
+/// @returns the size of the frame at `p`, or of the rest of the batch if
+///          there's no valid frame header there.
+static size_t
+raw_frame_bytes(const uint8_t* p, const uint8_t* end, int* has_header)
+{
+    const struct VideoFrame* frame = (const struct VideoFrame*)p;
+    const size_t bytes = (size_t)(end - p);
+    *has_header = bytes >= sizeof(*frame) &&
+                  frame->bytes_of_frame >= sizeof(*frame) &&
+                  frame->bytes_of_frame <= bytes;
+    return *has_header ? frame->bytes_of_frame : bytes;
+}
+
+static void
+raw_compress_block(void* ctx, size_t i)
+{
+    struct RawCodecBlock* b = ((struct Raw*)ctx)->codec.blocks + i;
+    b->nout = raw_codec_compress_block(
+      b->dst, b->src, b->n, b->bpe, b->shuffle, b->scratch);
+}
+
+/// Compresses the frames of a batch, each into a header, a block table and
+/// its blocks (see raw.index.h). Blocks are compressed on the worker pool,
+/// each into a slot as big as the block, then packed together.
+///
+/// Bytes that don't start with a valid frame header are passed through.
+/// @returns the compressed batch in `*out`, valid until the next call.
+static int
+raw_compress(struct Raw* self,
+             const struct VideoFrame* frames,
+             size_t nbytes,
+             const struct VideoFrame** out,
+             size_t* nout)
+{
+    const size_t header_bytes =
+      sizeof(struct VideoFrame) + sizeof(struct RawCompressedHeader);
+    const size_t bpb = self->codec.bytes_per_block;
+    const uint8_t* const beg = (const uint8_t*)frames;
+    const uint8_t* const end = beg + nbytes;
+    int has_header = 0;
+
+    // Lay out the slots.
+    size_t slots = 0, nblocks = 0;
+    for (const uint8_t* p = beg; p < end;) {
+        const size_t bytes = raw_frame_bytes(p, end, &has_header);
+        if (has_header) {
+            const size_t ndata = bytes - sizeof(struct VideoFrame);
+            const size_t n = (ndata + bpb - 1) / bpb;
+            slots += header_bytes + n * sizeof(uint32_t) + ndata + 7;
+            nblocks += n;
+        } else {
+            slots += bytes;
+        }
+        p += bytes;
+    }
+    CHECK(raw_reserve(&self->codec.out, &self->codec.out_capacity, slots));
+    CHECK(raw_reserve(
+      &self->codec.scratch, &self->codec.scratch_capacity, nbytes));
+    if (nblocks > self->codec.blocks_capacity) {
+        void* blocks =
+          realloc(self->codec.blocks, nblocks * sizeof(*self->codec.blocks));
+        CHECK(blocks);
+        self->codec.blocks = blocks;
+        self->codec.blocks_capacity = nblocks;
+    }
+
+    // Compress the blocks into their slots.
+    self->codec.nblocks = 0;
+    size_t slot = 0;
+    for (const uint8_t* p = beg; p < end;) {
+        const size_t bytes = raw_frame_bytes(p, end, &has_header);
+        if (has_header) {
+            const struct VideoFrame* frame = (const struct VideoFrame*)p;
+            const size_t ndata = bytes - sizeof(*frame);
+            const size_t n = (ndata + bpb - 1) / bpb;
+            uint8_t* dst = self->codec.out + slot + header_bytes +
+                           n * sizeof(uint32_t);
+            for (size_t at = 0; at < ndata; at += bpb) {
+                self->codec.blocks[self->codec.nblocks++] =
+                  (struct RawCodecBlock){
+                      .src = frame->data + at,
+                      .dst = dst + at,
+                      .scratch = self->codec.scratch + (frame->data + at - beg),
+                      .n = ndata - at < bpb ? ndata - at : bpb,
+                      .bpe = raw_bytes_per_sample(frame->shape.type),
+                      .shuffle = self->codec.shuffle,
+                  };
+            }
+            slot += header_bytes + n * sizeof(uint32_t) + ndata + 7;
+        } else {
+            slot += bytes;
+        }
+        p += bytes;
+    }
+    worker_pool_parallel_for(
+      self->codec.pool, self->codec.nblocks, raw_compress_block, self);
+
+    // Pack the frames. Each one moves towards the start of `out`, so this
+    // only overwrites slots that are already packed.
+    uint8_t* packed = self->codec.out;
+    const struct RawCodecBlock* block = self->codec.blocks;
+    for (const uint8_t* p = beg; p < end;) {
+        const size_t bytes = raw_frame_bytes(p, end, &has_header);
+        if (!has_header) {
+            memcpy(packed, p, bytes); // NOLINT
+            packed += bytes;
+            break;
+        }
+        const size_t ndata = bytes - sizeof(struct VideoFrame);
+        const size_t n = (ndata + bpb - 1) / bpb;
+        uint8_t* data = packed + header_bytes + n * sizeof(uint32_t);
+        for (size_t i = 0; i < n; ++i, ++block) {
+            const uint32_t nblock = (uint32_t)block->nout;
+            memcpy(packed + header_bytes + i * sizeof(nblock), // NOLINT
+                   &nblock,
+                   sizeof(nblock));
+            memmove(data, block->dst, block->nout); // NOLINT
+            data += block->nout;
+        }
+        const size_t payload = (size_t)(data - packed) - header_bytes;
+        const size_t record = (header_bytes + payload + 7) & ~(size_t)7;
+        memset(data, 0, packed + record - data); // NOLINT
+
+        struct VideoFrame header = *(const struct VideoFrame*)p;
+        header.bytes_of_frame = record;
+        const struct RawCompressedHeader codec = {
+            .magic = RAW_COMPRESSED_MAGIC,
+            .shuffle = (uint16_t)self->codec.shuffle,
+            .bytes_per_element =
+              (uint16_t)raw_bytes_per_sample(header.shape.type),
+            .bytes_per_block = (uint32_t)bpb,
+            .bytes_of_data = ndata,
+            .bytes_of_payload = payload,
+        };
+        memcpy(packed, &header, sizeof(header));                // NOLINT
+        memcpy(packed + sizeof(header), &codec, sizeof(codec)); // NOLINT
+        packed += record;
+        p += bytes;
+    }
+
+    *out = (const struct VideoFrame*)self->codec.out;
+    *nout = (size_t)(packed - self->codec.out);
+    self->codec.bytes_in += nbytes;
+    self->codec.bytes_out += *nout;
+    return 1;
+Error:
+    return 0;
+}
+
+/// Reads `ACQUIRE_RAW_COMPRESS`, `ACQUIRE_RAW_COMPRESS_THREADS` and
+/// `ACQUIRE_RAW_COMPRESS_BLOCK_KIB`, and starts the worker pool.
+static int
+raw_start_codec(struct Raw* self)
+{
+    int64_t nthreads = 4, block_kib = 256;
+    const char* codec = options_get_string("ACQUIRE_RAW_COMPRESS");
+    self->codec.enabled = 0;
+    self->codec.bytes_in = self->codec.bytes_out = 0;
+    if (!codec || !strcmp(codec, "none"))
+        return 1;
+    if (!strcmp(codec, "shuffle-lz")) {
+        self->codec.shuffle = RawShuffle_Byte;
+    } else if (!strcmp(codec, "bitshuffle-lz")) {
+        self->codec.shuffle = RawShuffle_Bit;
+    } else {
+        LOGE("Unknown ACQUIRE_RAW_COMPRESS \"%s\". Expected none, "
+             "shuffle-lz or bitshuffle-lz.",
+             codec);
+        goto Error;
+    }
+    options_get_int("ACQUIRE_RAW_COMPRESS_THREADS", &nthreads);
+    options_get_int("ACQUIRE_RAW_COMPRESS_BLOCK_KIB", &block_kib);
+    if (nthreads < 1 || nthreads > 256 || block_kib < 1 ||
+        block_kib > (1 << 20)) {
+        LOGE("ACQUIRE_RAW_COMPRESS_THREADS must be in [1,256] and "
+             "ACQUIRE_RAW_COMPRESS_BLOCK_KIB in [1,2^20]. Got: %d and %d",
+             (int)nthreads,
+             (int)block_kib);
+        goto Error;
+    }
+    self->codec.bytes_per_block = (uint32_t)block_kib << 10;
+    // The appending thread works too, so it needs one fewer worker.
+    if (nthreads > 1)
+        CHECK(self->codec.pool = worker_pool_create((unsigned)nthreads - 1, 0));
+    self->codec.enabled = 1;
+    return 1;
+Error:
+    return 0;
+}
+
+/// Stops the worker pool, frees the buffers and logs the compression ratio.
+static void
+raw_stop_codec(struct Raw* self)
+{
+    if (self->codec.enabled && self->codec.bytes_out)
+        LOG("RAW: Compressed %.1f MiB to %.1f MiB (%.2fx).",
+            (double)self->codec.bytes_in / (1 << 20),
+            (double)self->codec.bytes_out / (1 << 20),
+            (double)self->codec.bytes_in / (double)self->codec.bytes_out);
+    self->codec.enabled = 0;
+    worker_pool_destroy(self->codec.pool);
+    self->codec.pool = 0;
+    free(self->codec.blocks);
+    free(self->codec.out);
+    free(self->codec.scratch);
+    self->codec.blocks = 0;
+    self->codec.out = self->codec.scratch = 0;
+    self->codec.blocks_capacity = self->codec.out_capacity =
+      self->codec.scratch_capacity = 0;
+}
+
 static enum DeviceState
 raw_set(struct Storage* self_, const struct StorageProperties* properties)
 {
@@ -69,9 +1239,35 @@ static enum DeviceState
 raw_start(struct Storage* self_)
 {
     struct Raw* self = containerof(self_, struct Raw, writer);
-    CHECK(file_create(&self->file,
-                      self->properties.filename.str,
-                      self->properties.filename.nbytes));
+    const char* stripes =
+      self->is_target ? 0 : options_get_string("ACQUIRE_RAW_STRIPES");
+    if (!self->is_target)
+        CHECK(raw_start_codec(self));
+    if (stripes) {
+        if (!raw_start_stripes(self, stripes)) {
+            raw_stop_stripes(self);
+            goto Error;
+        }
+        return DeviceState_Running;
+    }
+    raw_read_options(self);
+    self->offset = 0;
+    self->file_fill = 0;
+    self->plan_file = 0;
+    self->splits.head = self->splits.end = 0;
+    self->file_index = 0;
+    self->file_base = 0;
+    CHECK(raw_open_file(self));
+    if (self->indexing && !raw_sidecar_open(self, &self->index, 0)) {
+        LOGE("RAW: Failed to create the index. Continuing without it.");
+        raw_sidecar_close(&self->index);
+        self->indexing = 0;
+    }
+    if (self->split && !raw_sidecar_open(self, &self->headers, 0)) {
+        raw_sidecar_close(&self->headers);
+        goto Error;
+    }
+    CHECK(raw_start_queue(self));
     LOG("RAW: Frame header size %d bytes", (int)sizeof(struct VideoFrame));
     return DeviceState_Running;
 Error:
@@ -82,7 +1278,11 @@ static enum DeviceState
 raw_stop(struct Storage* self_)
 {
     struct Raw* self = containerof(self_, struct Raw, writer);
-    file_close(&self->file);
+    int ok = raw_stop_stripes(self);
+    ok = raw_finish(self) && ok;
+    raw_stop_codec(self);
+    if (!ok)
+        LOGE("RAW: Some frames could not be written.");
     return DeviceState_Armed;
 }
 
@@ -92,12 +1292,14 @@ raw_append(struct Storage* self_,
            size_t* nbytes)
 {
     struct Raw* self = containerof(self_, struct Raw, writer);
-    CHECK(file_write(&self->file,
-                     self->offset,
-                     (uint8_t*)frames,
-                     ((uint8_t*)frames) + *nbytes));
-    self->offset += *nbytes;
-
+    size_t n = *nbytes;
+    int dropped = 0;
+    if (self->codec.enabled)
+        CHECK(raw_compress(self, frames, *nbytes, &frames, &n));
+    if (self->stripes.targets)
+        CHECK(raw_stripe_append(self, frames, n));
+    else
+        CHECK(raw_append_bytes(self, frames, n, &dropped));
     return DeviceState_Running;
 Error:
     *nbytes = 0;
@@ -110,6 +1312,10 @@ raw_destroy(struct Storage* writer_)
     struct Raw* self = containerof(writer_, struct Raw, writer);
     raw_stop(writer_);
     storage_properties_destroy(&self->properties);
+    lock_deinit(&self->lock);
+    free(self->splits.offsets);
+    free(self->planned);
+    free(self->spans);
     free(self);
 }
 
@@ -124,6 +1330,7 @@ raw_init()
     struct Raw* self;
     CHECK(self = malloc(sizeof(*self)));
     memset(self, 0, sizeof(*self));
+    lock_init(&self->lock);
     const struct PixelScale pixel_scale_um = { 1, 1 };
 
     CHECK(storage_properties_init(&self->properties,
@@ -133,6 +1340,18 @@ raw_init()
                                   0,
                                   0,
                                   pixel_scale_um));
+    self->index.suffix = ".idx";
+    self->index.header = (struct RawIndexHeader){
+        .magic = RAW_INDEX_MAGIC,
+        .version = RAW_INDEX_VERSION,
+        .bytes_of_entry = sizeof(struct RawIndexEntry),
+    };
+    self->headers.suffix = ".hdr";
+    self->headers.header = (struct RawIndexHeader){
+        .magic = RAW_HEADERS_MAGIC,
+        .version = RAW_HEADERS_VERSION,
+        .bytes_of_entry = sizeof(struct VideoFrame),
+    };
     self->writer =
       (struct Storage){ .state = DeviceState_AwaitingConfiguration,
                         .set = raw_set,
@@ -147,3 +1366,478 @@ raw_init()
 Error:
     return 0;
 }
+
+#ifndef NO_UNIT_TESTS
+#include "device/kit/driver.h"
+
+#include <stdio.h>
+
+#ifdef _WIN32
+#include <direct.h>
+#define mkdir(path, mode) _mkdir(path)
+#define rmdir _rmdir
+#else
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+static int
+set_option(const char* name, const char* value)
+{
+#ifdef _WIN32
+    return _putenv_s(name, value) == 0;
+#else
+    return setenv(name, value, 1) == 0;
+#endif
+}
+
+acquire_export int
+unit_test_raw_index()
+{
+    const char filename[] = "raw-index-test.raw";
+    const struct PixelScale pixel_scale_um = { 1, 1 };
+    struct StorageProperties props = { 0 };
+    struct Storage* writer = 0;
+    struct RawReader* reader = 0;
+    uint8_t* batch = 0;
+    uint64_t nframes = 0;
+    int ok = 0;
+    CHECK(set_option("ACQUIRE_RAW_INDEX", "1"));
+    CHECK(storage_properties_init(
+      &props, 0, filename, sizeof(filename), 0, 0, pixel_scale_um));
+    CHECK(writer = raw_init());
+    CHECK(writer->set(writer, &props) == DeviceState_Armed);
+    CHECK(writer->start(writer) == DeviceState_Running);
+
+    // Batches of 1 to 4 frames whose sizes all differ.
+    CHECK(batch = malloc(4 * (sizeof(struct VideoFrame) + 4096)));
+    for (int b = 0; b < 50; ++b) {
+        size_t nbytes = 0;
+        for (int i = 0; i <= b % 4; ++i) {
+            struct VideoFrame* f = (struct VideoFrame*)(batch + nbytes);
+            const size_t npx = 8 * (size_t)((nframes * 37) % 512);
+            *f = (struct VideoFrame){
+                .bytes_of_frame = sizeof(*f) + npx,
+                .frame_id = nframes,
+                .hardware_frame_id = 2 * nframes,
+                .timestamps = { .hardware = 3 * nframes },
+            };
+            memset(f->data, (int)(nframes & 0xff), npx); // NOLINT
+            nbytes += f->bytes_of_frame;
+            ++nframes;
+        }
+        CHECK(writer->append(writer, (struct VideoFrame*)batch, &nbytes) ==
+              DeviceState_Running);
+    }
+    CHECK(writer->stop(writer) == DeviceState_Armed);
+
+    // With and without the index.
+    for (int pass = 0; pass < 2; ++pass) {
+        CHECK(reader = raw_reader_open(filename));
+        CHECK(raw_reader_frame_count(reader) == nframes);
+        for (uint64_t i = 0; i < nframes; ++i) {
+            const uint64_t j = (i * 7919) % nframes;
+            const struct RawIndexEntry* e = raw_reader_entry(reader, j);
+            const struct VideoFrame* f = raw_reader_frame(reader, j);
+            CHECK(e && f);
+            CHECK(f->frame_id == j && e->hardware_frame_id == 2 * j);
+            CHECK(e->timestamp_hardware == 3 * j);
+            const size_t npx = f->bytes_of_frame - sizeof(*f);
+            CHECK(npx == 8 * ((j * 37) % 512));
+            CHECK(!npx || f->data[npx - 1] == (uint8_t)(j & 0xff));
+            CHECK(raw_reader_find_frame_id(reader, j) == (int64_t)j);
+        }
+        CHECK(raw_reader_find_frame_id(reader, nframes) == -1);
+        CHECK(!raw_reader_frame(reader, nframes));
+        raw_reader_close(reader);
+        reader = 0;
+        remove("raw-index-test.raw.idx");
+    }
+    ok = 1;
+Error:
+    raw_reader_close(reader);
+    if (writer)
+        writer->destroy(writer);
+    storage_properties_destroy(&props);
+    free(batch);
+    set_option("ACQUIRE_RAW_INDEX", "");
+    remove(filename);
+    remove("raw-index-test.raw.idx");
+    return ok;
+}
+
+/// Copies the stripe manifest at `from` to `to`, one directory down, with
+/// the files' paths made relative to it. They must be absolute in `from`.
+static int
+relocate_manifest(const char* from, const char* to)
+{
+    FILE *in = 0, *out = 0;
+    char line[4096];
+    int ok = 0;
+    CHECK(in = fopen(from, "rb"));
+    CHECK(out = fopen(to, "wb"));
+    while (fgets(line, sizeof(line), in)) {
+        unsigned t = 0;
+        int at = 0;
+        if (sscanf(line, "file %u %n", &t, &at) != 1 || !at) {
+            CHECK(fputs(line, out) >= 0);
+            continue;
+        }
+        const char* path = line + at;
+        CHECK(path[0] == '/' || path[0] == '\\' || path[1] == ':');
+        // Keep the last two components: "../<stripe dir>/<file>"
+        const char* tail[2] = { path, path };
+        for (const char* c = path; *c; ++c)
+            if (*c == '/' || *c == '\\') {
+                tail[0] = tail[1];
+                tail[1] = c;
+            }
+        CHECK(fprintf(out, "file %u ..%s", t, tail[0]) > 0);
+    }
+    ok = 1;
+Error:
+    if (in)
+        fclose(in);
+    if (out)
+        fclose(out);
+    return ok;
+}
+
+acquire_export int
+unit_test_raw_stripes()
+{
+    const char filename[] = "raw-stripes-test.raw";
+    const char* dirs[] = { "raw-stripes-0", "raw-stripes-1", "raw-stripes-2" };
+    const struct PixelScale pixel_scale_um = { 1, 1 };
+    struct StorageProperties props = { 0 };
+    struct Storage* writer = 0;
+    struct RawStripes* reader = 0;
+    uint8_t* batch = 0;
+    uint64_t nframes = 0;
+    int ok = 0;
+    for (int i = 0; i < (int)countof(dirs); ++i)
+        mkdir(dirs[i], 0777);
+    CHECK(set_option("ACQUIRE_RAW_STRIPES",
+                     "raw-stripes-0;raw-stripes-1/;;raw-stripes-2"));
+    CHECK(set_option("ACQUIRE_RAW_STRIPE_FRAMES", "3"));
+    CHECK(set_option("ACQUIRE_RAW_ROLLOVER_MIB", "1"));
+    CHECK(storage_properties_init(
+      &props, 0, filename, sizeof(filename), 0, 0, pixel_scale_um));
+    CHECK(writer = raw_init());
+    CHECK(writer->set(writer, &props) == DeviceState_Armed);
+    CHECK(writer->start(writer) == DeviceState_Running);
+
+    // About 12 MiB in batches of 1 to 4 frames of up to 400 kB, so each
+    // target rolls over a few times.
+    CHECK(batch = malloc(4 * (sizeof(struct VideoFrame) + (400 << 10))));
+    for (int b = 0; b < 24; ++b) {
+        size_t nbytes = 0;
+        for (int i = 0; i <= b % 4; ++i) {
+            struct VideoFrame* f = (struct VideoFrame*)(batch + nbytes);
+            const size_t npx = 4096 * (size_t)((nframes * 37) % 101);
+            *f = (struct VideoFrame){
+                .bytes_of_frame = sizeof(*f) + npx,
+                .frame_id = nframes,
+            };
+            memset(f->data, (int)(nframes & 0xff), npx); // NOLINT
+            nbytes += f->bytes_of_frame;
+            ++nframes;
+        }
+        CHECK(writer->append(writer, (struct VideoFrame*)batch, &nbytes) ==
+              DeviceState_Running);
+    }
+    CHECK(writer->stop(writer) == DeviceState_Armed);
+
+    // As written, then with the files relative to a manifest elsewhere.
+    CHECK(relocate_manifest(filename, "raw-stripes-1/moved.raw"));
+    for (int pass = 0; pass < 2; ++pass) {
+        CHECK(reader =
+                raw_stripes_open(pass ? "raw-stripes-1/moved.raw" : filename));
+        CHECK(raw_stripes_frame_count(reader) == nframes);
+        for (uint64_t i = 0; i < nframes; ++i) {
+            const struct VideoFrame* f = raw_stripes_frame(reader, i);
+            CHECK(f && f->frame_id == i);
+            const size_t npx = f->bytes_of_frame - sizeof(*f);
+            CHECK(npx == 4096 * ((i * 37) % 101));
+            CHECK(!npx || f->data[npx - 1] == (uint8_t)(i & 0xff));
+        }
+        CHECK(!raw_stripes_frame(reader, nframes));
+        raw_stripes_close(reader);
+        reader = 0;
+    }
+    ok = 1;
+Error:
+    raw_stripes_close(reader);
+    if (writer)
+        writer->destroy(writer);
+    storage_properties_destroy(&props);
+    free(batch);
+    set_option("ACQUIRE_RAW_STRIPES", "");
+    set_option("ACQUIRE_RAW_STRIPE_FRAMES", "");
+    set_option("ACQUIRE_RAW_ROLLOVER_MIB", "");
+    remove(filename);
+    remove("raw-stripes-1/moved.raw");
+    for (int i = 0; i < (int)countof(dirs); ++i) {
+        char name[128];
+        for (int k = 0; k < 16; ++k) {
+            snprintf(name,
+                     sizeof(name),
+                     "%s/raw-stripes-test.%03d.raw",
+                     dirs[i],
+                     k);
+            remove(name);
+            strcat(name, ".idx"); // NOLINT
+            remove(name);
+        }
+        rmdir(dirs[i]);
+    }
+    return ok;
+}
+
+/// Fills frame `id` with 16 bit samples that are smooth apart from a little
+/// noise, like many microscope images.
+static void
+make_compressible_frame(struct VideoFrame* f, uint64_t id, uint32_t w)
+{
+    const uint32_t h = 8 + (uint32_t)(id % 5);
+    *f = (struct VideoFrame){
+        .bytes_of_frame = sizeof(*f) + 2 * (size_t)w * h,
+        .shape = { .dims = { .channels = 1,
+                             .width = w,
+                             .height = h,
+                             .planes = 1 },
+                   .type = id % 3 ? SampleType_u16 : SampleType_u8 },
+        .frame_id = id,
+    };
+    if (f->shape.type == SampleType_u8)
+        f->bytes_of_frame = sizeof(*f) + (size_t)w * h;
+    uint64_t state = id + 1;
+    for (size_t i = 0; i < (size_t)w * h; ++i) {
+        state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+        const unsigned v =
+          100 + (unsigned)(i / w) * 3 + (unsigned)(state >> 61);
+        if (f->shape.type == SampleType_u8)
+            f->data[i] = (uint8_t)v;
+        else
+            ((uint16_t*)f->data)[i] = (uint16_t)(v + 1000 * id);
+    }
+}
+
+acquire_export int
+unit_test_raw_compress()
+{
+    const char filename[] = "raw-compress-test.raw";
+    const uint32_t width = 1000;
+    const struct PixelScale pixel_scale_um = { 1, 1 };
+    struct StorageProperties props = { 0 };
+    struct Storage* writer = 0;
+    struct RawReader* reader = 0;
+    uint8_t *batch = 0, *expected = 0, *actual = 0;
+    const size_t max_frame = sizeof(struct VideoFrame) + 2 * width * 12;
+    uint64_t nframes = 0, nbytes_total = 0;
+    int ok = 0;
+    CHECK(set_option("ACQUIRE_RAW_COMPRESS", "bitshuffle-lz"));
+    CHECK(set_option("ACQUIRE_RAW_COMPRESS_THREADS", "3"));
+    CHECK(set_option("ACQUIRE_RAW_COMPRESS_BLOCK_KIB", "4"));
+    CHECK(storage_properties_init(
+      &props, 0, filename, sizeof(filename), 0, 0, pixel_scale_um));
+    CHECK(writer = raw_init());
+    CHECK(writer->set(writer, &props) == DeviceState_Armed);
+    CHECK(writer->start(writer) == DeviceState_Running);
+
+    CHECK(batch = malloc(4 * max_frame));
+    CHECK(expected = malloc(max_frame));
+    CHECK(actual = malloc(max_frame));
+    for (int b = 0; b < 30; ++b) {
+        size_t nbytes = 0;
+        for (int i = 0; i <= b % 4; ++i) {
+            struct VideoFrame* f = (struct VideoFrame*)(batch + nbytes);
+            make_compressible_frame(f, nframes++, width);
+            nbytes += f->bytes_of_frame;
+        }
+        nbytes_total += nbytes;
+        CHECK(writer->append(writer, (struct VideoFrame*)batch, &nbytes) ==
+              DeviceState_Running);
+    }
+    CHECK(writer->stop(writer) == DeviceState_Armed);
+
+    CHECK(reader = raw_reader_open(filename));
+    CHECK(raw_reader_frame_count(reader) == nframes);
+    uint64_t nbytes_file = 0;
+    for (uint64_t i = 0; i < nframes; ++i) {
+        const struct VideoFrame* f = raw_reader_frame(reader, i);
+        CHECK(f && f->frame_id == i);
+        nbytes_file += f->bytes_of_frame;
+        make_compressible_frame((struct VideoFrame*)expected, i, width);
+        const size_t n = ((struct VideoFrame*)expected)->bytes_of_frame;
+        CHECK(raw_frame_decompressed_bytes(f) == n);
+        CHECK(!raw_frame_decompress(f, actual, n - 1));
+        CHECK(raw_frame_decompress(f, actual, max_frame));
+        CHECK(!memcmp(actual, expected, n));
+    }
+    CHECK(2 * nbytes_file < nbytes_total);
+    ok = 1;
+Error:
+    raw_reader_close(reader);
+    if (writer)
+        writer->destroy(writer);
+    storage_properties_destroy(&props);
+    free(batch);
+    free(expected);
+    free(actual);
+    set_option("ACQUIRE_RAW_COMPRESS", "");
+    set_option("ACQUIRE_RAW_COMPRESS_THREADS", "");
+    set_option("ACQUIRE_RAW_COMPRESS_BLOCK_KIB", "");
+    remove(filename);
+    remove("raw-compress-test.raw.idx");
+    return ok;
+}
+
+acquire_export int
+unit_test_raw_crc32c()
+{
+    const char filename[] = "raw-crc32c-test.raw";
+    const struct PixelScale pixel_scale_um = { 1, 1 };
+    struct StorageProperties props = { 0 };
+    struct Storage* writer = 0;
+    struct RawReader* reader = 0;
+    struct VideoFrame* frame = 0;
+    FILE* file = 0;
+    const size_t npx = 3000, nframes = 10;
+    int ok = 0;
+    CHECK(storage_properties_init(
+      &props, 0, filename, sizeof(filename), 0, 0, pixel_scale_um));
+    CHECK(frame = malloc(sizeof(*frame) + npx));
+
+    // Without, then with checksums.
+    for (int pass = 0; pass < 2; ++pass) {
+        CHECK(set_option("ACQUIRE_RAW_CRC32C", pass ? "1" : "0"));
+        CHECK(writer = raw_init());
+        CHECK(writer->set(writer, &props) == DeviceState_Armed);
+        CHECK(writer->start(writer) == DeviceState_Running);
+        for (uint64_t i = 0; i < nframes; ++i) {
+            size_t nbytes = sizeof(*frame) + npx;
+            *frame = (struct VideoFrame){ .bytes_of_frame = nbytes,
+                                          .frame_id = i };
+            for (size_t j = 0; j < npx; ++j)
+                frame->data[j] = (uint8_t)(i * j);
+            CHECK(writer->append(writer, frame, &nbytes) ==
+                  DeviceState_Running);
+        }
+        writer->destroy(writer);
+        writer = 0;
+
+        CHECK(reader = raw_reader_open(filename));
+        for (uint64_t i = 0; i < nframes; ++i)
+            CHECK(raw_reader_verify(reader, i) == (pass ? 1 : -1));
+        CHECK(!raw_reader_verify(reader, nframes));
+        raw_reader_close(reader);
+        reader = 0;
+    }
+
+    // Flip a bit in the pixels of frame 3.
+    CHECK(file = fopen(filename, "r+b"));
+    const long at = (long)(3 * (sizeof(*frame) + npx) + sizeof(*frame) + 100);
+    int c;
+    CHECK(fseek(file, at, SEEK_SET) == 0 && (c = fgetc(file)) != EOF);
+    CHECK(fseek(file, at, SEEK_SET) == 0 && fputc(c ^ 4, file) != EOF);
+    fclose(file);
+    file = 0;
+    CHECK(reader = raw_reader_open(filename));
+    for (uint64_t i = 0; i < nframes; ++i)
+        CHECK(raw_reader_verify(reader, i) == (i != 3));
+    ok = 1;
+Error:
+    if (file)
+        fclose(file);
+    raw_reader_close(reader);
+    if (writer)
+        writer->destroy(writer);
+    storage_properties_destroy(&props);
+    free(frame);
+    set_option("ACQUIRE_RAW_CRC32C", "");
+    remove(filename);
+    remove("raw-crc32c-test.raw.idx");
+    return ok;
+}
+
+acquire_export int
+unit_test_raw_split()
+{
+    const char filename[] = "raw-split-test.raw";
+    const struct PixelScale pixel_scale_um = { 1, 1 };
+    struct StorageProperties props = { 0 };
+    struct Storage* writer = 0;
+    struct RawReader* reader = 0;
+    uint8_t* batch = 0;
+    const uint64_t nframes = 40;
+    int ok = 0;
+    CHECK(set_option("ACQUIRE_RAW_LAYOUT", "split"));
+    CHECK(set_option("ACQUIRE_RAW_CRC32C", "1"));
+    CHECK(storage_properties_init(
+      &props, 0, filename, sizeof(filename), 0, 0, pixel_scale_um));
+    CHECK(batch = malloc(3 * (sizeof(struct VideoFrame) + 10000)));
+
+    // Through the queue, then synchronously. Frames of 0 to 9999 pixels in
+    // batches of 1 to 3.
+    for (int pass = 0; pass < 2; ++pass) {
+        CHECK(set_option("ACQUIRE_RAW_QUEUE_MIB", pass ? "0" : "1"));
+        CHECK(writer = raw_init());
+        CHECK(writer->set(writer, &props) == DeviceState_Armed);
+        CHECK(writer->start(writer) == DeviceState_Running);
+        for (uint64_t i = 0; i < nframes;) {
+            size_t nbytes = 0;
+            for (uint64_t end = i + 1 + i % 3; i < end && i < nframes; ++i) {
+                struct VideoFrame* f = (struct VideoFrame*)(batch + nbytes);
+                const size_t npx = (size_t)((i * 4099) % 10000);
+                *f = (struct VideoFrame){ .bytes_of_frame = sizeof(*f) + npx,
+                                          .frame_id = i,
+                                          .timestamps = { .hardware = 7 * i } };
+                memset(f->data, (int)(i + 1), npx); // NOLINT
+                nbytes += f->bytes_of_frame;
+            }
+            CHECK(writer->append(writer, (struct VideoFrame*)batch, &nbytes) ==
+                  DeviceState_Running);
+        }
+        CHECK(writer->stop(writer) == DeviceState_Armed);
+        writer->destroy(writer);
+        writer = 0;
+
+        // With and without the index.
+        for (int indexed = 1; indexed >= 0; --indexed) {
+            if (!indexed)
+                remove("raw-split-test.raw.idx");
+            CHECK(reader = raw_reader_open(filename));
+            CHECK(raw_reader_frame_count(reader) == nframes);
+            for (uint64_t i = 0; i < nframes; ++i) {
+                const struct VideoFrame* h = raw_reader_header(reader, i);
+                const uint8_t* px = raw_reader_pixels(reader, i);
+                const size_t npx = (size_t)((i * 4099) % 10000);
+                CHECK(h && px && !raw_reader_frame(reader, i));
+                CHECK(h->frame_id == i && h->timestamps.hardware == 7 * i);
+                CHECK(h->bytes_of_frame == sizeof(*h) + npx);
+                CHECK((uintptr_t)px % RAW_SPLIT_ALIGN == 0);
+                CHECK(!npx || (px[0] == (uint8_t)(i + 1) &&
+                               px[npx - 1] == (uint8_t)(i + 1)));
+                CHECK(raw_reader_verify(reader, i) == (indexed ? 1 : -1));
+            }
+            raw_reader_close(reader);
+            reader = 0;
+        }
+    }
+    ok = 1;
+Error:
+    raw_reader_close(reader);
+    if (writer)
+        writer->destroy(writer);
+    storage_properties_destroy(&props);
+    free(batch);
+    set_option("ACQUIRE_RAW_LAYOUT", "");
+    set_option("ACQUIRE_RAW_CRC32C", "");
+    set_option("ACQUIRE_RAW_QUEUE_MIB", "");
+    remove(filename);
+    remove("raw-split-test.raw.idx");
+    remove("raw-split-test.raw.hdr");
+    return ok;
+}
+#endif
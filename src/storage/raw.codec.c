@@ -0,0 +1,583 @@
+#include "raw.codec.h"
+#include "raw.index.h"
+
+#include <string.h>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <immintrin.h>
+#define HAVE_SSE2 1
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#define HAVE_NEON 1
+#endif
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+/// The LZ format is a sequence of
+///
+///     token       high nibble: literal count, low nibble: match length - 4
+///     [count]     if the literal count is 15, bytes added to it until one
+///                 isn't 255
+///     literals
+///     offset      2 bytes, little endian, how far back the match starts
+///     [length]    if the match length nibble is 15, as for the count
+///
+/// except that the last sequence stops after its literals. Matches may
+/// overlap the bytes they produce, so a run of a repeated byte is a literal
+/// and a match at offset 1.
+
+#define HASH_BITS (13)
+#define MIN_MATCH (4)
+#define MAX_OFFSET (65535)
+/// Matches start at least this far from the end, so 4 byte loads are safe.
+#define TAIL (8)
+
+static uint32_t
+load32(const uint8_t* p)
+{
+    uint32_t v;
+    memcpy(&v, p, sizeof(v)); // NOLINT
+    return v;
+}
+
+static uint32_t
+hash4(uint32_t v)
+{
+    return (v * 2654435761u) >> (32 - HASH_BITS);
+}
+
+#ifdef HAVE_SSE2
+static unsigned
+lowest_bit(unsigned x)
+{
+#ifdef _MSC_VER
+    unsigned long i;
+    _BitScanForward(&i, x);
+    return (unsigned)i;
+#else
+    return (unsigned)__builtin_ctz(x);
+#endif
+}
+#endif
+
+/// @returns the length of the common prefix of `a` and the earlier `b`,
+///          stopping at `end`.
+static size_t
+match_length(const uint8_t* a, const uint8_t* b, const uint8_t* end)
+{
+    const uint8_t* const start = a;
+#ifdef HAVE_SSE2
+    while (end - a >= 16) {
+        const __m128i x = _mm_loadu_si128((const __m128i*)a);
+        const __m128i y = _mm_loadu_si128((const __m128i*)b);
+        const unsigned differ =
+          (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(x, y)) ^ 0xffffu;
+        if (differ)
+            return (size_t)(a - start) + lowest_bit(differ);
+        a += 16;
+        b += 16;
+    }
+#endif
+    while (a < end && *a == *b) {
+        ++a;
+        ++b;
+    }
+    return (size_t)(a - start);
+}
+
+static uint8_t*
+put_length(uint8_t* out, size_t len)
+{
+    if (len >= 15) {
+        len -= 15;
+        for (; len >= 255; len -= 255)
+            *out++ = 255;
+        *out++ = (uint8_t)len;
+    }
+    return out;
+}
+
+static int
+get_length(const uint8_t** in, const uint8_t* end, size_t* len)
+{
+    uint8_t b;
+    do {
+        if (*in == end)
+            return 0;
+        b = *(*in)++;
+        *len += b;
+    } while (b == 255);
+    return 1;
+}
+
+/// Writes `nlit` literals from `lit` followed, if `len` isn't 0, by a match.
+/// @returns the new end of the output, or NULL if it doesn't fit.
+static uint8_t*
+put_sequence(uint8_t* out,
+             const uint8_t* out_end,
+             const uint8_t* lit,
+             size_t nlit,
+             size_t offset,
+             size_t len)
+{
+    const size_t m = len ? len - MIN_MATCH : 0;
+    const size_t worst = 1 + nlit / 255 + 1 + nlit + 2 + m / 255 + 1;
+    if ((size_t)(out_end - out) < worst)
+        return 0;
+    *out++ = (uint8_t)((nlit < 15 ? nlit : 15) << 4 | (m < 15 ? m : 15));
+    out = put_length(out, nlit);
+    memcpy(out, lit, nlit); // NOLINT
+    out += nlit;
+    if (len) {
+        *out++ = (uint8_t)(offset & 0xff);
+        *out++ = (uint8_t)(offset >> 8);
+        out = put_length(out, m);
+    }
+    return out;
+}
+
+size_t
+raw_lz_compress(uint8_t* dst, size_t capacity, const uint8_t* src, size_t n)
+{
+    uint32_t table[1 << HASH_BITS];
+    uint8_t* out = dst;
+    const uint8_t* const out_end = dst + capacity;
+    const uint8_t* const end = src + n;
+    const uint8_t* const limit = n > TAIL ? end - TAIL : src;
+    const uint8_t* anchor = src; // first byte not yet written
+    const uint8_t* p = src;
+    size_t misses = 0;
+
+    memset(table, 0, sizeof(table)); // NOLINT
+    while (p < limit) {
+        const uint32_t v = load32(p);
+        const uint32_t h = hash4(v);
+        const uint8_t* candidate = src + table[h];
+        table[h] = (uint32_t)(p - src);
+        if (candidate < p && p - candidate <= MAX_OFFSET &&
+            load32(candidate) == v) {
+            const size_t len =
+              MIN_MATCH +
+              match_length(p + MIN_MATCH, candidate + MIN_MATCH, end);
+            if (!(out = put_sequence(out,
+                                     out_end,
+                                     anchor,
+                                     (size_t)(p - anchor),
+                                     (size_t)(p - candidate),
+                                     len)))
+                return 0;
+            p += len;
+            anchor = p;
+            misses = 0;
+        } else {
+            // Speeds through data that doesn't compress.
+            p += 1 + (misses++ >> 6);
+        }
+    }
+    out = put_sequence(out, out_end, anchor, (size_t)(end - anchor), 0, 0);
+    if (!out)
+        return 0;
+    return (size_t)(out - dst);
+}
+
+/// Copies `len` bytes starting `offset` bytes before `out` to `out`. The
+/// ranges may overlap, in which case the pattern repeats.
+static void
+copy_match(uint8_t* out, size_t offset, size_t len)
+{
+    if (offset >= len) {
+        memcpy(out, out - offset, len); // NOLINT
+        return;
+    }
+    // Each copy doubles the repeated pattern behind `out + done`.
+    size_t done = 0, period = offset;
+    while (done < len) {
+        const size_t n = len - done < period ? len - done : period;
+        memcpy(out + done, out + done - period, n); // NOLINT
+        done += n;
+        period *= 2;
+    }
+}
+
+int
+raw_lz_decompress(uint8_t* dst, size_t n, const uint8_t* src, size_t nsrc)
+{
+    uint8_t* out = dst;
+    const uint8_t* in = src;
+    const uint8_t* const in_end = src + nsrc;
+    while (in < in_end) {
+        const unsigned token = *in++;
+        size_t nlit = token >> 4;
+        if (nlit == 15 && !get_length(&in, in_end, &nlit))
+            return 0;
+        if (nlit > (size_t)(in_end - in) || nlit > n - (size_t)(out - dst))
+            return 0;
+        memcpy(out, in, nlit); // NOLINT
+        out += nlit;
+        in += nlit;
+        if (in == in_end)
+            break;
+
+        if (in_end - in < 2)
+            return 0;
+        const size_t offset = in[0] | (size_t)in[1] << 8;
+        in += 2;
+        size_t len = token & 15;
+        if (len == 15 && !get_length(&in, in_end, &len))
+            return 0;
+        len += MIN_MATCH;
+        if (!offset || offset > (size_t)(out - dst) ||
+            len > n - (size_t)(out - dst))
+            return 0;
+        copy_match(out, offset, len);
+        out += len;
+    }
+    return out == dst + n;
+}
+
+void
+raw_shuffle(uint8_t* dst, const uint8_t* src, size_t n, unsigned bpe)
+{
+    const size_t count = bpe > 1 ? n / bpe : 0;
+    if (bpe == 2) {
+        uint8_t* lo = dst;
+        uint8_t* hi = dst + count;
+        size_t i = 0;
+#if defined(HAVE_SSE2)
+        const __m128i mask = _mm_set1_epi16(0xff);
+        for (; i + 16 <= count; i += 16) {
+            const __m128i a = _mm_loadu_si128((const __m128i*)(src + 2 * i));
+            const __m128i b =
+              _mm_loadu_si128((const __m128i*)(src + 2 * i + 16));
+            _mm_storeu_si128(
+              (__m128i*)(lo + i),
+              _mm_packus_epi16(_mm_and_si128(a, mask), _mm_and_si128(b, mask)));
+            _mm_storeu_si128(
+              (__m128i*)(hi + i),
+              _mm_packus_epi16(_mm_srli_epi16(a, 8), _mm_srli_epi16(b, 8)));
+        }
+#elif defined(HAVE_NEON)
+        for (; i + 16 <= count; i += 16) {
+            const uint8x16x2_t v = vld2q_u8(src + 2 * i);
+            vst1q_u8(lo + i, v.val[0]);
+            vst1q_u8(hi + i, v.val[1]);
+        }
+#endif
+        for (; i < count; ++i) {
+            lo[i] = src[2 * i];
+            hi[i] = src[2 * i + 1];
+        }
+    } else {
+        for (unsigned k = 0; k < bpe && count; ++k) {
+            uint8_t* plane = dst + k * count;
+            for (size_t i = 0; i < count; ++i)
+                plane[i] = src[i * bpe + k];
+        }
+    }
+    memcpy(dst + count * bpe, src + count * bpe, n - count * bpe); // NOLINT
+}
+
+void
+raw_unshuffle(uint8_t* dst, const uint8_t* src, size_t n, unsigned bpe)
+{
+    const size_t count = bpe > 1 ? n / bpe : 0;
+    if (bpe == 2) {
+        const uint8_t* lo = src;
+        const uint8_t* hi = src + count;
+        size_t i = 0;
+#if defined(HAVE_SSE2)
+        for (; i + 16 <= count; i += 16) {
+            const __m128i l = _mm_loadu_si128((const __m128i*)(lo + i));
+            const __m128i h = _mm_loadu_si128((const __m128i*)(hi + i));
+            _mm_storeu_si128((__m128i*)(dst + 2 * i), _mm_unpacklo_epi8(l, h));
+            _mm_storeu_si128((__m128i*)(dst + 2 * i + 16),
+                             _mm_unpackhi_epi8(l, h));
+        }
+#elif defined(HAVE_NEON)
+        for (; i + 16 <= count; i += 16) {
+            const uint8x16x2_t v = { { vld1q_u8(lo + i), vld1q_u8(hi + i) } };
+            vst2q_u8(dst + 2 * i, v);
+        }
+#endif
+        for (; i < count; ++i) {
+            dst[2 * i] = lo[i];
+            dst[2 * i + 1] = hi[i];
+        }
+    } else {
+        for (unsigned k = 0; k < bpe && count; ++k) {
+            const uint8_t* plane = src + k * count;
+            for (size_t i = 0; i < count; ++i)
+                dst[i * bpe + k] = plane[i];
+        }
+    }
+    memcpy(dst + count * bpe, src + count * bpe, n - count * bpe); // NOLINT
+}
+
+static uint64_t
+load64(const uint8_t* p)
+{
+    uint64_t v;
+    memcpy(&v, p, sizeof(v)); // NOLINT
+    return v;
+}
+
+/// Transposes the 8x8 bit matrix whose rows are the bytes of `x`: bit `j` of
+/// byte `i` becomes bit `i` of byte `j`. Assumes a little endian host.
+static uint64_t
+transpose8(uint64_t x)
+{
+    uint64_t t;
+    t = (x ^ (x >> 7)) & 0x00aa00aa00aa00aaULL;
+    x = x ^ t ^ (t << 7);
+    t = (x ^ (x >> 14)) & 0x0000cccc0000ccccULL;
+    x = x ^ t ^ (t << 14);
+    t = (x ^ (x >> 28)) & 0x00000000f0f0f0f0ULL;
+    return x ^ t ^ (t << 28);
+}
+
+/// Splits the `m` bytes at `src`, a multiple of 8, into 8 bit planes.
+static void
+bit_transpose(uint8_t* dst, const uint8_t* src, size_t m)
+{
+    const size_t stride = m / 8;
+    size_t i = 0;
+#ifdef HAVE_SSE2
+    // movemask collects the top bit of 16 bytes at once.
+    for (; i + 16 <= m; i += 16) {
+        __m128i x = _mm_loadu_si128((const __m128i*)(src + i));
+        for (int j = 7; j >= 0; --j) {
+            const uint16_t bits = (uint16_t)_mm_movemask_epi8(x);
+            memcpy(dst + j * stride + i / 8, &bits, sizeof(bits)); // NOLINT
+            x = _mm_add_epi8(x, x);
+        }
+    }
+#endif
+    for (; i < m; i += 8) {
+        const uint64_t y = transpose8(load64(src + i));
+        for (int j = 0; j < 8; ++j)
+            dst[j * stride + i / 8] = (uint8_t)(y >> (8 * j));
+    }
+}
+
+/// Inverse of `bit_transpose()`.
+static void
+bit_untranspose(uint8_t* dst, const uint8_t* src, size_t m)
+{
+    const size_t stride = m / 8;
+    for (size_t i = 0; i < m; i += 8) {
+        uint64_t y = 0;
+        for (int j = 0; j < 8; ++j)
+            y |= (uint64_t)src[j * stride + i / 8] << (8 * j);
+        const uint64_t x = transpose8(y);
+        memcpy(dst + i, &x, sizeof(x)); // NOLINT
+    }
+}
+
+void
+raw_bitshuffle(uint8_t* dst,
+               const uint8_t* src,
+               size_t n,
+               unsigned bpe,
+               uint8_t* tmp)
+{
+    if (bpe < 1)
+        bpe = 1;
+    const size_t count = n / bpe;
+    const size_t whole = count & ~(size_t)7;
+    raw_shuffle(tmp, src, n, bpe);
+    for (unsigned k = 0; k < bpe; ++k) {
+        const uint8_t* plane = tmp + k * count;
+        bit_transpose(dst + k * count, plane, whole);
+        memcpy(dst + k * count + whole, plane + whole, count - whole); // NOLINT
+    }
+    memcpy(dst + count * bpe, tmp + count * bpe, n - count * bpe); // NOLINT
+}
+
+void
+raw_unbitshuffle(uint8_t* dst,
+                 const uint8_t* src,
+                 size_t n,
+                 unsigned bpe,
+                 uint8_t* tmp)
+{
+    if (bpe < 1)
+        bpe = 1;
+    const size_t count = n / bpe;
+    const size_t whole = count & ~(size_t)7;
+    for (unsigned k = 0; k < bpe; ++k) {
+        const uint8_t* plane = src + k * count;
+        bit_untranspose(tmp + k * count, plane, whole);
+        memcpy(tmp + k * count + whole, plane + whole, count - whole); // NOLINT
+    }
+    memcpy(tmp + count * bpe, src + count * bpe, n - count * bpe); // NOLINT
+    raw_unshuffle(dst, tmp, n, bpe);
+}
+
+size_t
+raw_codec_compress_block(uint8_t* dst,
+                         const uint8_t* src,
+                         size_t n,
+                         unsigned bpe,
+                         unsigned shuffle,
+                         uint8_t* scratch)
+{
+    size_t nout = 0;
+    if (n > 1) {
+        if (shuffle == RawShuffle_Bit)
+            raw_bitshuffle(scratch, src, n, bpe, dst); // `dst` as scratch
+        else
+            raw_shuffle(scratch, src, n, bpe);
+        nout = raw_lz_compress(dst, n - 1, scratch, n);
+    }
+    if (!nout) {
+        memcpy(dst, src, n); // NOLINT
+        nout = n;
+    }
+    return nout;
+}
+
+int
+raw_codec_decompress_block(uint8_t* dst,
+                           size_t n,
+                           const uint8_t* src,
+                           size_t nsrc,
+                           unsigned bpe,
+                           unsigned shuffle,
+                           uint8_t* scratch)
+{
+    if (nsrc == n) {
+        memcpy(dst, src, n); // NOLINT
+        return 1;
+    }
+    if (nsrc > n)
+        return 0;
+    if (shuffle == RawShuffle_Bit) {
+        if (!raw_lz_decompress(dst, n, src, nsrc))
+            return 0;
+        raw_unbitshuffle(dst, dst, n, bpe, scratch);
+        return 1;
+    }
+    if (bpe <= 1)
+        return raw_lz_decompress(dst, n, src, nsrc);
+    if (!raw_lz_decompress(scratch, n, src, nsrc))
+        return 0;
+    raw_unshuffle(dst, scratch, n, bpe);
+    return 1;
+}
+
+#ifndef NO_UNIT_TESTS
+#include "device/kit/driver.h"
+#include "logger.h"
+
+#include <stdlib.h>
+
+#define LOGE(...) aq_logger(1, __FILE__, __LINE__, __FUNCTION__, __VA_ARGS__)
+#define EXPECT(e, ...)                                                         \
+    do {                                                                       \
+        if (!(e)) {                                                            \
+            LOGE(__VA_ARGS__);                                                 \
+            goto Error;                                                        \
+        }                                                                      \
+    } while (0)
+
+acquire_export int
+unit_test_raw_codec()
+{
+    const size_t cap = 200000;
+    uint8_t *src = malloc(cap), *packed = malloc(cap), *out = malloc(cap),
+            *scratch = malloc(cap);
+    uint64_t state = 1;
+    EXPECT(src && packed && out && scratch, "Allocation failed");
+
+    // 0: noise, 1: a constant, 2: slowly varying 16 bit samples, 3: noise
+    // in the low 5 bits of 16 bit samples, 4: a short repeating pattern
+    for (int kind = 0; kind < 5; ++kind) {
+        for (size_t i = 0; i < cap; ++i) {
+            state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+            const uint8_t r = (uint8_t)(state >> 56);
+            switch (kind) {
+                case 0:
+                    src[i] = r;
+                    break;
+                case 1:
+                    src[i] = 7;
+                    break;
+                case 2:
+                    src[i] = (i & 1) ? (uint8_t)(i >> 13) : (uint8_t)(i >> 5);
+                    break;
+                case 3:
+                    src[i] = (i & 1) ? 1 : (r & 31);
+                    break;
+                default:
+                    src[i] = (uint8_t)("abcabd"[i % 6]);
+            }
+        }
+        for (size_t n = 0; n < cap; n = n * 3 + 1) {
+            for (unsigned bpe = 1; bpe <= 4; ++bpe) {
+                raw_shuffle(scratch, src, n, bpe);
+                raw_unshuffle(out, scratch, n, bpe);
+                EXPECT(!memcmp(out, src, n),
+                       "Shuffle round trip failed. n=%d bpe=%d",
+                       (int)n,
+                       (int)bpe);
+                EXPECT(n < 2 * bpe || bpe < 2 || scratch[1] == src[bpe],
+                       "Not shuffled. n=%d bpe=%d",
+                       (int)n,
+                       (int)bpe);
+
+                raw_bitshuffle(scratch, src, n, bpe, packed);
+                raw_unbitshuffle(out, scratch, n, bpe, packed);
+                EXPECT(!memcmp(out, src, n),
+                       "Bit shuffle round trip failed. n=%d bpe=%d",
+                       (int)n,
+                       (int)bpe);
+                EXPECT(n < 8 * bpe ||
+                         ((scratch[0] & 1) == (src[0] & 1) &&
+                          ((scratch[0] >> 1) & 1) == (src[bpe] & 1)),
+                       "Not bit shuffled. n=%d bpe=%d",
+                       (int)n,
+                       (int)bpe);
+
+                for (unsigned shuffle = RawShuffle_Byte;
+                     shuffle <= RawShuffle_Bit;
+                     ++shuffle) {
+                    const size_t m = raw_codec_compress_block(
+                      packed, src, n, bpe, shuffle, scratch);
+                    EXPECT(m <= n, "Block grew. n=%d", (int)n);
+                    memset(out, 0xcd, n); // NOLINT
+                    EXPECT(raw_codec_decompress_block(
+                             out, n, packed, m, bpe, shuffle, scratch) &&
+                             !memcmp(out, src, n),
+                           "Block round trip failed. kind=%d n=%d bpe=%d "
+                           "shuffle=%d",
+                           kind,
+                           (int)n,
+                           bpe,
+                           shuffle);
+                    if (kind == 1 && n > 1000)
+                        EXPECT(m < n / 20,
+                               "A constant should compress well. %d -> %d",
+                               (int)n,
+                               (int)m);
+                    // Input that doesn't fit must be rejected, not overrun.
+                    EXPECT(m == n || !raw_lz_decompress(out, n - 1, packed, m),
+                           "Decompressed past the end of the output.");
+                }
+            }
+        }
+    }
+    free(src);
+    free(packed);
+    free(out);
+    free(scratch);
+    return 1;
+Error:
+    free(src);
+    free(packed);
+    free(out);
+    free(scratch);
+    return 0;
+}
+#endif // NO_UNIT_TESTS
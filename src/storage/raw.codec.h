@@ -0,0 +1,87 @@
+#ifndef H_ACQUIRE_DRIVER_BASICS_STORAGE_RAW_CODEC_V0
+#define H_ACQUIRE_DRIVER_BASICS_STORAGE_RAW_CODEC_V0
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    /// The block codec behind compressed raw frames. See raw.index.h for the
+    /// frame layout and raw.codec.c for the LZ format.
+    ///
+    /// Like the reader, this doesn't depend on the rest of the driver.
+
+    /// Gathers byte `k` of every `bpe` byte element of `src` into the `k`-th
+    /// of `bpe` planes in `dst`. Bytes past the last whole element are
+    /// copied as is.
+    void raw_shuffle(uint8_t* dst, const uint8_t* src, size_t n, unsigned bpe);
+
+    /// Inverse of `raw_shuffle()`.
+    void raw_unshuffle(uint8_t* dst,
+                       const uint8_t* src,
+                       size_t n,
+                       unsigned bpe);
+
+    /// Byte shuffles `src` into `tmp`, then splits each of the byte planes
+    /// into 8 bit planes in `dst`: bit `i % 8` of byte `i / 8` of plane `j`
+    /// is bit `j` of the byte in element `i`. Elements past the last whole
+    /// group of 8 in a plane, and bytes past the last whole element, are
+    /// copied as is. A plane of bits that are all the same then compresses
+    /// to almost nothing, even if the bits below it are noise.
+    void raw_bitshuffle(uint8_t* dst,
+                        const uint8_t* src,
+                        size_t n,
+                        unsigned bpe,
+                        uint8_t* tmp);
+
+    /// Inverse of `raw_bitshuffle()`. `dst` may be `src`.
+    void raw_unbitshuffle(uint8_t* dst,
+                          const uint8_t* src,
+                          size_t n,
+                          unsigned bpe,
+                          uint8_t* tmp);
+
+    /// Compresses `[src,src+n)` into at most `capacity` bytes of `dst`.
+    /// @returns the compressed size, or 0 if it doesn't fit.
+    size_t raw_lz_compress(uint8_t* dst,
+                           size_t capacity,
+                           const uint8_t* src,
+                           size_t n);
+
+    /// Decompresses `[src,src+nsrc)`, which must produce exactly `n` bytes.
+    /// @returns 1 on success, 0 if the input is corrupt.
+    int raw_lz_decompress(uint8_t* dst,
+                          size_t n,
+                          const uint8_t* src,
+                          size_t nsrc);
+
+    /// Shuffles, with `shuffle` of `enum RawShuffle` (raw.index.h), and
+    /// compresses a block of `n` bytes into `dst`, which holds at least `n`
+    /// bytes. Stores the block as is when that's no bigger. `scratch` holds
+    /// `n` bytes.
+    /// @returns the number of bytes written to `dst`.
+    size_t raw_codec_compress_block(uint8_t* dst,
+                                    const uint8_t* src,
+                                    size_t n,
+                                    unsigned bpe,
+                                    unsigned shuffle,
+                                    uint8_t* scratch);
+
+    /// Inverse of `raw_codec_compress_block()`. `scratch` holds `n` bytes.
+    /// @returns 1 on success, 0 if the input is corrupt.
+    int raw_codec_decompress_block(uint8_t* dst,
+                                   size_t n,
+                                   const uint8_t* src,
+                                   size_t nsrc,
+                                   unsigned bpe,
+                                   unsigned shuffle,
+                                   uint8_t* scratch);
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif // H_ACQUIRE_DRIVER_BASICS_STORAGE_RAW_CODEC_V0
@@ -0,0 +1,222 @@
+#ifndef H_ACQUIRE_DRIVER_BASICS_STORAGE_RAW_INDEX_V0
+#define H_ACQUIRE_DRIVER_BASICS_STORAGE_RAW_INDEX_V0
+
+#include "device/props/components.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifndef acquire_export
+#if defined(_WIN32)
+#define acquire_export __declspec(dllexport)
+#else
+#define acquire_export __attribute__((visibility("default")))
+#endif
+#endif
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    /// A raw file is a concatenation of `VideoFrame` records. Next to each
+    /// one, e.g. `out.raw`, the raw device can write an index, `out.raw.idx`
+    /// (see `ACQUIRE_RAW_INDEX`): a `RawIndexHeader` followed by one
+    /// `RawIndexEntry` per frame, in the order the frames appear. All fields
+    /// are little endian.
+    ///
+    /// Entries are written as frames are appended, before their bytes reach
+    /// the raw file. While the device runs, or after a crash, the index can
+    /// list frames the raw file doesn't hold yet. Readers must ignore entries
+    /// that end past the raw file's size.
+
+#define RAW_INDEX_MAGIC "AQRAWIDX"
+#define RAW_INDEX_VERSION (2)
+
+    struct RawIndexHeader
+    {
+        char magic[8]; ///< RAW_INDEX_MAGIC, not terminated
+        uint32_t version;
+        uint32_t bytes_of_entry; ///< sizeof(struct RawIndexEntry)
+    };
+
+    struct RawIndexEntry
+    {
+        uint64_t offset;         ///< of the frame's header in the raw file
+        uint64_t bytes_of_frame; ///< header and pixels
+        uint64_t frame_id;
+        uint64_t hardware_frame_id;
+        uint64_t timestamp_hardware;
+        uint64_t timestamp_acq_thread;
+        uint32_t crc32c; ///< see `RawIndex_Crc32c`
+        uint32_t flags;  ///< `enum RawIndexFlags`
+    };
+
+    enum RawIndexFlags
+    {
+        /// `crc32c` holds the CRC-32C (see crc32c.h) of the frame's bytes
+        /// after its header, as they are in the raw file. Written with
+        /// `ACQUIRE_RAW_CRC32C`.
+        RawIndex_Crc32c = 1,
+        /// The frame is split, see below: `offset` is where its pixels
+        /// start.
+        RawIndex_Split = 2,
+    };
+
+    /// With the split layout (`ACQUIRE_RAW_LAYOUT=split`), the raw file only
+    /// holds pixels. A frame's pixels start at a multiple of
+    /// `RAW_SPLIT_ALIGN` and are padded with zeros up to the next one, so
+    /// they can be mapped as an array. The frame headers go to `out.raw.hdr`:
+    /// a `RawIndexHeader` with `RAW_HEADERS_MAGIC`, then the `VideoFrame`
+    /// header of each frame, in order. A frame's pixels are its
+    /// `bytes_of_frame - sizeof(struct VideoFrame)` bytes.
+
+#define RAW_SPLIT_ALIGN (4096)
+#define RAW_HEADERS_MAGIC "AQRAWHDR"
+#define RAW_HEADERS_VERSION (1)
+
+    /// With compression (`ACQUIRE_RAW_COMPRESS`), a frame's pixels are
+    /// replaced by a `RawCompressedHeader` and a payload, and the frame's
+    /// `bytes_of_frame` covers those instead, rounded up to 8 bytes. The
+    /// pixels are cut into blocks of `bytes_per_block`. Each block is
+    /// shuffled, see `enum RawShuffle`, and then LZ compressed (see
+    /// raw.codec.c). The payload is the compressed size of every block, as
+    /// uint32s, followed by the blocks. A block whose compressed size is its
+    /// size is stored as it was. Use `raw_frame_decompress()` to get the
+    /// frame back.
+
+#define RAW_COMPRESSED_MAGIC "AQRAWLZ1"
+
+    enum RawShuffle
+    {
+        /// Byte 0 of every sample comes first, then byte 1, and so on.
+        RawShuffle_Byte = 1,
+        /// As for bytes, then each byte plane is split into 8 bit planes.
+        RawShuffle_Bit = 2,
+    };
+
+    struct RawCompressedHeader
+    {
+        char magic[8];              ///< RAW_COMPRESSED_MAGIC, not terminated
+        uint16_t shuffle;           ///< enum RawShuffle
+        uint16_t bytes_per_element; ///< of the shuffle
+        uint32_t bytes_per_block;   ///< before compression
+        uint64_t bytes_of_data;     ///< pixels before compression
+        uint64_t bytes_of_payload;  ///< block sizes and blocks
+    };
+
+    /// @returns the size of `frame`, header included, once decompressed, or
+    ///          its size if it isn't compressed.
+    acquire_export uint64_t raw_frame_decompressed_bytes(
+      const struct VideoFrame* frame);
+
+    /// Writes `frame`, decompressed, to `dst`, which holds `nbytes`. Frames
+    /// that aren't compressed are copied.
+    /// @returns 1 on success, 0 if `nbytes` is too small or the frame is
+    ///          corrupt.
+    acquire_export int raw_frame_decompress(const struct VideoFrame* frame,
+                                            void* dst,
+                                            size_t nbytes);
+
+    /// Random access to the frames of a raw file. The raw file and its index
+    /// are memory mapped, so finding a frame is O(1) and reading it only
+    /// touches its pages.
+    ///
+    /// The reader doesn't depend on the rest of the driver. It's exported
+    /// from it, and built as the `acquire-raw-reader` static library for
+    /// programs that don't load the driver.
+    struct RawReader;
+
+    /// Opens the raw file at `path` and its index, `<path>.idx`. Without an
+    /// index the frame headers are walked once instead, those in
+    /// `<path>.hdr` if there is one. Index entries for frames past the end of
+    /// the raw file, e.g. while it's still being written, are ignored.
+    /// @returns NULL on failure.
+    acquire_export struct RawReader* raw_reader_open(const char* path);
+
+    /// Accepts NULL.
+    acquire_export void raw_reader_close(struct RawReader* self);
+
+    acquire_export uint64_t
+    raw_reader_frame_count(const struct RawReader* self);
+
+    /// @returns NULL if `i` is out of range.
+    acquire_export const struct RawIndexEntry* raw_reader_entry(
+      const struct RawReader* self,
+      uint64_t i);
+
+    /// @returns frame `i`, pointing into the mapped file, or NULL if `i` is
+    ///          out of range, the frame is split or the file doesn't match
+    ///          its index. Compressed frames are returned compressed.
+    acquire_export const struct VideoFrame* raw_reader_frame(
+      const struct RawReader* self,
+      uint64_t i);
+
+    /// @returns the header of frame `i`, split or not, or NULL as for
+    ///          `raw_reader_frame()`. Split frames' pixels don't follow their
+    ///          header.
+    acquire_export const struct VideoFrame* raw_reader_header(
+      const struct RawReader* self,
+      uint64_t i);
+
+    /// @returns the bytes after frame `i`'s header, split or not, pointing
+    ///          into the mapped file, or NULL as for `raw_reader_frame()`.
+    ///          Split frames' pixels are aligned to `RAW_SPLIT_ALIGN`.
+    acquire_export const void* raw_reader_pixels(const struct RawReader* self,
+                                                 uint64_t i);
+
+    /// Checks frame `i` against the CRC-32C in its index entry.
+    /// @returns 1 if it matches, 0 if it doesn't or the frame can't be read,
+    ///          or -1 if the entry has no CRC.
+    acquire_export int raw_reader_verify(const struct RawReader* self,
+                                         uint64_t i);
+
+    /// Binary search for `frame_id`, for files whose frame ids increase.
+    /// @returns the frame's position, or -1 if it isn't there.
+    acquire_export int64_t raw_reader_find_frame_id(
+      const struct RawReader* self,
+      uint64_t frame_id);
+
+    /// The frames of a striped acquisition, in the order they were appended.
+    /// See `ACQUIRE_RAW_STRIPES`. Every file of every target is opened with
+    /// `raw_reader_open()`.
+    struct RawStripes;
+
+    /// Opens the stripe manifest at `path`, the storage device's filename,
+    /// and the files it lists. Relative file paths are taken relative to the
+    /// manifest's directory. Runs of frames that the files don't hold, e.g.
+    /// after a crash, end the sequence.
+    /// @returns NULL on failure.
+    acquire_export struct RawStripes* raw_stripes_open(const char* path);
+
+    /// Accepts NULL.
+    acquire_export void raw_stripes_close(struct RawStripes* self);
+
+    acquire_export uint64_t
+    raw_stripes_frame_count(const struct RawStripes* self);
+
+    /// @returns frame `i`, or NULL if `i` is out of range or the frame's
+    ///          file doesn't match its index.
+    acquire_export const struct VideoFrame* raw_stripes_frame(
+      const struct RawStripes* self,
+      uint64_t i);
+
+    /// As `raw_reader_header()`, for frame `i` of the sequence.
+    acquire_export const struct VideoFrame* raw_stripes_header(
+      const struct RawStripes* self,
+      uint64_t i);
+
+    /// As `raw_reader_pixels()`, for frame `i` of the sequence.
+    acquire_export const void* raw_stripes_pixels(
+      const struct RawStripes* self,
+      uint64_t i);
+
+    /// As `raw_reader_verify()`, for frame `i` of the sequence.
+    acquire_export int raw_stripes_verify(const struct RawStripes* self,
+                                          uint64_t i);
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif // H_ACQUIRE_DRIVER_BASICS_STORAGE_RAW_INDEX_V0
@@ -0,0 +1,703 @@
+#include "raw.index.h"
+#include "raw.codec.h"
+#include "crc32c.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+/// A read-only view of a whole file.
+struct mapping
+{
+    const uint8_t* data; ///< NULL for an empty file
+    uint64_t size;
+#ifdef _WIN32
+    HANDLE file, map;
+#endif
+};
+
+static int
+map_file(struct mapping* m, const char* path)
+{
+    memset(m, 0, sizeof(*m)); // NOLINT
+#ifdef _WIN32
+    LARGE_INTEGER size;
+    m->file = CreateFileA(path,
+                          GENERIC_READ,
+                          FILE_SHARE_READ | FILE_SHARE_WRITE,
+                          0,
+                          OPEN_EXISTING,
+                          FILE_ATTRIBUTE_NORMAL,
+                          0);
+    if (m->file == INVALID_HANDLE_VALUE) {
+        m->file = 0;
+        return 0;
+    }
+    if (!GetFileSizeEx(m->file, &size))
+        goto Error;
+    m->size = (uint64_t)size.QuadPart;
+    if (!m->size)
+        return 1;
+    if (!(m->map = CreateFileMappingA(m->file, 0, PAGE_READONLY, 0, 0, 0)))
+        goto Error;
+    if (!(m->data = MapViewOfFile(m->map, FILE_MAP_READ, 0, 0, 0)))
+        goto Error;
+    return 1;
+Error:
+    if (m->map)
+        CloseHandle(m->map);
+    CloseHandle(m->file);
+    memset(m, 0, sizeof(*m)); // NOLINT
+    return 0;
+#else
+    struct stat st;
+    const int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return 0;
+    if (fstat(fd, &st) < 0)
+        goto Error;
+    m->size = (uint64_t)st.st_size;
+    if (m->size) {
+        void* p = mmap(0, m->size, PROT_READ, MAP_SHARED, fd, 0);
+        if (p == MAP_FAILED)
+            goto Error;
+        m->data = p;
+    }
+    close(fd);
+    return 1;
+Error:
+    close(fd);
+    return 0;
+#endif
+}
+
+static void
+unmap_file(struct mapping* m)
+{
+#ifdef _WIN32
+    if (m->data)
+        UnmapViewOfFile(m->data);
+    if (m->map)
+        CloseHandle(m->map);
+    if (m->file)
+        CloseHandle(m->file);
+#else
+    if (m->data)
+        munmap((void*)m->data, m->size);
+#endif
+    memset(m, 0, sizeof(*m)); // NOLINT
+}
+
+struct RawReader
+{
+    struct mapping data, index, headers;
+    const struct RawIndexEntry* entries; ///< into `index`, or `owned`
+    struct RawIndexEntry* owned; ///< built by walking when there's no index
+    uint64_t count;
+    const struct VideoFrame* split; ///< into `headers`, for split frames
+    uint64_t nsplit;
+};
+
+/// @returns the bytes of the frame that are in the raw file.
+static uint64_t
+bytes_in_file(const struct RawIndexEntry* e)
+{
+    return e->flags & RawIndex_Split
+             ? e->bytes_of_frame - sizeof(struct VideoFrame)
+             : e->bytes_of_frame;
+}
+
+/// @returns the number of leading entries that lie within the raw file, and
+///          for split frames, the header file.
+static uint64_t
+count_valid(const struct RawReader* self,
+            const struct RawIndexEntry* entries,
+            uint64_t n)
+{
+    const uint64_t size = self->data.size;
+    uint64_t i = 0;
+    for (; i < n; ++i) {
+        const struct RawIndexEntry* e = entries + i;
+        if (e->bytes_of_frame < sizeof(struct VideoFrame) || e->offset > size ||
+            bytes_in_file(e) > size - e->offset ||
+            ((e->flags & RawIndex_Split) && i >= self->nsplit))
+            break;
+    }
+    return i;
+}
+
+static int
+use_headers(struct RawReader* self)
+{
+    const struct mapping* m = &self->headers;
+    const struct RawIndexHeader* h = (const struct RawIndexHeader*)m->data;
+    if (m->size < sizeof(*h) || memcmp(h->magic, RAW_HEADERS_MAGIC, 8) ||
+        h->version != RAW_HEADERS_VERSION ||
+        h->bytes_of_entry != sizeof(struct VideoFrame))
+        return 0;
+    self->split = (const struct VideoFrame*)(m->data + sizeof(*h));
+    self->nsplit = (m->size - sizeof(*h)) / sizeof(struct VideoFrame);
+    return 1;
+}
+
+static int
+use_index(struct RawReader* self)
+{
+    const struct mapping* m = &self->index;
+    const struct RawIndexHeader* h = (const struct RawIndexHeader*)m->data;
+    if (m->size < sizeof(*h) || memcmp(h->magic, RAW_INDEX_MAGIC, 8) ||
+        h->version != RAW_INDEX_VERSION ||
+        h->bytes_of_entry != sizeof(struct RawIndexEntry))
+        return 0;
+    self->entries = (const struct RawIndexEntry*)(m->data + sizeof(*h));
+    self->count = count_valid(
+      self, self->entries, (m->size - sizeof(*h)) / sizeof(*self->entries));
+    return 1;
+}
+
+static int
+reserve_owned(struct RawReader* self, uint64_t* capacity)
+{
+    if (self->count < *capacity)
+        return 1;
+    *capacity = *capacity ? 2 * *capacity : 1024;
+    struct RawIndexEntry* e = realloc(self->owned, *capacity * sizeof(*e));
+    if (!e)
+        return 0;
+    self->owned = e;
+    return 1;
+}
+
+static struct RawIndexEntry
+entry_of(const struct VideoFrame* f, uint64_t offset)
+{
+    return (struct RawIndexEntry){
+        .offset = offset,
+        .bytes_of_frame = f->bytes_of_frame,
+        .frame_id = f->frame_id,
+        .hardware_frame_id = f->hardware_frame_id,
+        .timestamp_hardware = f->timestamps.hardware,
+        .timestamp_acq_thread = f->timestamps.acq_thread,
+    };
+}
+
+/// Builds the index from the headers of split frames. Each frame's pixels
+/// start where the padded pixels of the one before end.
+static int
+walk_split(struct RawReader* self)
+{
+    uint64_t capacity = 0, offset = 0;
+    for (uint64_t i = 0; i < self->nsplit; ++i) {
+        const struct VideoFrame* f = self->split + i;
+        if (f->bytes_of_frame < sizeof(*f))
+            break;
+        const uint64_t npx = f->bytes_of_frame - sizeof(*f);
+        if (offset > self->data.size || npx > self->data.size - offset)
+            break;
+        if (!reserve_owned(self, &capacity))
+            return 0;
+        self->owned[self->count] = entry_of(f, offset);
+        self->owned[self->count++].flags = RawIndex_Split;
+        offset += (npx + RAW_SPLIT_ALIGN - 1) / RAW_SPLIT_ALIGN *
+                  RAW_SPLIT_ALIGN;
+    }
+    self->entries = self->owned;
+    return 1;
+}
+
+/// Builds the index by walking the frame headers.
+static int
+walk(struct RawReader* self)
+{
+    uint64_t capacity = 0, offset = 0;
+    while (offset + sizeof(struct VideoFrame) <= self->data.size) {
+        const struct VideoFrame* f =
+          (const struct VideoFrame*)(self->data.data + offset);
+        if (f->bytes_of_frame < sizeof(*f) ||
+            f->bytes_of_frame > self->data.size - offset)
+            break;
+        if (!reserve_owned(self, &capacity))
+            return 0;
+        self->owned[self->count++] = entry_of(f, offset);
+        offset += f->bytes_of_frame;
+    }
+    self->entries = self->owned;
+    return 1;
+}
+
+struct RawReader*
+raw_reader_open(const char* path)
+{
+    struct RawReader* self = 0;
+    char* sidecar_path = 0;
+    const size_t n = strlen(path);
+    if (!(self = malloc(sizeof(*self))))
+        goto Error;
+    memset(self, 0, sizeof(*self)); // NOLINT
+    if (!map_file(&self->data, path))
+        goto Error;
+    if (!(sidecar_path = malloc(n + sizeof(".idx"))))
+        goto Error;
+    memcpy(sidecar_path, path, n);                    // NOLINT
+    memcpy(sidecar_path + n, ".hdr", sizeof(".hdr")); // NOLINT
+    if (!(map_file(&self->headers, sidecar_path) && use_headers(self)))
+        unmap_file(&self->headers);
+    memcpy(sidecar_path + n, ".idx", sizeof(".idx")); // NOLINT
+    if (!(map_file(&self->index, sidecar_path) && use_index(self))) {
+        unmap_file(&self->index);
+        if (!(self->split ? walk_split(self) : walk(self)))
+            goto Error;
+    }
+    free(sidecar_path);
+    return self;
+Error:
+    free(sidecar_path);
+    raw_reader_close(self);
+    return 0;
+}
+
+void
+raw_reader_close(struct RawReader* self)
+{
+    if (!self)
+        return;
+    unmap_file(&self->data);
+    unmap_file(&self->index);
+    unmap_file(&self->headers);
+    free(self->owned);
+    free(self);
+}
+
+uint64_t
+raw_reader_frame_count(const struct RawReader* self)
+{
+    return self->count;
+}
+
+const struct RawIndexEntry*
+raw_reader_entry(const struct RawReader* self, uint64_t i)
+{
+    return i < self->count ? self->entries + i : 0;
+}
+
+const struct VideoFrame*
+raw_reader_frame(const struct RawReader* self, uint64_t i)
+{
+    const struct RawIndexEntry* e = raw_reader_entry(self, i);
+    return e && !(e->flags & RawIndex_Split) ? raw_reader_header(self, i) : 0;
+}
+
+const struct VideoFrame*
+raw_reader_header(const struct RawReader* self, uint64_t i)
+{
+    const struct RawIndexEntry* e = raw_reader_entry(self, i);
+    if (!e)
+        return 0;
+    const struct VideoFrame* f =
+      e->flags & RawIndex_Split
+        ? self->split + i
+        : (const struct VideoFrame*)(self->data.data + e->offset);
+    return f->bytes_of_frame == e->bytes_of_frame && f->frame_id == e->frame_id
+             ? f
+             : 0;
+}
+
+const void*
+raw_reader_pixels(const struct RawReader* self, uint64_t i)
+{
+    const struct RawIndexEntry* e = raw_reader_entry(self, i);
+    const struct VideoFrame* f = raw_reader_header(self, i);
+    if (!f)
+        return 0;
+    return e->flags & RawIndex_Split ? self->data.data + e->offset : f->data;
+}
+
+int
+raw_reader_verify(const struct RawReader* self, uint64_t i)
+{
+    const struct RawIndexEntry* e = raw_reader_entry(self, i);
+    if (e && !(e->flags & RawIndex_Crc32c))
+        return -1;
+    const void* pixels = raw_reader_pixels(self, i);
+    return pixels &&
+           crc32c(0, pixels, e->bytes_of_frame - sizeof(struct VideoFrame)) ==
+             e->crc32c;
+}
+
+int64_t
+raw_reader_find_frame_id(const struct RawReader* self, uint64_t frame_id)
+{
+    uint64_t lo = 0, hi = self->count;
+    while (lo < hi) {
+        const uint64_t mid = lo + (hi - lo) / 2;
+        if (self->entries[mid].frame_id < frame_id)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo < self->count && self->entries[lo].frame_id == frame_id
+             ? (int64_t)lo
+             : -1;
+}
+
+struct RawStripeTarget
+{
+    struct RawReader** files;
+    uint64_t* ends; ///< frames in `files[0]` through `files[k]`
+    unsigned nfiles;
+    uint64_t nframes; ///< frames the runs put on this target
+};
+
+struct RawStripeRun
+{
+    uint64_t first; ///< position of the run's first frame
+    uint64_t local; ///< position of the same frame on its target
+    uint64_t nframes;
+    unsigned target;
+};
+
+struct RawStripes
+{
+    struct RawStripeTarget* targets;
+    unsigned ntargets;
+    struct RawStripeRun* runs;
+    size_t nruns, capacity;
+    uint64_t count;
+};
+
+/// @returns target `t`, adding it and any before it as needed.
+static struct RawStripeTarget*
+get_target(struct RawStripes* self, unsigned t)
+{
+    if (t >= 4096) // not a manifest the driver wrote
+        return 0;
+    if (t >= self->ntargets) {
+        struct RawStripeTarget* targets =
+          realloc(self->targets, (t + 1) * sizeof(*targets));
+        if (!targets)
+            return 0;
+        memset(targets + self->ntargets, // NOLINT
+               0,
+               (t + 1 - self->ntargets) * sizeof(*targets));
+        self->targets = targets;
+        self->ntargets = t + 1;
+    }
+    return self->targets + t;
+}
+
+static int
+add_run(struct RawStripes* self, unsigned t, uint64_t nframes)
+{
+    struct RawStripeTarget* target = get_target(self, t);
+    if (!target)
+        return 0;
+    if (self->nruns == self->capacity) {
+        const size_t capacity = self->capacity ? 2 * self->capacity : 1024;
+        struct RawStripeRun* runs =
+          realloc(self->runs, capacity * sizeof(*runs));
+        if (!runs)
+            return 0;
+        self->runs = runs;
+        self->capacity = capacity;
+    }
+    self->runs[self->nruns++] = (struct RawStripeRun){
+        .first = self->count,
+        .local = target->nframes,
+        .nframes = nframes,
+        .target = t,
+    };
+    self->count += nframes;
+    target->nframes += nframes;
+    return 1;
+}
+
+/// @returns `name` if it's absolute, or else `name` relative to the directory
+///          of the manifest at `manifest`. The caller frees it.
+static char*
+resolve_path(const char* manifest, const char* name)
+{
+    const int is_absolute =
+      name[0] == '/' || name[0] == '\\' ||
+      (((name[0] | 0x20) >= 'a' && (name[0] | 0x20) <= 'z') && name[1] == ':');
+    size_t ndir = 0;
+    if (!is_absolute)
+        for (size_t i = 0; manifest[i]; ++i)
+            if (manifest[i] == '/' || manifest[i] == '\\')
+                ndir = i + 1;
+    const size_t cap = ndir + strlen(name) + 1;
+    char* path = malloc(cap);
+    if (path)
+        snprintf(path, cap, "%.*s%s", (int)ndir, manifest, name);
+    return path;
+}
+
+static int
+add_file(struct RawStripes* self,
+         unsigned t,
+         const char* manifest,
+         const char* name)
+{
+    struct RawStripeTarget* target = get_target(self, t);
+    char* path = 0;
+    if (!target)
+        return 0;
+    const unsigned n = target->nfiles + 1;
+    struct RawReader** files = realloc(target->files, n * sizeof(*files));
+    if (!files)
+        return 0;
+    target->files = files;
+    uint64_t* ends = realloc(target->ends, n * sizeof(*ends));
+    if (!ends)
+        return 0;
+    target->ends = ends;
+    if (!(path = resolve_path(manifest, name)))
+        return 0;
+    files[n - 1] = raw_reader_open(path);
+    free(path);
+    if (!files[n - 1])
+        return 0;
+    ends[n - 1] =
+      (n > 1 ? ends[n - 2] : 0) + raw_reader_frame_count(files[n - 1]);
+    target->nfiles = n;
+    return 1;
+}
+
+/// Ends the sequence at the first frame the files don't hold.
+static void
+clip_runs(struct RawStripes* self)
+{
+    for (size_t r = 0; r < self->nruns; ++r) {
+        struct RawStripeRun* run = self->runs + r;
+        const struct RawStripeTarget* target = self->targets + run->target;
+        const uint64_t held = target->nfiles ? target->ends[target->nfiles - 1]
+                                             : 0;
+        if (run->local + run->nframes > held) {
+            run->nframes = held > run->local ? held - run->local : 0;
+            self->nruns = run->nframes ? r + 1 : r;
+            self->count = run->first + run->nframes;
+            return;
+        }
+    }
+}
+
+struct RawStripes*
+raw_stripes_open(const char* path)
+{
+    struct RawStripes* self = 0;
+    FILE* fp = 0;
+    char line[4096];
+    if (!(self = malloc(sizeof(*self))))
+        goto Error;
+    memset(self, 0, sizeof(*self)); // NOLINT
+    if (!(fp = fopen(path, "rb")))
+        goto Error;
+    if (!fgets(line, sizeof(line), fp) ||
+        strcmp(line, "acquire raw stripes 1\n"))
+        goto Error;
+    while (fgets(line, sizeof(line), fp)) {
+        const size_t n = strlen(line);
+        unsigned t = 0;
+        unsigned long long nframes = 0;
+        int at = 0;
+        if (!n || line[n - 1] != '\n')
+            goto Error; // too long, or cut short
+        line[n - 1] = 0;
+        if (sscanf(line, "run %u %llu", &t, &nframes) == 2) {
+            if (!add_run(self, t, nframes))
+                goto Error;
+        } else if (sscanf(line, "file %u %n", &t, &at) == 1 && at > 0) {
+            if (!add_file(self, t, path, line + at))
+                goto Error;
+        } else {
+            goto Error;
+        }
+    }
+    fclose(fp);
+    clip_runs(self);
+    return self;
+Error:
+    if (fp)
+        fclose(fp);
+    raw_stripes_close(self);
+    return 0;
+}
+
+void
+raw_stripes_close(struct RawStripes* self)
+{
+    if (!self)
+        return;
+    for (unsigned t = 0; t < self->ntargets; ++t) {
+        for (unsigned k = 0; k < self->targets[t].nfiles; ++k)
+            raw_reader_close(self->targets[t].files[k]);
+        free(self->targets[t].files);
+        free(self->targets[t].ends);
+    }
+    free(self->targets);
+    free(self->runs);
+    free(self);
+}
+
+uint64_t
+raw_stripes_frame_count(const struct RawStripes* self)
+{
+    return self->count;
+}
+
+/// Finds the file that holds frame `i` and the frame's position in it.
+/// @returns 0 if `i` is out of range or the file isn't there.
+static int
+locate(const struct RawStripes* self,
+       uint64_t i,
+       const struct RawReader** file,
+       uint64_t* at)
+{
+    if (i >= self->count)
+        return 0;
+
+    // The last run that starts at or before `i`
+    size_t lo = 0, hi = self->nruns;
+    while (hi - lo > 1) {
+        const size_t mid = lo + (hi - lo) / 2;
+        if (self->runs[mid].first <= i)
+            lo = mid;
+        else
+            hi = mid;
+    }
+    const struct RawStripeRun* run = self->runs + lo;
+    const struct RawStripeTarget* target = self->targets + run->target;
+    const uint64_t local = run->local + (i - run->first);
+
+    // The first file that ends after `local`
+    unsigned k = 0, end = target->nfiles;
+    while (k < end) {
+        const unsigned mid = k + (end - k) / 2;
+        if (target->ends[mid] <= local)
+            k = mid + 1;
+        else
+            end = mid;
+    }
+    if (k == target->nfiles)
+        return 0;
+    *file = target->files[k];
+    *at = local - (k ? target->ends[k - 1] : 0);
+    return 1;
+}
+
+const struct VideoFrame*
+raw_stripes_frame(const struct RawStripes* self, uint64_t i)
+{
+    const struct RawReader* file = 0;
+    uint64_t at = 0;
+    return locate(self, i, &file, &at) ? raw_reader_frame(file, at) : 0;
+}
+
+const struct VideoFrame*
+raw_stripes_header(const struct RawStripes* self, uint64_t i)
+{
+    const struct RawReader* file = 0;
+    uint64_t at = 0;
+    return locate(self, i, &file, &at) ? raw_reader_header(file, at) : 0;
+}
+
+const void*
+raw_stripes_pixels(const struct RawStripes* self, uint64_t i)
+{
+    const struct RawReader* file = 0;
+    uint64_t at = 0;
+    return locate(self, i, &file, &at) ? raw_reader_pixels(file, at) : 0;
+}
+
+int
+raw_stripes_verify(const struct RawStripes* self, uint64_t i)
+{
+    const struct RawReader* file = 0;
+    uint64_t at = 0;
+    return locate(self, i, &file, &at) ? raw_reader_verify(file, at) : 0;
+}
+
+/// @returns the compression header of `frame`, or NULL if it isn't a
+///          consistent compressed frame.
+static const struct RawCompressedHeader*
+compressed_header(const struct VideoFrame* frame)
+{
+    const struct RawCompressedHeader* h =
+      (const struct RawCompressedHeader*)frame->data;
+    if (frame->bytes_of_frame < sizeof(*frame) + sizeof(*h) ||
+        memcmp(h->magic, RAW_COMPRESSED_MAGIC, 8) || !h->bytes_per_element ||
+        (h->shuffle != RawShuffle_Byte && h->shuffle != RawShuffle_Bit) ||
+        !h->bytes_per_block ||
+        h->bytes_of_payload >
+          frame->bytes_of_frame - sizeof(*frame) - sizeof(*h))
+        return 0;
+    const uint64_t nblocks =
+      (h->bytes_of_data + h->bytes_per_block - 1) / h->bytes_per_block;
+    return nblocks <= h->bytes_of_payload / sizeof(uint32_t) ? h : 0;
+}
+
+uint64_t
+raw_frame_decompressed_bytes(const struct VideoFrame* frame)
+{
+    const struct RawCompressedHeader* h = compressed_header(frame);
+    return h ? sizeof(*frame) + h->bytes_of_data : frame->bytes_of_frame;
+}
+
+int
+raw_frame_decompress(const struct VideoFrame* frame, void* dst, size_t nbytes)
+{
+    const struct RawCompressedHeader* h = compressed_header(frame);
+    uint8_t* scratch = 0;
+    if (!h) {
+        if (nbytes < frame->bytes_of_frame)
+            return 0;
+        memcpy(dst, frame, frame->bytes_of_frame); // NOLINT
+        return 1;
+    }
+    if (nbytes < sizeof(*frame) + h->bytes_of_data)
+        return 0;
+
+    struct VideoFrame* out = dst;
+    memcpy(out, frame, sizeof(*frame)); // NOLINT
+    out->bytes_of_frame = sizeof(*frame) + h->bytes_of_data;
+
+    const uint64_t nblocks =
+      (h->bytes_of_data + h->bytes_per_block - 1) / h->bytes_per_block;
+    const uint8_t* sizes = (const uint8_t*)(h + 1);
+    const uint8_t* const end = sizes + h->bytes_of_payload;
+    const uint8_t* block = sizes + nblocks * sizeof(uint32_t);
+    if (!(scratch = malloc(h->bytes_per_block)))
+        goto Error;
+    for (uint64_t b = 0; b < nblocks; ++b) {
+        const uint64_t at = b * h->bytes_per_block;
+        const uint64_t rest = h->bytes_of_data - at;
+        const size_t n =
+          (size_t)(rest < h->bytes_per_block ? rest : h->bytes_per_block);
+        uint32_t nsrc;
+        memcpy(&nsrc, sizes + b * sizeof(nsrc), sizeof(nsrc)); // NOLINT
+        if (nsrc > (uint64_t)(end - block) ||
+            !raw_codec_decompress_block(out->data + at,
+                                        n,
+                                        block,
+                                        nsrc,
+                                        h->bytes_per_element,
+                                        h->shuffle,
+                                        scratch))
+            goto Error;
+        block += nsrc;
+    }
+    free(scratch);
+    return 1;
+Error:
+    free(scratch);
+    return 0;
+}
@@ -2,11 +2,16 @@
 #include "device/kit/storage.h"
 #include "logger.h"
 #include "platform.h"
+#include "io.h"
+#include "crc32c.h"
+#include "../common/options.h"
+#include "../common/worker.pool.h"
 
 #include <cstddef>
 #include <exception>
 #include <stdexcept>
 #include <string>
+#include <vector>
 #include <algorithm>
 
 using namespace std;
@@ -47,14 +52,41 @@ struct Tiff final : public Storage
     string filename_;
     string external_metadata_;
     struct PixelScale pixel_scale_um_;
-    struct file file_;
+    struct IoFile* io_;
     uint64_t last_offset_, last_ifd_next_offset_;
     size_t frame_count_; // the number of frames written to the current file
+    bool checksumming_;  // add a CRC-32C of the pixels to each description
 
     // Context for constructing string storage during ifd assembly.
     // This acquires memory. Kept in object context to reuse that memory.
     StringSection ifd_strings_;
 
+    // An appended batch is gathered here and written with one
+    // io_file_writev(). The ifds, strings and padding are copied into
+    // `staged_`. The pixels stay where the caller put them.
+    struct Piece
+    {
+        const uint8_t* data; ///< the caller's, or null for `staged_ + at`
+        size_t at, nbytes;
+    };
+    vector<uint8_t> staged_;
+    vector<Piece> pieces_;
+    vector<IoSpan> spans_;
+    uint64_t batch_offset_, batch_end_;
+
+    // The CRC-32Cs of a batch's frames are computed in pieces on a pool of
+    // `ACQUIRE_TIFF_CRC32C_THREADS`, then combined into `crcs_`.
+    struct CrcPiece
+    {
+        const uint8_t* data;
+        size_t nbytes;
+        size_t frame; ///< in the batch
+        uint32_t crc;
+    };
+    struct WorkerPool* crc_pool_;
+    vector<CrcPiece> crc_pieces_;
+    vector<uint32_t> crcs_;
+
     Tiff() noexcept;
     ~Tiff() noexcept;
 
@@ -68,6 +100,9 @@ struct Tiff final : public Storage
 
   private:
     void terminate_ifd_list() noexcept;
+    void gather_(uint64_t offset, const void* buf, size_t nbytes, bool copy);
+    void write_batch_();
+    void checksum_batch_(const struct VideoFrame* frames, size_t nbytes);
 };
 
 #pragma pack(push, 1)
@@ -405,10 +440,14 @@ Tiff::Tiff() noexcept
     .reserve_image_shape = ::tiff_reserve_image_shape,
   }
   , pixel_scale_um_{.x=1.0,.y=1.0}
-  , file_{}
+  , io_(nullptr)
   , last_offset_(0)
   , last_ifd_next_offset_(0)
   , frame_count_(0)
+  , checksumming_(false)
+  , batch_offset_(0)
+  , batch_end_(0)
+  , crc_pool_(nullptr)
 {
 }
 
@@ -483,11 +522,37 @@ int
 Tiff::start() noexcept
 {
     frame_count_ = 0;
-    CHECK(file_create(&file_, filename_.c_str(), filename_.length()));
+    {
+        int64_t crc = 0, nthreads = 4;
+        options_get_int("ACQUIRE_TIFF_CRC32C", &crc);
+        options_get_int("ACQUIRE_TIFF_CRC32C_THREADS", &nthreads);
+        checksumming_ = crc != 0;
+        worker_pool_destroy(crc_pool_);
+        crc_pool_ = nullptr;
+        EXPECT(nthreads >= 1 && nthreads <= 256,
+               "ACQUIRE_TIFF_CRC32C_THREADS must be in [1,256]. Got: %d",
+               (int)nthreads);
+        // The appending thread works too, so it needs one fewer worker.
+        if (checksumming_ && nthreads > 1)
+            CHECK(crc_pool_ =
+                    worker_pool_create((unsigned)nthreads - 1, nullptr));
+        if (checksumming_ && !crc32c_is_accelerated())
+            LOG("TIFF: No crc instructions. CRC-32Cs will be slow to "
+                "compute.");
+    }
+    {
+        const IoFileOptions options{
+            .engine = io_engine_from_options("ACQUIRE_TIFF_IO"),
+        };
+        CHECK(io_ = io_file_create(
+                filename_.c_str(), filename_.length(), &options));
+    }
     {
         const auto hdr = header();
         write_(0, (void*)&hdr, sizeof(hdr));
+        CHECK(io_);
         last_offset_ = sizeof(hdr);
+        last_ifd_next_offset_ = offsetof(header_t, first_ifd);
     }
     LOG("TIFF: Streaming to \"%s\"", filename_.c_str());
     return 1;
@@ -499,20 +564,32 @@ void
 Tiff::terminate_ifd_list() noexcept
 {
     // zero out the last next offset.
+    // Not through write_(), which calls stop() when it fails.
     uint64_t data(0);
-    write_(last_ifd_next_offset_, &data, sizeof(data));
+    io_file_write(io_,
+                  last_ifd_next_offset_,
+                  (uint8_t*)&data,
+                  (uint8_t*)&data + sizeof(data));
 }
 
 int
 Tiff::stop() noexcept
 {
-    if (state == DeviceState_Running) {
-        terminate_ifd_list();
-        file_close(&file_);
-        state = DeviceState_Armed;
+    // Keyed on the open file rather than `state`, which isn't updated when
+    // this writer is driven by the side-by-side tiff.
+    if (io_) {
+        // The terminator overwrites part of the last ifd, which may still be
+        // in flight.
+        if (io_file_flush(io_))
+            terminate_ifd_list();
+        if (!io_file_close(io_))
+            LOGE("TIFF: Some frames could not be written.");
+        io_ = nullptr;
         frame_count_ = 0;
         LOG("TIFF: Writer stop");
     }
+    worker_pool_destroy(crc_pool_);
+    crc_pool_ = nullptr;
     return 1;
 }
 
@@ -536,7 +613,13 @@ Tiff::append(const struct VideoFrame* frames, size_t nbytes) noexcept
         return (o < nbytes) ? (const struct VideoFrame*)p : nullptr;
     };
     try {
-        for (cur = frames; cur; cur = next()) {
+        staged_.clear();
+        pieces_.clear();
+        batch_offset_ = batch_end_ = last_offset_;
+        if (checksumming_)
+            checksum_batch_(frames, nbytes);
+        size_t i = 0; // in the batch
+        for (cur = frames; cur; cur = next(), ++i) {
             using ifdN_t = ifd_t<16>;
             const auto bytes_of_image = cur->bytes_of_frame - sizeof(*cur);
 
@@ -545,6 +628,13 @@ Tiff::append(const struct VideoFrame* frames, size_t nbytes) noexcept
             const auto section_data = align8(section_ifd + sizeof(ifdN_t));
             const auto section_strings = align8(section_data + bytes_of_image);
 
+            char crc[32] = "";
+            if (checksumming_)
+                snprintf(crc,
+                         sizeof(crc),
+                         ",\"crc32c\":%u",
+                         (unsigned)crcs_[i]);
+
             // assemble ifd
             ifd_strings_.reset(section_strings);
             ifdN_t ifd{
@@ -575,34 +665,41 @@ Tiff::append(const struct VideoFrame* frames, size_t nbytes) noexcept
                         ifd_strings_,
                         "{\"frame_id\":%llu,\"hardware_frame_id\":%llu,"
                         "\"timestamps\":{"
-                        "\"runtime\":%llu,\"hardware\":%llu},\"metadata\":%s}",
+                        "\"runtime\":%llu,\"hardware\":%llu}%s,"
+                        "\"metadata\":%s}",
                         cur->frame_id,
                         cur->hardware_frame_id,
                         cur->timestamps.acq_thread,
                         cur->timestamps.hardware,
+                        crc,
                         external_metadata_.c_str())
                     : image_description(ifd_strings_,
                                         "{\"frame_id\":%llu,\"hardware_frame_"
                                         "id\":%llu,\"timestamps\":{"
-                                        "\"runtime\":%llu,\"hardware\":%llu}}",
+                                        "\"runtime\":%llu,\"hardware\":%llu}"
+                                        "%s}",
                                         cur->frame_id,
                                         cur->hardware_frame_id,
                                         cur->timestamps.acq_thread,
-                                        cur->timestamps.hardware),
+                                        cur->timestamps.hardware,
+                                        crc),
                 },
                 align8(ifd_strings_.offset)
             };
 
-            // write
-            write_(section_ifd, &ifd, sizeof(ifd));
-            write_(section_data, (void*)cur->data, bytes_of_image);
-            write_(section_strings, ifd_strings_.data, ifd_strings_.size);
+            // gather, padding up to the next ifd so frames are contiguous
+            gather_(section_ifd, &ifd, sizeof(ifd), true);
+            gather_(section_data, cur->data, bytes_of_image, false);
+            gather_(
+              section_strings, ifd_strings_.data, ifd_strings_.size, true);
+            gather_(ifd.next, nullptr, 0, true);
 
             // update markers
             last_ifd_next_offset_ = section_ifd + offsetof(ifdN_t, next);
             last_offset_ = ifd.next;
             ++frame_count_;
         }
+        write_batch_();
     } catch (const std::exception& e) {
         LOGE("Exception: %s", e.what());
         return 0;
@@ -613,10 +710,90 @@ Tiff::append(const struct VideoFrame* frames, size_t nbytes) noexcept
     return 1;
 }
 
+/// Computes the CRC-32C of each frame's pixels into `crcs_`. Frames are cut
+/// into pieces of at most `crc_piece_bytes`, which the pool works on while
+/// the appending thread waits, so a batch of one large frame is spread out
+/// too.
+void
+Tiff::checksum_batch_(const struct VideoFrame* frames, size_t nbytes)
+{
+    constexpr size_t crc_piece_bytes = 1 << 20;
+    crc_pieces_.clear();
+    crcs_.clear();
+    for (size_t at = 0, frame = 0; at < nbytes; ++frame) {
+        const auto* f = (const struct VideoFrame*)((const uint8_t*)frames + at);
+        const size_t n = f->bytes_of_frame - sizeof(*f);
+        // At least one piece per frame, so empty frames get a CRC too.
+        size_t i = 0;
+        do {
+            crc_pieces_.push_back(
+              { f->data + i, min(crc_piece_bytes, n - i), frame, 0 });
+            i += crc_piece_bytes;
+        } while (i < n);
+        at += f->bytes_of_frame;
+    }
+    worker_pool_parallel_for(
+      crc_pool_,
+      crc_pieces_.size(),
+      [](void* ctx, size_t i) {
+          auto& piece = ((Tiff*)ctx)->crc_pieces_[i];
+          piece.crc = crc32c(0, piece.data, piece.nbytes);
+      },
+      this);
+    for (const auto& piece : crc_pieces_) {
+        if (piece.frame == crcs_.size())
+            crcs_.push_back(piece.crc);
+        else
+            crcs_.back() =
+              crc32c_combine(crcs_.back(), piece.crc, piece.nbytes);
+    }
+}
+
+/// Adds `nbytes` at `offset` to the batch, zeros first if there's a gap.
+/// Consecutive copies go in one piece.
+void
+Tiff::gather_(uint64_t offset, const void* buf, size_t nbytes, bool copy)
+{
+    const auto add = [&](const uint8_t* data, size_t n, bool stage) {
+        if (!n)
+            return;
+        if (!stage)
+            pieces_.push_back({ data, 0, n });
+        else {
+            if (pieces_.empty() || pieces_.back().data)
+                pieces_.push_back({ nullptr, staged_.size(), 0 });
+            if (data)
+                staged_.insert(staged_.end(), data, data + n);
+            else
+                staged_.resize(staged_.size() + n, 0);
+            pieces_.back().nbytes += n;
+        }
+        batch_end_ += n;
+    };
+    add(nullptr, offset - batch_end_, true);
+    add((const uint8_t*)buf, nbytes, copy);
+}
+
+void
+Tiff::write_batch_()
+{
+    spans_.clear();
+    for (const auto& p : pieces_) {
+        const uint8_t* beg = p.data ? p.data : staged_.data() + p.at;
+        spans_.push_back({ beg, beg + p.nbytes });
+    }
+    CHECK(io_);
+    CHECK(io_file_writev(io_, batch_offset_, spans_.data(), spans_.size()));
+    return;
+Error:
+    stop();
+}
+
 void
 Tiff::write_(uint64_t offset, void* buf, size_t nbytes) noexcept
 {
-    CHECK(file_write(&file_, offset, (uint8_t*)buf, (uint8_t*)buf + nbytes));
+    CHECK(io_);
+    CHECK(io_file_write(io_, offset, (uint8_t*)buf, (uint8_t*)buf + nbytes));
     return;
 Error:
     stop();
@@ -699,3 +876,184 @@ tiff_init()
 {
     return new Tiff();
 }
+
+#ifndef NO_UNIT_TESTS
+#include "device/kit/driver.h"
+
+#include <cstdio>
+#include <cstdlib>
+
+namespace {
+int
+set_option(const char* name, const char* value)
+{
+#ifdef _WIN32
+    return _putenv_s(name, value) == 0;
+#else
+    return setenv(name, value, 1) == 0;
+#endif
+}
+
+int
+read_file(const char* path, vector<uint8_t>& out)
+{
+    FILE* fp = fopen(path, "rb");
+    if (!fp)
+        return 0;
+    fseek(fp, 0, SEEK_END);
+    out.resize((size_t)ftell(fp));
+    fseek(fp, 0, SEEK_SET);
+    const size_t n = fread(out.data(), 1, out.size(), fp);
+    fclose(fp);
+    return n == out.size();
+}
+
+uint64_t
+read_u64(const vector<uint8_t>& file, uint64_t offset)
+{
+    uint64_t v = 0;
+    if (offset + sizeof(v) <= file.size())
+        memcpy(&v, file.data() + offset, sizeof(v));
+    return v;
+}
+
+/// Frame `i` of the test is `width(i)` by `height(i)` u8 pixels.
+uint32_t
+width(uint64_t i)
+{
+    return 1 + (uint32_t)((i * 37) % 61);
+}
+
+uint32_t
+height(uint64_t i)
+{
+    return 1 + (uint32_t)((i * 13) % 7);
+}
+
+uint8_t
+pixel(uint64_t i, size_t k)
+{
+    return (uint8_t)(i * 7 + k * 3);
+}
+
+/// Walks the ifd chain of `file`, which should hold `nframes` test frames,
+/// and checks each frame's shape and pixels.
+int
+check_test_tiff(const vector<uint8_t>& file, uint64_t nframes)
+{
+    uint64_t offset = read_u64(file, offsetof(header_t, first_ifd));
+    uint64_t i = 0;
+    CHECK(file.size() >= sizeof(header_t));
+    CHECK(file[0] == 'I' && file[1] == 'I' && file[2] == 0x2b);
+    for (; offset; ++i) {
+        const uint64_t ntags = read_u64(file, offset);
+        const uint64_t end = offset + 8 + ntags * sizeof(tag_t) + 8;
+        uint64_t w = 0, h = 0, data = 0, nbytes = 0;
+        EXPECT(i < nframes, "More than %d ifds", (int)nframes);
+        EXPECT(offset % 8 == 0 && end <= file.size(),
+               "Bad ifd %d at %llu",
+               (int)i,
+               (unsigned long long)offset);
+        for (uint64_t t = 0; t < ntags; ++t) {
+            tag_t tag;
+            memcpy(
+              &tag, file.data() + offset + 8 + t * sizeof(tag), sizeof(tag));
+            switch (tag.tag) {
+                case 256:
+                    w = tag.value.u32;
+                    break;
+                case 257:
+                    h = tag.value.u32;
+                    break;
+                case 273:
+                    data = tag.value.u64;
+                    break;
+                case 279:
+                    nbytes = tag.value.u64;
+                    break;
+                default:;
+            }
+        }
+        EXPECT(w == width(i) && h == height(i), "Frame %d shape", (int)i);
+        CHECK(nbytes == w * h && data + nbytes <= file.size());
+        for (size_t k = 0; k < nbytes; ++k)
+            EXPECT(file[data + k] == pixel(i, k),
+                   "Frame %d: wrong pixel %d",
+                   (int)i,
+                   (int)k);
+        offset = read_u64(file, end - 8);
+    }
+    EXPECT(i == nframes, "Found %d of %d frames", (int)i, (int)nframes);
+    return 1;
+Error:
+    return 0;
+}
+} // end namespace ::{anonymous}
+
+/// Batches of 1 to 5 odd-sized frames, through each io engine, then a
+/// start and stop with no frames at all.
+extern "C" acquire_export int
+unit_test_tiff_batched_append()
+{
+    const char filename[] = "tiff-batch-test.tif";
+    const struct PixelScale pixel_scale_um = { 1, 1 };
+    const uint64_t nframes = 40;
+    struct StorageProperties props = {};
+    struct Storage* writer = 0;
+    vector<uint8_t> batch, file;
+    int ok = 0;
+    CHECK(storage_properties_init(
+      &props, 0, filename, sizeof(filename), 0, 0, pixel_scale_um));
+
+    for (int e = 0; e < IoEngineCount; ++e) {
+        CHECK(set_option("ACQUIRE_TIFF_IO",
+                         io_engine_to_string((enum IoEngine)e)));
+        CHECK(writer = tiff_init());
+        CHECK(writer->set(writer, &props) == DeviceState_Armed);
+        CHECK(writer->start(writer) == DeviceState_Running);
+        for (uint64_t i = 0; i < nframes;) {
+            size_t nbytes = 0;
+            batch.clear();
+            for (uint64_t end = i + 1 + i % 5; i < end && i < nframes; ++i) {
+                const size_t npx = (size_t)width(i) * height(i);
+                batch.resize(nbytes + sizeof(VideoFrame) + npx);
+                VideoFrame* f = (VideoFrame*)(batch.data() + nbytes);
+                *f = VideoFrame{ .bytes_of_frame = sizeof(*f) + npx };
+                f->shape.dims = { .channels = 1,
+                                  .width = width(i),
+                                  .height = height(i),
+                                  .planes = 1 };
+                f->shape.type = SampleType_u8;
+                f->frame_id = i;
+                for (size_t k = 0; k < npx; ++k)
+                    f->data[k] = pixel(i, k);
+                nbytes += f->bytes_of_frame;
+            }
+            CHECK(writer->append(writer, (VideoFrame*)batch.data(), &nbytes) ==
+                  DeviceState_Running);
+        }
+        CHECK(writer->stop(writer) == DeviceState_Armed);
+        CHECK(read_file(filename, file));
+        EXPECT(check_test_tiff(file, nframes),
+               "%s engine",
+               io_engine_to_string((enum IoEngine)e));
+
+        // No frames: the first ifd offset is the terminator.
+        CHECK(writer->start(writer) == DeviceState_Running);
+        CHECK(writer->stop(writer) == DeviceState_Armed);
+        CHECK(read_file(filename, file));
+        CHECK(file.size() == sizeof(header_t));
+        CHECK(check_test_tiff(file, 0));
+        writer->destroy(writer);
+        writer = 0;
+    }
+    ok = 1;
+Error:
+    if (writer)
+        writer->destroy(writer);
+    storage_properties_destroy(&props);
+    set_option("ACQUIRE_TIFF_IO", "");
+    remove(filename);
+    return ok;
+}
+#endif
@@ -0,0 +1,328 @@
+#include "write.queue.h"
+#include "platform.h"
+#include "logger.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define LOG(...) aq_logger(0, __FILE__, __LINE__, __FUNCTION__, __VA_ARGS__)
+#define LOGE(...) aq_logger(1, __FILE__, __LINE__, __FUNCTION__, __VA_ARGS__)
+#define EXPECT(e, ...)                                                         \
+    do {                                                                       \
+        if (!(e)) {                                                            \
+            LOGE(__VA_ARGS__);                                                 \
+            goto Error;                                                        \
+        }                                                                      \
+    } while (0)
+#define CHECK(e) EXPECT(e, "Expression evaluated as false:\n\t%s", #e)
+
+/// Largest write handed to the sink at once, so room is freed as the writer
+/// goes rather than only after a long write.
+#define MAX_WRITE_BYTES (8ULL << 20)
+
+/// Bytes are addressed by their position in the stream. Position `p` lives
+/// at `ring[p % capacity]`. [head,tail) is queued, [tail,head+capacity) is
+/// free. The producer copies into the free part without holding the lock
+/// and the writer reads the queued part without holding it, so only the
+/// positions are guarded.
+struct WriteQueue
+{
+    struct lock lock;
+    struct condition_variable data_ready;  ///< tail moved or shutdown
+    struct condition_variable space_ready; ///< head moved or the sink failed
+    struct thread thread;
+
+    uint8_t* ring;
+    size_t capacity;
+    enum WriteQueueBackpressure backpressure;
+    write_queue_sink_t sink;
+    void* ctx;
+    uint64_t first_offset;
+
+    uint64_t head, tail;
+    int is_running;
+    int has_thread;
+    int failed;
+
+    struct WriteQueueStats stats;
+    double depth_sum;
+};
+
+static void
+writer_thread(struct WriteQueue* self)
+{
+    lock_acquire(&self->lock);
+    while (!self->failed) {
+        if (self->head == self->tail) {
+            if (!self->is_running)
+                break;
+            condition_variable_wait(&self->data_ready, &self->lock);
+            continue;
+        }
+        const size_t at = (size_t)(self->head % self->capacity);
+        size_t n = (size_t)(self->tail - self->head);
+        if (n > self->capacity - at)
+            n = self->capacity - at; // up to the end of the ring
+        if (n > MAX_WRITE_BYTES)
+            n = MAX_WRITE_BYTES;
+        const uint64_t offset = self->first_offset + self->head;
+        lock_release(&self->lock);
+
+        struct clock clock;
+        clock_init(&clock);
+        const int ok =
+          self->sink(self->ctx, offset, self->ring + at, self->ring + at + n);
+        const double ms = clock_toc_ms(&clock);
+
+        lock_acquire(&self->lock);
+        self->stats.writes += 1;
+        self->stats.write_ms += ms;
+        if (ms > self->stats.max_write_ms)
+            self->stats.max_write_ms = ms;
+        if (ok) {
+            self->head += n;
+            self->stats.bytes_written += n;
+        } else {
+            LOGE("Write of %llu bytes at offset %llu failed.",
+                 (unsigned long long)n,
+                 (unsigned long long)offset);
+            self->failed = 1;
+        }
+        condition_variable_notify_all(&self->space_ready);
+    }
+    lock_release(&self->lock);
+}
+
+struct WriteQueue*
+write_queue_create(size_t capacity,
+                   enum WriteQueueBackpressure backpressure,
+                   write_queue_sink_t sink,
+                   void* ctx,
+                   uint64_t first_offset)
+{
+    struct WriteQueue* self = 0;
+    CHECK(capacity > 0);
+    CHECK(sink);
+    CHECK(self = malloc(sizeof(*self)));
+    memset(self, 0, sizeof(*self)); // NOLINT
+    lock_init(&self->lock);
+    condition_variable_init(&self->data_ready);
+    condition_variable_init(&self->space_ready);
+    thread_init(&self->thread);
+    EXPECT(self->ring = malloc(capacity),
+           "Failed to allocate a write queue of %llu bytes.",
+           (unsigned long long)capacity);
+    self->capacity = capacity;
+    self->backpressure = backpressure;
+    self->sink = sink;
+    self->ctx = ctx;
+    self->first_offset = first_offset;
+    self->is_running = 1;
+    CHECK(thread_create(&self->thread, (void (*)(void*))writer_thread, self));
+    self->has_thread = 1;
+    return self;
+Error:
+    write_queue_destroy(self, 0);
+    return 0;
+}
+
+int
+write_queue_push(struct WriteQueue* self,
+                 const uint8_t* beg,
+                 const uint8_t* end,
+                 int* dropped)
+{
+    const struct WriteQueueSpan span = { .beg = beg, .end = end };
+    return write_queue_pushv(self, &span, 1, dropped);
+}
+
+int
+write_queue_pushv(struct WriteQueue* self,
+                  const struct WriteQueueSpan* spans,
+                  size_t nspans,
+                  int* dropped)
+{
+    size_t total = 0;
+    int ok = 0;
+    for (size_t i = 0; i < nspans; ++i)
+        total += (size_t)(spans[i].end - spans[i].beg);
+    if (dropped)
+        *dropped = 0;
+    lock_acquire(&self->lock);
+    CHECK(!self->failed);
+
+    {
+        const size_t depth = (size_t)(self->tail - self->head);
+        self->stats.pushes += 1;
+        self->depth_sum += (double)depth;
+        if (depth > self->stats.max_depth)
+            self->stats.max_depth = depth;
+        if (self->backpressure == WriteQueue_Drop && total <= self->capacity &&
+            self->capacity - depth < total) {
+            self->stats.dropped += 1;
+            if (dropped)
+                *dropped = 1;
+            ok = 1;
+            goto Done;
+        }
+    }
+
+    for (size_t i = 0; i < nspans; ++i) {
+        const uint8_t* beg = spans[i].beg;
+        size_t remaining = (size_t)(spans[i].end - beg);
+        while (remaining) {
+            if (self->tail - self->head == self->capacity) {
+                struct clock clock;
+                clock_init(&clock);
+                while (self->tail - self->head == self->capacity &&
+                       !self->failed)
+                    condition_variable_wait(&self->space_ready, &self->lock);
+                const double ms = clock_toc_ms(&clock);
+                self->stats.stall_ms += ms;
+                if (ms > self->stats.max_stall_ms)
+                    self->stats.max_stall_ms = ms;
+                CHECK(!self->failed);
+            }
+
+            const size_t at = (size_t)(self->tail % self->capacity);
+            size_t n = self->capacity - (size_t)(self->tail - self->head);
+            if (n > self->capacity - at)
+                n = self->capacity - at; // up to the end of the ring
+            if (n > remaining)
+                n = remaining;
+            lock_release(&self->lock);
+            memcpy(self->ring + at, beg, n); // NOLINT
+            lock_acquire(&self->lock);
+
+            self->tail += n;
+            beg += n;
+            remaining -= n;
+            condition_variable_notify_all(&self->data_ready);
+        }
+    }
+    ok = 1;
+Done:
+Error:
+    lock_release(&self->lock);
+    return ok;
+}
+
+int
+write_queue_destroy(struct WriteQueue* self, struct WriteQueueStats* stats)
+{
+    if (!self)
+        return 1;
+    lock_acquire(&self->lock);
+    self->is_running = 0;
+    condition_variable_notify_all(&self->data_ready);
+    lock_release(&self->lock);
+    if (self->has_thread)
+        thread_join(&self->thread);
+
+    const int ok = !self->failed;
+    if (stats) {
+        *stats = self->stats;
+        stats->mean_depth =
+          self->stats.pushes ? self->depth_sum / (double)self->stats.pushes : 0;
+    }
+    lock_deinit(&self->lock);
+    free(self->ring);
+    free(self);
+    return ok;
+}
+
+#ifndef NO_UNIT_TESTS
+#include "device/kit/driver.h"
+
+struct test_sink
+{
+    uint8_t out[1 << 16];
+    uint64_t next_offset; ///< writes must arrive in order
+    int fail_after;       ///< fail once this many writes succeeded, if > 0
+    int nwrites;
+};
+
+static int
+test_sink_write(void* ctx,
+                uint64_t offset,
+                const uint8_t* beg,
+                const uint8_t* end)
+{
+    struct test_sink* sink = ctx;
+    if (offset != sink->next_offset ||
+        offset + (uint64_t)(end - beg) > sizeof(sink->out))
+        return 0;
+    if (sink->fail_after > 0 && sink->nwrites == sink->fail_after)
+        return 0;
+    memcpy(sink->out + offset, beg, end - beg); // NOLINT
+    sink->next_offset += end - beg;
+    sink->nwrites += 1;
+    return 1;
+}
+
+acquire_export int
+unit_test_write_queue()
+{
+    static struct test_sink sink;
+    uint8_t in[1 << 15];
+    struct WriteQueue* q = 0;
+    struct WriteQueueStats stats = { 0 };
+    for (size_t i = 0; i < sizeof(in); ++i)
+        in[i] = (uint8_t)(i * 7 + 1);
+
+    // Pushes of every size up to, and beyond, a small ring arrive in order.
+    memset(&sink, 0, sizeof(sink)); // NOLINT
+    CHECK(q = write_queue_create(
+            97, WriteQueue_Block, test_sink_write, &sink, 0));
+    size_t pushed = 0;
+    for (size_t n = 1; pushed + n <= sizeof(in); n += 13) {
+        CHECK(write_queue_push(q, in + pushed, in + pushed + n, 0));
+        pushed += n;
+    }
+    CHECK(write_queue_destroy(q, &stats));
+    q = 0;
+    CHECK(stats.bytes_written == pushed);
+    CHECK(stats.dropped == 0);
+    CHECK(stats.max_depth <= 97);
+    CHECK(memcmp(sink.out, in, pushed) == 0);
+
+    // Dropped pushes don't take up offsets. Spans are dropped together.
+    memset(&sink, 0, sizeof(sink)); // NOLINT
+    CHECK(q = write_queue_create(
+            64, WriteQueue_Drop, test_sink_write, &sink, 0));
+    uint64_t ndropped = 0;
+    const struct WriteQueueSpan spans[] = { { in, in + 24 },
+                                            { in + 24, in + 40 },
+                                            { in + 40, in + 48 } };
+    for (int i = 0; i < 100; ++i) {
+        int dropped = 0;
+        if (i % 2)
+            CHECK(write_queue_pushv(q, spans, 3, &dropped));
+        else
+            CHECK(write_queue_push(q, in, in + 48, &dropped));
+        ndropped += dropped;
+    }
+    CHECK(write_queue_destroy(q, &stats));
+    q = 0;
+    CHECK(stats.pushes == 100);
+    CHECK(stats.dropped == ndropped);
+    CHECK(stats.bytes_written == 48 * (stats.pushes - stats.dropped));
+    for (uint64_t i = 0; i < stats.bytes_written; i += 48)
+        CHECK(memcmp(sink.out + i, in, 48) == 0);
+
+    // A failing sink fails the pushes that follow and the flush.
+    memset(&sink, 0, sizeof(sink)); // NOLINT
+    sink.fail_after = 2;
+    CHECK(q = write_queue_create(
+            16, WriteQueue_Block, test_sink_write, &sink, 0));
+    int ok = 1;
+    for (int i = 0; i < 100 && ok; ++i)
+        ok = write_queue_push(q, in, in + 16, 0);
+    CHECK(!ok);
+    CHECK(!write_queue_destroy(q, 0));
+    return 1;
+Error:
+    write_queue_destroy(q, 0);
+    return 0;
+}
+#endif
@@ -0,0 +1,92 @@
+#ifndef H_ACQUIRE_DRIVER_BASICS_WRITE_QUEUE_V0
+#define H_ACQUIRE_DRIVER_BASICS_WRITE_QUEUE_V0
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    /// What `write_queue_push()` does when the queue doesn't have room.
+    enum WriteQueueBackpressure
+    {
+        /// Wait for the writer to make room.
+        WriteQueue_Block,
+        /// Drop the whole push. Pushes larger than the queue still wait.
+        WriteQueue_Drop,
+    };
+
+    /// Writes `[beg,end)` at `offset` of the output.
+    /// @returns 1 on success, 0 on failure.
+    typedef int (*write_queue_sink_t)(void* ctx,
+                                      uint64_t offset,
+                                      const uint8_t* beg,
+                                      const uint8_t* end);
+
+    struct WriteQueueStats
+    {
+        uint64_t pushes;
+        uint64_t dropped;       ///< pushes dropped for lack of room
+        uint64_t bytes_written; ///< bytes the sink accepted
+        size_t max_depth;       ///< most bytes queued when a push arrived
+        double mean_depth;      ///< mean bytes queued when a push arrived
+        double stall_ms;        ///< total time pushes waited for room
+        double max_stall_ms;
+        uint64_t writes;      ///< calls to the sink
+        double write_ms;      ///< total time spent in the sink
+        double max_write_ms;
+    };
+
+    /// A bounded write-behind buffer for a sequential byte stream.
+    ///
+    /// Pushed bytes are copied into a ring of `capacity` bytes and written by
+    /// a dedicated thread, so the caller only waits when the ring is full.
+    /// Bytes are handed to the sink in order, at consecutive offsets starting
+    /// at `first_offset`. Dropped pushes don't take up offsets.
+    ///
+    /// Pushes must come from one thread at a time.
+    struct WriteQueue;
+
+    /// @returns NULL on failure.
+    struct WriteQueue* write_queue_create(
+      size_t capacity,
+      enum WriteQueueBackpressure backpressure,
+      write_queue_sink_t sink,
+      void* ctx,
+      uint64_t first_offset);
+
+    /// Queues `[beg,end)`. The bytes may be reused once this returns.
+    /// If `dropped` isn't NULL it's set to whether the push was dropped.
+    /// Dropped pushes don't take up offsets.
+    /// @returns 0 if the sink has failed, after which nothing more is
+    ///          written, otherwise 1, including when the push was dropped.
+    int write_queue_push(struct WriteQueue* self,
+                         const uint8_t* beg,
+                         const uint8_t* end,
+                         int* dropped);
+
+    struct WriteQueueSpan
+    {
+        const uint8_t *beg, *end;
+    };
+
+    /// Queues the `nspans` spans one after the other, as one push: they're
+    /// all queued or all dropped.
+    int write_queue_pushv(struct WriteQueue* self,
+                          const struct WriteQueueSpan* spans,
+                          size_t nspans,
+                          int* dropped);
+
+    /// Writes what's queued, stops the writer and frees the queue. Writes
+    /// the statistics to `stats` if it isn't NULL. Accepts NULL.
+    /// @returns 0 if the sink failed at any point, otherwise 1.
+    int write_queue_destroy(struct WriteQueue* self,
+                            struct WriteQueueStats* stats);
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif // H_ACQUIRE_DRIVER_BASICS_WRITE_QUEUE_V0
@@ -0,0 +1,248 @@
+/// Checks the frames in raw files, stripe manifests and tiffs written by this
+/// driver against the CRC-32Cs recorded for them, see `ACQUIRE_RAW_CRC32C`
+/// and `ACQUIRE_TIFF_CRC32C`.
+///
+///     acquire-verify <file>...
+///
+/// Prints each frame that fails and a summary per file. Exits with 0 if
+/// every file could be read and every recorded CRC matched.
+
+#include "../storage/raw.index.h"
+#include "../storage/crc32c.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+struct counts
+{
+    uint64_t frames, checked, bad;
+};
+
+static void
+report(const char* path, const struct counts* c)
+{
+    printf("%s: %llu frames, %llu checked, %llu bad\n",
+           path,
+           (unsigned long long)c->frames,
+           (unsigned long long)c->checked,
+           (unsigned long long)c->bad);
+}
+
+static int
+verify_raw(const char* path, struct counts* c)
+{
+    struct RawReader* reader = raw_reader_open(path);
+    if (!reader) {
+        fprintf(stderr, "%s: could not open\n", path);
+        return 0;
+    }
+    c->frames = raw_reader_frame_count(reader);
+    for (uint64_t i = 0; i < c->frames; ++i) {
+        const int v = raw_reader_verify(reader, i);
+        c->checked += v >= 0;
+        if (!v) {
+            ++c->bad;
+            printf("%s: frame %llu failed\n", path, (unsigned long long)i);
+        }
+    }
+    raw_reader_close(reader);
+    return 1;
+}
+
+static int
+verify_stripes(const char* path, struct counts* c)
+{
+    struct RawStripes* stripes = raw_stripes_open(path);
+    if (!stripes) {
+        fprintf(stderr, "%s: could not open the stripes\n", path);
+        return 0;
+    }
+    c->frames = raw_stripes_frame_count(stripes);
+    for (uint64_t i = 0; i < c->frames; ++i) {
+        const int v = raw_stripes_verify(stripes, i);
+        c->checked += v >= 0;
+        if (!v) {
+            ++c->bad;
+            printf("%s: frame %llu failed\n", path, (unsigned long long)i);
+        }
+    }
+    raw_stripes_close(stripes);
+    return 1;
+}
+
+/// A tag of the BigTIFFs tiff.cpp writes.
+#pragma pack(push, 1)
+struct tiff_tag
+{
+    uint16_t tag, type;
+    uint64_t count;
+    uint64_t value;
+};
+#pragma pack(pop)
+
+static int
+seek(FILE* file, uint64_t offset)
+{
+#ifdef _WIN32
+    return _fseeki64(file, (int64_t)offset, SEEK_SET) == 0;
+#else
+    return fseeko(file, (off_t)offset, SEEK_SET) == 0;
+#endif
+}
+
+static int
+read_at(FILE* file, uint64_t offset, void* buf, size_t nbytes)
+{
+    return seek(file, offset) && fread(buf, 1, nbytes, file) == nbytes;
+}
+
+/// Computes the CRC of `nbytes` at `offset`, reading through `buf`.
+static int
+crc_at(FILE* file,
+       uint64_t offset,
+       uint64_t nbytes,
+       uint8_t* buf,
+       size_t capacity,
+       uint32_t* crc)
+{
+    *crc = 0;
+    if (!seek(file, offset))
+        return 0;
+    while (nbytes) {
+        const size_t n = nbytes < capacity ? (size_t)nbytes : capacity;
+        if (fread(buf, 1, n, file) != n)
+            return 0;
+        *crc = crc32c(*crc, buf, n);
+        nbytes -= n;
+    }
+    return 1;
+}
+
+/// Walks the image file directories. Each frame's pixels are one strip, and
+/// its image description is json that may hold "crc32c". The directories
+/// must come in file order, as tiff.cpp writes them.
+static int
+verify_tiff(const char* path, FILE* file, struct counts* c)
+{
+    const size_t capacity = 1 << 20;
+    uint8_t* buf = malloc(capacity);
+    char* description = 0;
+    uint64_t offset = 0;
+    int ok = 0;
+    if (!buf || !read_at(file, 8, &offset, sizeof(offset)))
+        goto Error;
+    while (offset) {
+        const uint64_t i = c->frames;
+        uint64_t ntags = 0, strip = 0, nbytes = 0;
+        struct tiff_tag tag;
+        const char* crc = 0;
+        if (!read_at(file, offset, &ntags, sizeof(ntags)) || ntags > 4096)
+            goto Error;
+        for (uint64_t t = 0; t < ntags; ++t) {
+            if (!read_at(file,
+                         offset + sizeof(ntags) + t * sizeof(tag),
+                         &tag,
+                         sizeof(tag)))
+                goto Error;
+            if (tag.tag == 273)
+                strip = tag.value;
+            else if (tag.tag == 279)
+                nbytes = tag.value;
+            else if (tag.tag == 270 && tag.count > 8 && tag.count < capacity) {
+                free(description);
+                if (!(description = malloc(tag.count)) ||
+                    !read_at(file, tag.value, description, tag.count))
+                    goto Error;
+                description[tag.count - 1] = '\0';
+                crc = strstr(description, "\"crc32c\":");
+            }
+        }
+        uint64_t next = 0;
+        if (!read_at(file,
+                     offset + sizeof(ntags) + ntags * sizeof(tag),
+                     &next,
+                     sizeof(next)))
+            goto Error;
+        // tiff.cpp writes each directory after the one before. Holding the
+        // chain to that also stops a corrupt one from going round in circles.
+        if (next && next <= offset) {
+            fprintf(stderr,
+                    "%s: the directory after frame %llu goes backwards\n",
+                    path,
+                    (unsigned long long)i);
+            goto Error;
+        }
+        offset = next;
+        ++c->frames;
+        if (!crc)
+            continue;
+        uint32_t actual = 0;
+        const uint32_t expected =
+          (uint32_t)strtoul(crc + sizeof("\"crc32c\":") - 1, 0, 10);
+        ++c->checked;
+        if (!crc_at(file, strip, nbytes, buf, capacity, &actual) ||
+            actual != expected) {
+            ++c->bad;
+            printf("%s: frame %llu failed\n", path, (unsigned long long)i);
+        }
+    }
+    ok = 1;
+Error:
+    if (!ok)
+        fprintf(stderr,
+                "%s: could not read frame %llu\n",
+                path,
+                (unsigned long long)c->frames);
+    free(buf);
+    free(description);
+    return ok;
+}
+
+static int
+verify(const char* path, struct counts* c)
+{
+    static const char stripes[] = "acquire raw stripes";
+    static const uint8_t bigtiff[] = { 'I', 'I', 0x2b, 0 };
+    char head[sizeof(stripes) - 1] = { 0 };
+    FILE* file = fopen(path, "rb");
+    if (!file) {
+        fprintf(stderr, "%s: could not open\n", path);
+        return 0;
+    }
+    const size_t n = fread(head, 1, sizeof(head), file);
+    int ok;
+    if (n >= sizeof(bigtiff) && !memcmp(head, bigtiff, sizeof(bigtiff)))
+        ok = verify_tiff(path, file, c);
+    else if (n == sizeof(head) && !memcmp(head, stripes, sizeof(head)))
+        ok = verify_stripes(path, c);
+    else
+        ok = verify_raw(path, c);
+    fclose(file);
+    return ok;
+}
+
+int
+main(int argc, char* argv[])
+{
+    int ok = 1;
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s <file>...\n", argv[0]);
+        return 2;
+    }
+    if (!crc32c_is_accelerated())
+        fprintf(stderr, "No crc instructions. This will be slow.\n");
+    for (int i = 1; i < argc; ++i) {
+        struct counts c = { 0 };
+        if (!verify(argv[i], &c)) {
+            ok = 0;
+            continue;
+        }
+        report(argv[i], &c);
+        if (c.bad)
+            ok = 0;
+        else if (!c.checked)
+            printf("%s: no CRCs to check\n", argv[i]);
+    }
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,214 @@
+/// Measures how much a large frame copy slows down an unrelated thread that
+/// works on a cache-resident data set, with `memcpy` and with the streaming
+/// copy used for frame delivery.
+///
+/// The "consumer" chases pointers through a random cycle of cache lines that
+/// fits in the last-level cache. It reports the mean time per access and, on
+/// Linux when perf events are available, its own last-level cache misses.
+/// The "producer" copies frames back to back.
+///
+/// Usage: frame-copy-cache-pollution [frame MiB] [working set KiB] [seconds]
+
+#include "frame.copy.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <numeric>
+#include <random>
+#include <thread>
+#include <vector>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+/// Counts last-level cache misses of the calling thread.
+struct MissCounter
+{
+    int fd = -1;
+
+    MissCounter()
+    {
+#ifdef __linux__
+        perf_event_attr attr{};
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.size = sizeof(attr);
+        attr.config = PERF_COUNT_HW_CACHE_MISSES;
+        attr.disabled = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        fd = (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+        if (fd >= 0) {
+            ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+            ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+        }
+#endif
+    }
+
+    ~MissCounter()
+    {
+#ifdef __linux__
+        if (fd >= 0)
+            close(fd);
+#endif
+    }
+
+    /// @returns the count so far, or -1 if unavailable.
+    int64_t read() const
+    {
+#ifdef __linux__
+        int64_t v = 0;
+        if (fd >= 0 && ::read(fd, &v, sizeof(v)) == sizeof(v))
+            return v;
+#endif
+        return -1;
+    }
+};
+
+struct Line
+{
+    Line* next;
+    char pad[64 - sizeof(Line*)];
+};
+
+struct ConsumerResult
+{
+    double ns_per_access;
+    double misses_per_access; // negative if unavailable
+};
+
+ConsumerResult
+consume(std::vector<Line>& lines, const std::atomic<bool>& stop)
+{
+    MissCounter counter;
+    const int64_t m0 = counter.read();
+    const auto t0 = Clock::now();
+    uint64_t n = 0;
+    Line* p = &lines[0];
+    while (!stop.load(std::memory_order_relaxed)) {
+        for (int i = 0; i < 4096; ++i)
+            p = p->next;
+        n += 4096;
+    }
+    const double ns =
+      (double)std::chrono::duration_cast<std::chrono::nanoseconds>(
+        Clock::now() - t0)
+        .count();
+    const int64_t m1 = counter.read();
+    // Keep the chase from being optimized away.
+    if (p == nullptr)
+        std::puts("");
+    return { ns / (double)n,
+             (m0 < 0 || m1 < 0) ? -1.0 : (double)(m1 - m0) / (double)n };
+}
+
+struct Run
+{
+    const char* name;
+    ConsumerResult consumer;
+    double copy_gib_per_s; // 0 when nothing was copied
+};
+
+Run
+run(const char* name,
+    void (*copy)(void*, const void*, size_t),
+    std::vector<Line>& lines,
+    std::vector<uint8_t>& src,
+    std::vector<uint8_t>& dst,
+    double seconds)
+{
+    std::atomic<bool> stop{ false };
+    ConsumerResult consumer{};
+    std::thread t([&] { consumer = consume(lines, stop); });
+
+    uint64_t copied = 0;
+    const auto t0 = Clock::now();
+    const auto deadline =
+      t0 + std::chrono::duration_cast<Clock::duration>(
+             std::chrono::duration<double>(seconds));
+    while (Clock::now() < deadline) {
+        if (copy) {
+            copy(dst.data(), src.data(), src.size());
+            copied += src.size();
+        } else {
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+    }
+    const double elapsed =
+      std::chrono::duration<double>(Clock::now() - t0).count();
+    stop = true;
+    t.join();
+    return { name, consumer, (double)copied / elapsed / (1ULL << 30) };
+}
+
+void
+copy_memcpy(void* dst, const void* src, size_t n)
+{
+    memcpy(dst, src, n);
+}
+
+} // end namespace ::{anonymous}
+
+int
+main(int argc, char* argv[])
+{
+    const size_t frame_bytes =
+      (size_t)(argc > 1 ? atof(argv[1]) : 256.0) * (1ULL << 20);
+    const size_t working_set =
+      (size_t)(argc > 2 ? atof(argv[2]) : 4096.0) * (1ULL << 10);
+    const double seconds = argc > 3 ? atof(argv[3]) : 3.0;
+
+    // A random cycle through the working set's cache lines.
+    std::vector<Line> lines(std::max<size_t>(working_set / sizeof(Line), 2));
+    {
+        std::vector<size_t> order(lines.size());
+        std::iota(order.begin(), order.end(), 0);
+        std::shuffle(order.begin() + 1, order.end(), std::mt19937_64(1234));
+        for (size_t i = 0; i < order.size(); ++i)
+            lines[order[i]].next = &lines[order[(i + 1) % order.size()]];
+    }
+
+    std::vector<uint8_t> src(frame_bytes, 1), dst(frame_bytes, 0);
+
+    const Run runs[] = {
+        run("idle", nullptr, lines, src, dst, seconds),
+        run("memcpy", copy_memcpy, lines, src, dst, seconds),
+        run("streaming", frame_copy_streaming, lines, src, dst, seconds),
+    };
+
+    printf("frame: %.0f MiB, consumer working set: %.0f KiB, %.1f s per run\n",
+           frame_bytes / (double)(1ULL << 20),
+           working_set / (double)(1ULL << 10),
+           seconds);
+    printf("%-10s %12s %16s %18s\n",
+           "copy",
+           "copy GiB/s",
+           "consumer ns/op",
+           "consumer miss/op");
+    for (const auto& r : runs) {
+        char misses[32] = "n/a";
+        if (r.consumer.misses_per_access >= 0)
+            snprintf(misses,
+                     sizeof(misses),
+                     "%.4f",
+                     r.consumer.misses_per_access);
+        printf("%-10s %12.2f %16.2f %18s\n",
+               r.name,
+               r.copy_gib_per_s,
+               r.consumer.ns_per_access,
+               misses);
+    }
+    return 0;
+}
@@ -0,0 +1,334 @@
+/// Throughput of the simulated camera kernels and of the frame copy in
+/// `get_frame()`, over a sweep of frame sizes. Kernels are measured for every
+/// instruction set that was built and that the cpu supports, e.g. to compare
+/// the AVX2 and AVX-512 builds.
+///
+/// Each measurement runs one kernel back to back on one frame for at least
+/// the given time. Binning works in place, so its input is restored before
+/// each call, outside the timed region. GB/s counts the bytes of the frame
+/// the kernel produces (fills) or consumes (binning, copy). Cycles are
+/// time-stamp counter cycles, where there is one.
+///
+/// Usage: simcam-kernels [--json <file>] [--max-side <pixels>]
+///                       [--seconds <per measurement>]
+
+#include "frame.copy.h"
+#include "kernels.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <x86intrin.h>
+#endif
+#define HAVE_TSC 1
+#endif
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+uint64_t
+cycles()
+{
+#ifdef HAVE_TSC
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
+
+size_t
+bytes_of(SampleType type)
+{
+    return type == SampleType_f32                                ? 4
+           : (type == SampleType_u16 || type == SampleType_i16) ? 2
+                                                                 : 1;
+}
+
+const char*
+type_name(SampleType type)
+{
+    switch (type) {
+        case SampleType_u8:
+            return "u8";
+        case SampleType_i8:
+            return "i8";
+        case SampleType_u16:
+            return "u16";
+        case SampleType_i16:
+            return "i16";
+        case SampleType_f32:
+            return "f32";
+        default:
+            return "?";
+    }
+}
+
+ImageShape
+make_shape(uint32_t w, uint32_t h, SampleType type)
+{
+    ImageShape shape{};
+    shape.dims = { 1, w, h, 1 };
+    shape.strides = { 1, 1, w, (int64_t)w * h };
+    shape.type = type;
+    return shape;
+}
+
+enum class Kernel
+{
+    fill_random,
+    fill_pattern,
+    bin,
+    frame_copy,
+};
+
+const char*
+kernel_name(Kernel k)
+{
+    switch (k) {
+        case Kernel::fill_random:
+            return "fill_random";
+        case Kernel::fill_pattern:
+            return "fill_pattern";
+        case Kernel::bin:
+            return "bin";
+        case Kernel::frame_copy:
+            return "frame_copy";
+    }
+    return "?";
+}
+
+struct Case
+{
+    Kernel kernel;
+    SampleType type;
+    int factor; // binning only
+};
+
+struct Result
+{
+    Case c;
+    const char* isa; // "-" for the frame copy, which isn't a kernel
+    uint32_t side;
+    double gb_per_s;
+    double cycles_per_pixel; // 0 without a time-stamp counter
+};
+
+struct Buffers
+{
+    uint8_t* buf;
+    uint8_t* input;
+};
+
+Result
+measure(const SimcamKernels* k,
+        const char* isa,
+        const Case& c,
+        uint32_t side,
+        const Buffers& b,
+        double seconds)
+{
+    const ImageShape shape = make_shape(side, side, c.type);
+    const size_t npx = (size_t)side * side;
+    const size_t nbytes = bytes_of(c.type) * npx;
+    double busy = 0;
+    uint64_t ncycles = 0, calls = 0;
+    const auto deadline =
+      Clock::now() + std::chrono::duration_cast<Clock::duration>(
+                       std::chrono::duration<double>(seconds));
+    while (calls < 3 || Clock::now() < deadline) {
+        if (c.kernel == Kernel::bin)
+            memcpy(b.buf, b.input, nbytes);
+        const auto t0 = Clock::now();
+        const uint64_t c0 = cycles();
+        switch (c.kernel) {
+            case Kernel::fill_random:
+                k->fill_random(&shape, calls, b.buf);
+                break;
+            case Kernel::fill_pattern:
+                k->fill_pattern[c.type](&shape,
+                                        side / 2.0f,
+                                        side / 2.0f,
+                                        (float)calls * 1e-3f,
+                                        b.buf);
+                break;
+            case Kernel::bin:
+                k->bin[c.type](b.buf, (int)side, (int)side, c.factor);
+                break;
+            case Kernel::frame_copy:
+                frame_copy(b.buf, b.input, nbytes);
+                break;
+        }
+        ncycles += cycles() - c0;
+        busy += std::chrono::duration<double>(Clock::now() - t0).count();
+        ++calls;
+    }
+    return { c,
+             isa,
+             side,
+             (double)(calls * nbytes) / busy * 1e-9,
+             (double)ncycles / (double)(calls * npx) };
+}
+
+void
+write_json(FILE* f, const std::vector<Result>& results)
+{
+    fprintf(f, "{\n  \"benchmark\": \"simcam-kernels\",\n");
+#ifdef HAVE_TSC
+    fprintf(f, "  \"cycles\": \"tsc\",\n");
+#else
+    fprintf(f, "  \"cycles\": null,\n");
+#endif
+    fprintf(f, "  \"results\": [");
+    for (size_t i = 0; i < results.size(); ++i) {
+        const Result& r = results[i];
+        fprintf(f,
+                "%s\n    {\"kernel\": \"%s\", \"type\": \"%s\", "
+                "\"factor\": %d, \"isa\": \"%s\", \"width\": %u, "
+                "\"height\": %u, \"gb_per_s\": %.4f, ",
+                i ? "," : "",
+                kernel_name(r.c.kernel),
+                type_name(r.c.type),
+                r.c.factor,
+                r.isa,
+                r.side,
+                r.side,
+                r.gb_per_s);
+#ifdef HAVE_TSC
+        fprintf(f, "\"cycles_per_pixel\": %.4f}", r.cycles_per_pixel);
+#else
+        fprintf(f, "\"cycles_per_pixel\": null}");
+#endif
+    }
+    fprintf(f, "\n  ]\n}\n");
+}
+
+} // end namespace ::{anonymous}
+
+int
+main(int argc, char* argv[])
+{
+    const char* json = nullptr;
+    uint32_t max_side = 8192;
+    double seconds = 0.2;
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg = argv[i];
+        if (arg == "--json" && i + 1 < argc) {
+            json = argv[++i];
+        } else if (arg == "--max-side" && i + 1 < argc) {
+            max_side = (uint32_t)atoi(argv[++i]);
+        } else if (arg == "--seconds" && i + 1 < argc) {
+            seconds = atof(argv[++i]);
+        } else {
+            fprintf(stderr,
+                    "Usage: %s [--json <file>] [--max-side <pixels>] "
+                    "[--seconds <per measurement>]\n",
+                    argv[0]);
+            return 1;
+        }
+    }
+
+    // Square frames.
+    std::vector<uint32_t> sides;
+    for (uint32_t s = 64; s <= max_side; s *= 4)
+        sides.push_back(s);
+    if (!sides.empty() && sides.back() != max_side && max_side % 128 == 0)
+        sides.push_back(max_side);
+
+    std::vector<Case> cases = {
+        { Kernel::fill_random, SampleType_u8, 0 },
+    };
+    for (SampleType t : { SampleType_u8,
+                          SampleType_i8,
+                          SampleType_u16,
+                          SampleType_i16,
+                          SampleType_f32 })
+        cases.push_back({ Kernel::fill_pattern, t, 0 });
+    cases.push_back({ Kernel::bin, SampleType_u8, 2 });
+    cases.push_back({ Kernel::bin, SampleType_u8, 4 });
+    cases.push_back({ Kernel::bin, SampleType_u16, 2 });
+    cases.push_back({ Kernel::bin, SampleType_f32, 4 });
+    cases.push_back({ Kernel::frame_copy, SampleType_u8, 0 });
+
+    // 64-byte aligned, as the binning kernels need 32.
+    const size_t nbytes = sides.empty() ? 0 : (size_t)4 * max_side * max_side;
+    std::vector<uint8_t> storage(2 * nbytes + 64);
+    uint8_t* const buf =
+      (uint8_t*)(((uintptr_t)storage.data() + 63) & ~(uintptr_t)63);
+    const Buffers buffers = { buf, buf + nbytes };
+    for (size_t i = 0; i < nbytes; ++i)
+        buffers.input[i] = (uint8_t)(i * 2654435761u >> 24);
+
+    printf("%.2f s per measurement. GB/s of frame data; %s per pixel.\n",
+           seconds,
+#ifdef HAVE_TSC
+           "tsc cycles"
+#else
+           "cycles n/a"
+#endif
+    );
+    printf("%-13s %-4s %6s %-7s %6s %9s %9s\n",
+           "kernel",
+           "type",
+           "factor",
+           "isa",
+           "side",
+           "GB/s",
+           "cyc/px");
+
+    std::vector<Result> results;
+    for (const auto& c : cases) {
+        for (uint32_t side : sides) {
+            // The u8 binning kernels need a width that's a multiple of
+            // 32 * factor.
+            if (c.kernel == Kernel::bin && side % (32 * c.factor))
+                continue;
+            for (int isa = 0; isa < SimdIsaCount; ++isa) {
+                const SimcamKernels* k = simcam_kernels_for((SimdIsa)isa);
+                if (!k)
+                    continue;
+                const bool is_copy = c.kernel == Kernel::frame_copy;
+                const Result r =
+                  measure(k,
+                          is_copy ? "-" : simd_isa_to_string((SimdIsa)isa),
+                          c,
+                          side,
+                          buffers,
+                          seconds);
+                results.push_back(r);
+                printf("%-13s %-4s %6d %-7s %6u %9.2f %9.2f\n",
+                       kernel_name(c.kernel),
+                       type_name(c.type),
+                       c.factor,
+                       r.isa,
+                       side,
+                       r.gb_per_s,
+                       r.cycles_per_pixel);
+                fflush(stdout);
+                if (is_copy)
+                    break; // the same for every instruction set
+            }
+        }
+    }
+
+    if (json) {
+        FILE* f = fopen(json, "w");
+        if (!f) {
+            fprintf(stderr, "Could not open %s\n", json);
+            return 1;
+        }
+        write_json(f, results);
+        fclose(f);
+    }
+    return 0;
+}
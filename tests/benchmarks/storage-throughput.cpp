@@ -0,0 +1,496 @@
+/// Throughput of the storage devices, measured through the driver.
+///
+/// Loads the driver, opens each storage device by name and appends batches
+/// of synthetic frames to it for a fixed time, the way the runtime does.
+/// Reports bytes per second and a histogram of the time spent in each
+/// `append()`. Output goes to the given directory, e.g. to compare a tmpfs
+/// with an NVMe drive. Each run writes into a new subdirectory of it, which
+/// is removed afterwards with everything the device wrote (indexes, rolled
+/// over files, ...) unless `--keep` is given.
+///
+/// Usage: storage-throughput [--dir <path>]
+///                           [--storage <name>[:<VAR>=<value>,...]]...
+///                           [--width <px>] [--height <px>] [--type <type>]
+///                           [--batch <frames per append>] [--seconds <s>]
+///                           [--keep]
+///
+/// Storage names are the driver's: raw, tiff, tiff-json and trash. A name may
+/// be followed by tuning variables to set while that device runs, e.g.
+/// `--storage raw --storage raw:ACQUIRE_RAW_DIRECT=1` compares buffered and
+/// direct writes. Types are u8, i8, u16, i16 and f32.
+
+#include "device/hal/driver.h"
+#include "device/kit/driver.h"
+#include "device/kit/storage.h"
+#include "device/props/storage.h"
+#include "logger.h"
+#include "platform.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <random>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+
+#define containerof(P, T, F) ((T*)(((char*)(P)) - offsetof(T, F)))
+
+namespace fs = std::filesystem;
+
+void
+reporter(int is_error,
+         const char* file,
+         int line,
+         const char* function,
+         const char* msg)
+{
+    // Devices log their own statistics, e.g. raw's write queue.
+    fprintf(is_error ? stderr : stdout,
+            "%s%s(%d) - %s: %s\n",
+            is_error ? "ERROR " : "",
+            file,
+            line,
+            function,
+            msg);
+}
+
+typedef struct Driver* (*init_func_t)(void (*reporter)(int is_error,
+                                                       const char* file,
+                                                       int line,
+                                                       const char* function,
+                                                       const char* msg));
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+struct Options
+{
+    std::string dir = ".";
+    std::vector<std::string> storages;
+    uint32_t width = 2048, height = 2048;
+    SampleType type = SampleType_u16;
+    int batch = 4;
+    double seconds = 5.0;
+    bool keep = false;
+};
+
+bool
+parse_type(const char* name, SampleType* type)
+{
+    const struct
+    {
+        const char* name;
+        SampleType type;
+    } types[] = {
+        { "u8", SampleType_u8 },   { "i8", SampleType_i8 },
+        { "u16", SampleType_u16 }, { "i16", SampleType_i16 },
+        { "f32", SampleType_f32 },
+    };
+    for (const auto& t : types) {
+        if (!strcmp(name, t.name)) {
+            *type = t.type;
+            return true;
+        }
+    }
+    return false;
+}
+
+size_t
+bytes_of(SampleType type)
+{
+    return type == SampleType_f32                                ? 4
+           : (type == SampleType_u16 || type == SampleType_i16) ? 2
+                                                                 : 1;
+}
+
+/// Append latencies in power of two buckets of microseconds: bucket `i`
+/// counts appends that took [2^(i-1), 2^i) us, bucket 0 those under 1 us.
+struct Histogram
+{
+    static constexpr int nbuckets = 32;
+    uint64_t counts[nbuckets] = {};
+    std::vector<double> samples_us;
+
+    void add(double us)
+    {
+        int i = us < 1 ? 0 : 1 + (int)std::log2(us);
+        counts[std::min(i, nbuckets - 1)] += 1;
+        samples_us.push_back(us);
+    }
+
+    double quantile(double q)
+    {
+        if (samples_us.empty())
+            return 0;
+        std::sort(samples_us.begin(), samples_us.end());
+        const size_t i = (size_t)(q * (double)(samples_us.size() - 1) + 0.5);
+        return samples_us[std::min(i, samples_us.size() - 1)];
+    }
+
+    void print()
+    {
+        for (int i = 0; i < nbuckets; ++i) {
+            if (!counts[i])
+                continue;
+            printf("    %10.0f - %-10.0f us %10llu\n",
+                   i ? std::ldexp(1.0, i - 1) : 0.0,
+                   std::ldexp(1.0, i),
+                   (unsigned long long)counts[i]);
+        }
+    }
+};
+
+/// `batch` contiguous frames, each padded to 8 bytes as the runtime does.
+struct Batch
+{
+    std::vector<uint64_t> storage; // 8-byte aligned
+    size_t bytes_of_frame;
+    size_t nbytes;
+    int nframes;
+
+    Batch(const Options& opts)
+      : nframes(opts.batch)
+    {
+        const size_t bytes_of_image =
+          bytes_of(opts.type) * opts.width * opts.height;
+        bytes_of_frame = (sizeof(VideoFrame) + bytes_of_image + 7) & ~7ULL;
+        nbytes = bytes_of_frame * nframes;
+        storage.resize(nbytes / 8);
+
+        for (int i = 0; i < nframes; ++i) {
+            auto* frame = at(i);
+            frame->bytes_of_frame = bytes_of_frame;
+            frame->shape = shape(opts);
+            // Not constant, so compressing file systems see real data.
+            uint8_t* data = (uint8_t*)frame->data;
+            for (size_t j = 0; j < bytes_of_image; ++j)
+                data[j] = (uint8_t)((j + i) * 2654435761u >> 24);
+        }
+    }
+
+    static ImageShape shape(const Options& opts)
+    {
+        ImageShape s{};
+        s.dims = { 1, opts.width, opts.height, 1 };
+        s.strides = { 1, 1, opts.width, (int64_t)opts.width * opts.height };
+        s.type = opts.type;
+        return s;
+    }
+
+    VideoFrame* at(int i)
+    {
+        return (VideoFrame*)((uint8_t*)storage.data() + i * bytes_of_frame);
+    }
+
+    void stamp(uint64_t first_frame_id)
+    {
+        for (int i = 0; i < nframes; ++i) {
+            at(i)->frame_id = first_frame_id + i;
+            at(i)->hardware_frame_id = first_frame_id + i;
+        }
+    }
+};
+
+/// A device to run and the tuning variables to set while it runs, parsed
+/// from "<name>[:<VAR>=<value>[,<VAR>=<value>]...]".
+struct Run
+{
+    std::string spec, name;
+    std::vector<std::pair<std::string, std::string>> env;
+
+    explicit Run(const std::string& spec)
+      : spec(spec)
+      , name(spec.substr(0, spec.find(':')))
+    {
+        size_t at = spec.find(':');
+        while (at != std::string::npos) {
+            const size_t next = spec.find(',', at + 1);
+            const std::string kv = spec.substr(at + 1, next - at - 1);
+            const size_t eq = kv.find('=');
+            if (eq != std::string::npos)
+                env.emplace_back(kv.substr(0, eq), kv.substr(eq + 1));
+            at = next;
+        }
+    }
+};
+
+/// Empty values read as unset, see src/common/options.h.
+void
+set_env(const std::string& name, const std::string& value)
+{
+#ifdef _WIN32
+    _putenv_s(name.c_str(), value.c_str());
+#else
+    setenv(name.c_str(), value.c_str(), 1);
+#endif
+}
+
+/// @returns the index of the device named `name`, or -1.
+int
+find_storage(struct Driver* driver, const std::string& name)
+{
+    const auto n = driver->device_count(driver);
+    for (uint32_t i = 0; i < n; ++i) {
+        DeviceIdentifier id{};
+        if (driver->describe(driver, &id, i) == Device_Ok &&
+            id.kind == DeviceKind_Storage && name == id.name)
+            return (int)i;
+    }
+    return -1;
+}
+
+/// @returns the name of the device's output file, `base` plus the usual
+///          extension.
+std::string
+output_name(const std::string& storage, const std::string& base)
+{
+    if (storage == "raw")
+        return base + ".raw";
+    if (storage == "tiff")
+        return base + ".tif";
+    return base + "." + storage;
+}
+
+/// Makes a new directory in `dir` for the files of one run. Its name is
+/// random, so runs of separate processes sharing stripe directories don't
+/// pick the same one.
+/// @returns its path, or an empty path on failure.
+fs::path
+make_run_dir(const std::string& dir)
+{
+    std::random_device random;
+    std::error_code ec;
+    for (int i = 0; i < 100; ++i) {
+        char name[64];
+        snprintf(name, sizeof(name), "storage-throughput.%08x", random());
+        const fs::path p = fs::path(dir) / name;
+        if (fs::create_directory(p, ec))
+            return p;
+        if (ec)
+            break;
+    }
+    fprintf(stderr, "Couldn't make a directory in \"%s\"\n", dir.c_str());
+    return {};
+}
+
+/// Striped raw files go to the directories listed in `stripes` (see
+/// `ACQUIRE_RAW_STRIPES`) rather than the run's, named after the device's
+/// output file.
+/// @returns the files there whose name is `base` followed by a dot.
+std::set<fs::path>
+list_stripe_files(const std::string& stripes, const std::string& base)
+{
+    std::set<fs::path> out;
+    for (size_t at = 0; at < stripes.size();) {
+        size_t end = stripes.find(';', at);
+        if (end == std::string::npos)
+            end = stripes.size();
+        std::error_code ec;
+        for (auto it = fs::directory_iterator(stripes.substr(at, end - at), ec);
+             !ec && it != fs::directory_iterator();
+             it.increment(ec))
+            if (it->path().filename().string().rfind(base + ".", 0) == 0)
+                out.insert(it->path());
+        at = end + 1;
+    }
+    return out;
+}
+
+/// @returns false if the device couldn't be set up or failed an append.
+bool
+run(struct Driver* driver, const Run& spec, const Options& opts)
+{
+    const std::string& name = spec.name;
+    const int idx = find_storage(driver, name);
+    if (idx < 0) {
+        fprintf(stderr, "No storage device named \"%s\"\n", name.c_str());
+        return false;
+    }
+
+    struct Device* device = nullptr;
+    if (driver_open_device(driver, idx, &device) != Device_Ok)
+        return false;
+    auto* storage = containerof(device, struct Storage, device);
+
+    const fs::path dir = make_run_dir(opts.dir);
+    if (dir.empty()) {
+        driver_close_device(device);
+        return false;
+    }
+    // The run directory's name is unique, so it also names the files this
+    // run writes into the stripe directories.
+    const std::string base = dir.filename().string();
+    const std::string path = (dir / output_name(name, base)).string();
+    StorageProperties props{};
+    const char metadata[] = "{}";
+    bool ok = storage_properties_init(&props,
+                                      0,
+                                      path.c_str(),
+                                      path.size() + 1,
+                                      metadata,
+                                      sizeof(metadata),
+                                      { 1, 1 });
+    Batch batch(opts);
+    Histogram latency;
+    uint64_t appended = 0, nappends = 0;
+    double elapsed = 0;
+
+    std::vector<std::pair<std::string, std::string>> saved;
+    for (const auto& [k, v] : spec.env) {
+        const char* old = getenv(k.c_str());
+        saved.emplace_back(k, old ? old : "");
+        set_env(k, v);
+    }
+    const char* stripes = getenv("ACQUIRE_RAW_STRIPES");
+    const std::string stripe_dirs = stripes ? stripes : "";
+    const std::set<fs::path> existing = list_stripe_files(stripe_dirs, base);
+    const ImageShape shape = Batch::shape(opts);
+    ok = ok && storage->set(storage, &props) == DeviceState_Armed;
+    if (ok)
+        storage->reserve_image_shape(storage, &shape);
+    ok = ok && storage->start(storage) == DeviceState_Running;
+    if (ok) {
+        const auto t0 = Clock::now();
+        const auto deadline =
+          t0 + std::chrono::duration_cast<Clock::duration>(
+                 std::chrono::duration<double>(opts.seconds));
+        while (ok && Clock::now() < deadline) {
+            batch.stamp(nappends * batch.nframes);
+            size_t nbytes = batch.nbytes;
+            const auto a = Clock::now();
+            ok = storage->append(storage, batch.at(0), &nbytes) ==
+                   DeviceState_Running &&
+                 nbytes == batch.nbytes;
+            latency.add(
+              std::chrono::duration<double, std::micro>(Clock::now() - a)
+                .count());
+            appended += nbytes;
+            ++nappends;
+        }
+        // Anything the device buffers is flushed by stop(), so it counts.
+        storage->stop(storage);
+        elapsed = std::chrono::duration<double>(Clock::now() - t0).count();
+    }
+    std::vector<fs::path> striped;
+    for (const auto& p : list_stripe_files(stripe_dirs, base))
+        if (!existing.count(p))
+            striped.push_back(p);
+    for (const auto& [k, v] : saved)
+        set_env(k, v);
+    storage_properties_destroy(&props);
+    driver_close_device(device);
+    if (opts.keep) {
+        printf("Kept the output of %s in \"%s\"\n",
+               spec.spec.c_str(),
+               dir.string().c_str());
+        for (const auto& p : striped)
+            printf("  and \"%s\"\n", p.string().c_str());
+    } else {
+        std::error_code ec;
+        fs::remove_all(dir, ec);
+        for (const auto& p : striped)
+            fs::remove(p, ec);
+    }
+
+    printf("%s: %llu appends of %d frames, %.1f MiB in %.2f s, %.1f MiB/s%s\n",
+           spec.spec.c_str(),
+           (unsigned long long)nappends,
+           batch.nframes,
+           (double)appended / (1 << 20),
+           elapsed,
+           elapsed > 0 ? (double)appended / (1 << 20) / elapsed : 0.0,
+           ok ? "" : " (failed)");
+    printf("  append latency p50 %.1f us, p99 %.1f us, p99.9 %.1f us, "
+           "max %.1f us\n",
+           latency.quantile(0.5),
+           latency.quantile(0.99),
+           latency.quantile(0.999),
+           latency.quantile(1.0));
+    latency.print();
+    return ok;
+}
+
+void
+usage(const char* argv0)
+{
+    fprintf(stderr,
+            "Usage: %s [--dir <path>] "
+            "[--storage <name>[:<VAR>=<value>,...]]... [--width <px>] "
+            "[--height <px>] [--type u8|i8|u16|i16|f32] "
+            "[--batch <frames per append>] [--seconds <s>] [--keep]\n",
+            argv0);
+}
+
+} // end namespace ::{anonymous}
+
+int
+main(int argc, char* argv[])
+{
+    Options opts;
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg = argv[i];
+        const bool has_value = i + 1 < argc;
+        if (arg == "--dir" && has_value) {
+            opts.dir = argv[++i];
+        } else if (arg == "--storage" && has_value) {
+            opts.storages.push_back(argv[++i]);
+        } else if (arg == "--width" && has_value) {
+            opts.width = (uint32_t)atoi(argv[++i]);
+        } else if (arg == "--height" && has_value) {
+            opts.height = (uint32_t)atoi(argv[++i]);
+        } else if (arg == "--type" && has_value &&
+                   parse_type(argv[i + 1], &opts.type)) {
+            ++i;
+        } else if (arg == "--batch" && has_value) {
+            opts.batch = std::max(1, atoi(argv[++i]));
+        } else if (arg == "--seconds" && has_value) {
+            opts.seconds = atof(argv[++i]);
+        } else if (arg == "--keep") {
+            opts.keep = true;
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (opts.storages.empty())
+        opts.storages = {
+            "raw", "raw:ACQUIRE_RAW_DIRECT=1", "tiff", "tiff-json", "trash"
+        };
+
+    printf("%u x %u, %zu bytes per pixel, %d frames per append, into %s\n",
+           opts.width,
+           opts.height,
+           bytes_of(opts.type),
+           opts.batch,
+           opts.dir.c_str());
+
+    logger_set_reporter(reporter);
+    int ecode = 0;
+    lib lib{};
+    if (!lib_open_by_name(&lib, "acquire-driver-common")) {
+        fprintf(stderr, "Could not load acquire-driver-common\n");
+        return 1;
+    }
+    {
+        auto init = (init_func_t)lib_load(&lib, "acquire_driver_init_v0");
+        struct Driver* driver = init ? init(reporter) : nullptr;
+        if (!driver) {
+            ecode = 1;
+        } else {
+            for (const auto& spec : opts.storages)
+                if (!run(driver, Run(spec), opts))
+                    ecode = 1;
+            driver->shutdown(driver);
+        }
+    }
+    lib_close(&lib);
+    return ecode;
+}
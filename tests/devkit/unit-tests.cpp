@@ -52,6 +52,24 @@ main()
     const std::vector<testcase> tests{
 #define CASE(e) { .name = #e, .test = (int (*)())lib_load(&lib, #e) }
         CASE(unit_test_basic_device_kind_to_string_is_complete),
+        CASE(unit_test_thread_placement_parse_cpus),
+        CASE(unit_test_sensor_noise_statistics),
+        CASE(unit_test_frame_copy_streaming),
+        CASE(unit_test_im_reverse),
+        CASE(unit_test_worker_pool),
+        CASE(unit_test_simd_kernels_agree),
+        CASE(unit_test_sprite_scene_incremental),
+        CASE(unit_test_simcam_lazy_matches_eager),
+        CASE(unit_test_write_queue),
+        CASE(unit_test_io_engines_agree),
+        CASE(unit_test_raw_index),
+        CASE(unit_test_raw_stripes),
+        CASE(unit_test_raw_codec),
+        CASE(unit_test_raw_compress),
+        CASE(unit_test_raw_crc32c),
+        CASE(unit_test_crc32c),
+        CASE(unit_test_raw_split),
+        CASE(unit_test_tiff_batched_append),
 #undef CASE
     };
 
@@ -0,0 +1,243 @@
+/// @file
+/// @brief Check that acquire-verify passes raw and tiff files written with
+/// CRC-32Cs, and fails them once a byte of pixels changes or the tiff's
+/// directories loop.
+///
+/// Takes the path to acquire-verify.
+
+#include "platform.h"
+#include "logger.h"
+#include "device/kit/driver.h"
+#include "device/kit/storage.h"
+#include "device/hal/driver.h"
+#include "device/props/storage.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#ifndef _WIN32
+#include <sys/wait.h>
+#endif
+
+#define containerof(P, T, F) ((T*)(((char*)(P)) - offsetof(T, F)))
+
+#define L aq_logger
+#define LOG(...) L(0, __FILE__, __LINE__, __FUNCTION__, __VA_ARGS__)
+#define LOGE(...) L(1, __FILE__, __LINE__, __FUNCTION__, __VA_ARGS__)
+#define EXPECT(e, ...)                                                         \
+    do {                                                                       \
+        if (!(e)) {                                                            \
+            LOGE(__VA_ARGS__);                                                 \
+            goto Error;                                                        \
+        }                                                                      \
+    } while (0)
+#define CHECK(e) EXPECT(e, "Expression evaluated as false:\n\t%s", #e)
+
+void
+reporter(int is_error,
+         const char* file,
+         int line,
+         const char* function,
+         const char* msg)
+{
+    fprintf(is_error ? stderr : stdout,
+            "%s%s(%d) - %s: %s\n",
+            is_error ? "ERROR " : "",
+            file,
+            line,
+            function,
+            msg);
+}
+
+typedef struct Driver* (*init_func_t)(void (*reporter)(int is_error,
+                                                       const char* file,
+                                                       int line,
+                                                       const char* function,
+                                                       const char* msg));
+
+// Every pixel of frame `i` is `pixel_value(i)`, so a frame's pixels can be
+// found in the file.
+const uint32_t width = 64, height = 64, nframes = 8;
+
+static uint8_t
+pixel_value(uint32_t i)
+{
+    return (uint8_t)(0x40 + i);
+}
+
+static bool
+set_option(const char* name, const char* value)
+{
+#ifdef _WIN32
+    return _putenv_s(name, value) == 0;
+#else
+    return setenv(name, value, 1) == 0;
+#endif
+}
+
+static bool
+read_file(const char* path, std::vector<uint8_t>& out)
+{
+    FILE* file = fopen(path, "rb");
+    if (!file)
+        return false;
+    out.clear();
+    uint8_t buf[4096];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), file)))
+        out.insert(out.end(), buf, buf + n);
+    fclose(file);
+    return true;
+}
+
+static bool
+write_file(const char* path, const std::vector<uint8_t>& data)
+{
+    FILE* file = fopen(path, "wb");
+    if (!file)
+        return false;
+    const bool ok = fwrite(data.data(), 1, data.size(), file) == data.size();
+    return fclose(file) == 0 && ok;
+}
+
+/// Writes `nframes` frames to `filename` with the storage device named
+/// `name`.
+static bool
+write_frames(struct Driver* driver, const char* name, const char* filename)
+{
+    const struct PixelScale pixel_scale_um = { 1, 1 };
+    struct StorageProperties props = {};
+    struct Device* device = nullptr;
+    struct Storage* storage = nullptr;
+    std::vector<uint8_t> buf(sizeof(VideoFrame) + width * height);
+    VideoFrame* frame = (VideoFrame*)buf.data();
+    const auto n = driver->device_count(driver);
+    uint32_t i = 0;
+    bool ok = false;
+    for (; i < n; ++i) {
+        DeviceIdentifier id{};
+        CHECK(driver->describe(driver, &id, i) == Device_Ok);
+        if (id.kind == DeviceKind_Storage && !strcmp(id.name, name))
+            break;
+    }
+    EXPECT(i < n, "No storage device named %s", name);
+    CHECK(Device_Ok == driver_open_device(driver, i, &device));
+    storage = containerof(device, struct Storage, device);
+    CHECK(storage_properties_init(
+      &props, 0, filename, strlen(filename) + 1, 0, 0, pixel_scale_um));
+    CHECK(storage->set(storage, &props) == DeviceState_Armed);
+    CHECK(storage->start(storage) == DeviceState_Running);
+    for (uint32_t k = 0; k < nframes; ++k) {
+        size_t nbytes = buf.size();
+        *frame = VideoFrame{ .bytes_of_frame = nbytes };
+        frame->shape.dims = {
+            .channels = 1, .width = width, .height = height, .planes = 1
+        };
+        frame->shape.type = SampleType_u8;
+        frame->frame_id = k;
+        memset(frame->data, pixel_value(k), width * height); // NOLINT
+        CHECK(storage->append(storage, frame, &nbytes) ==
+              DeviceState_Running);
+    }
+    CHECK(storage->stop(storage) == DeviceState_Armed);
+    ok = true;
+Error:
+    storage_properties_destroy(&props);
+    if (device)
+        driver_close_device(device);
+    return ok;
+}
+
+/// @returns acquire-verify's exit code for `path`.
+static int
+run_verify(const std::string& tool, const char* path)
+{
+    const std::string command = "\"" + tool + "\" " + path;
+    LOG("%s", command.c_str());
+    const int status = std::system(command.c_str());
+#ifdef _WIN32
+    return status;
+#else
+    return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+#endif
+}
+
+/// Changes one byte in the middle of frame 3's pixels.
+static bool
+flip_pixel(const char* path)
+{
+    std::vector<uint8_t> data;
+    if (!read_file(path, data))
+        return false;
+    const auto px = std::search_n(
+      data.begin(), data.end(), width * height, pixel_value(3));
+    if (px == data.end())
+        return false;
+    px[width * height / 2] ^= 1;
+    return write_file(path, data);
+}
+
+/// Points the tiff's first directory back at itself.
+static bool
+loop_directories(const char* path)
+{
+    std::vector<uint8_t> data;
+    uint64_t first = 0, ntags = 0;
+    if (!read_file(path, data) || data.size() < 16)
+        return false;
+    memcpy(&first, data.data() + 8, sizeof(first)); // NOLINT
+    if (first + sizeof(ntags) > data.size())
+        return false;
+    memcpy(&ntags, data.data() + first, sizeof(ntags)); // NOLINT
+    const uint64_t next = first + sizeof(ntags) + 20 * ntags;
+    if (next + sizeof(first) > data.size())
+        return false;
+    memcpy(data.data() + next, &first, sizeof(first)); // NOLINT
+    return write_file(path, data);
+}
+
+int
+main(int argc, char* argv[])
+{
+    logger_set_reporter(reporter);
+    lib lib{};
+    struct Driver* driver = nullptr;
+    const char raw[] = "verify-files-test.raw";
+    const char tiff[] = "verify-files-test.tif";
+    EXPECT(argc == 2, "Usage: %s <path to acquire-verify>", argv[0]);
+    CHECK(set_option("ACQUIRE_RAW_CRC32C", "1"));
+    CHECK(set_option("ACQUIRE_TIFF_CRC32C", "1"));
+    CHECK(lib_open_by_name(&lib, "acquire-driver-common"));
+    CHECK(driver = ((init_func_t)lib_load(&lib, "acquire_driver_init_v0"))(
+            reporter));
+
+    CHECK(write_frames(driver, "raw", raw));
+    CHECK(write_frames(driver, "tiff", tiff));
+    CHECK(run_verify(argv[1], raw) == 0);
+    CHECK(run_verify(argv[1], tiff) == 0);
+    CHECK(flip_pixel(raw));
+    CHECK(flip_pixel(tiff));
+    CHECK(run_verify(argv[1], raw) == 1);
+    CHECK(run_verify(argv[1], tiff) == 1);
+
+    // Good pixels, but the directories go round in circles.
+    CHECK(write_frames(driver, "tiff", tiff));
+    CHECK(loop_directories(tiff));
+    CHECK(run_verify(argv[1], tiff) == 1);
+
+    lib_close(&lib);
+    remove(raw);
+    remove("verify-files-test.raw.idx");
+    remove(tiff);
+    return 0;
+Error:
+    lib_close(&lib);
+    remove(raw);
+    remove("verify-files-test.raw.idx");
+    remove(tiff);
+    return 1;
+}
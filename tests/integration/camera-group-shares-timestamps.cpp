@@ -0,0 +1,171 @@
+//! Test: Simulated cameras started in group mode produce frames on a common
+//! clock, so frames with the same hardware frame id carry the same hardware
+//! timestamp. Ids count the group's ticks, not each camera's frames, so this
+//! holds however far apart the cameras start.
+
+#include "acquire.h"
+#include "device/hal/device.manager.h"
+#include "device/props/components.h"
+#include "device/props/device.h"
+#include "logger.h"
+#include "platform.h"
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <stdexcept>
+
+void
+reporter(int is_error,
+         const char* file,
+         int line,
+         const char* function,
+         const char* msg)
+{
+    fprintf(is_error ? stderr : stdout,
+            "%s%s(%d) - %s: %s\n",
+            is_error ? "ERROR " : "",
+            file,
+            line,
+            function,
+            msg);
+}
+
+/// Helper for passing size static strings as function args.
+/// For a function: `f(char*,size_t)` use `f(SIZED("hello"))`.
+/// Expands to `f("hello",5)`.
+#define SIZED(str) str, sizeof(str)
+
+#define L (aq_logger)
+#define LOG(...) L(0, __FILE__, __LINE__, __FUNCTION__, __VA_ARGS__)
+#define ERR(...) L(1, __FILE__, __LINE__, __FUNCTION__, __VA_ARGS__)
+#define EXPECT(e, ...)                                                         \
+    do {                                                                       \
+        if (!(e)) {                                                            \
+            char buf[1 << 8] = { 0 };                                          \
+            ERR(__VA_ARGS__);                                                  \
+            snprintf(buf, sizeof(buf) - 1, __VA_ARGS__);                       \
+            throw std::runtime_error(buf);                                     \
+        }                                                                      \
+    } while (0)
+#define CHECK(e) EXPECT(e, "Expression evaluated as false: %s", #e)
+#define DEVOK(e) CHECK(Device_Ok == (e))
+#define OK(e) CHECK(AcquireStatus_Ok == (e))
+
+static void
+enable_camera_group()
+{
+#ifdef _WIN32
+    CHECK(0 == _putenv_s("ACQUIRE_SIMCAM_GROUP", "1"));
+#else
+    CHECK(0 == setenv("ACQUIRE_SIMCAM_GROUP", "1", 1));
+#endif
+}
+
+static void
+setup(AcquireRuntime* runtime)
+{
+    auto dm = acquire_device_manager(runtime);
+    CHECK(runtime);
+    CHECK(dm);
+
+    AcquireProperties props = {};
+    OK(acquire_get_configuration(runtime, &props));
+
+    DEVOK(device_manager_select(dm,
+                                DeviceKind_Camera,
+                                SIZED("simulated: radial sin") - 1,
+                                &props.video[0].camera.identifier));
+    DEVOK(device_manager_select(dm,
+                                DeviceKind_Camera,
+                                SIZED("simulated: uniform random") - 1,
+                                &props.video[1].camera.identifier));
+    for (auto& video : props.video) {
+        DEVOK(device_manager_select(dm,
+                                    DeviceKind_Storage,
+                                    SIZED("trash") - 1,
+                                    &video.storage.identifier));
+    }
+
+    OK(acquire_configure(runtime, &props));
+
+    for (auto& video : props.video) {
+        video.camera.settings.binning = 1;
+        video.camera.settings.pixel_type = SampleType_u8;
+        video.camera.settings.shape = { .x = 256, .y = 256 };
+        video.camera.settings.exposure_time_us = 5000;
+        video.max_frame_count = 50;
+    }
+    // Different exposures. The group ticks at the longest one.
+    props.video[1].camera.settings.exposure_time_us = 2000;
+
+    OK(acquire_configure(runtime, &props));
+}
+
+static const VideoFrame*
+next(const VideoFrame* frame)
+{
+    const uint8_t* f = (const uint8_t*)frame;
+    return (const VideoFrame*)(f + frame->bytes_of_frame);
+}
+
+static bool
+is_running(AcquireRuntime* runtime)
+{
+    return acquire_get_state(runtime) == DeviceState_Running;
+}
+
+int
+main()
+{
+    float test_timeout_ms = 10000.0;
+    AcquireRuntime* runtime = 0;
+    try {
+        enable_camera_group();
+        runtime = acquire_init(reporter);
+        setup(runtime);
+        OK(acquire_start(runtime));
+
+        // hardware frame id -> hardware timestamp, per stream
+        std::map<uint64_t, uint64_t> timestamps[2];
+        struct clock t0;
+        clock_init(&t0);
+        while (is_running(runtime) && clock_toc_ms(&t0) < test_timeout_ms) {
+            for (uint32_t stream = 0; stream < 2; ++stream) {
+                VideoFrame *beg, *end;
+                OK(acquire_map_read(runtime, stream, &beg, &end));
+                for (const VideoFrame* cur = beg; cur < end; cur = next(cur))
+                    timestamps[stream][cur->hardware_frame_id] =
+                      cur->timestamps.hardware;
+                OK(acquire_unmap_read(
+                  runtime, stream, (uint8_t*)end - (uint8_t*)beg));
+            }
+            clock_sleep_ms(0, 10);
+        }
+        OK(acquire_stop(runtime));
+
+        int nmatched = 0;
+        for (const auto& [id, ts] : timestamps[0]) {
+            const auto it = timestamps[1].find(id);
+            if (it == timestamps[1].end())
+                continue;
+            EXPECT(it->second == ts,
+                   "Frame %llu: timestamps differ (%llu != %llu)",
+                   (unsigned long long)id,
+                   (unsigned long long)ts,
+                   (unsigned long long)it->second);
+            ++nmatched;
+        }
+        EXPECT(nmatched > 0, "Expected frames from both cameras.");
+        LOG("Compared %d frames", nmatched);
+
+        OK(acquire_shutdown(runtime));
+        LOG("OK");
+        return 0;
+    } catch (const std::runtime_error& e) {
+        ERR("Runtime error: %s", e.what());
+    } catch (...) {
+        ERR("Uncaught exception");
+    }
+    acquire_shutdown(runtime);
+    return 1;
+}
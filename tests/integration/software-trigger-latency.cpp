@@ -0,0 +1,288 @@
+//! Benchmark: Latency from `acquire_execute_trigger()` to the arrival of the
+//! triggered frame for a simulated camera, across trigger rates, exposure
+//! times and frame shapes. Not registered as a test; run it by hand.
+//!
+//! Triggers are fired on a fixed schedule. The camera stamps each frame with
+//! `clock_tic()` when it consumes a trigger, so a frame answers the newest
+//! trigger that had been set by its hardware timestamp. Triggers that arrive
+//! while another one is still pending are merged by the camera; they never
+//! get a frame of their own and are reported as lost, as are triggers still
+//! unanswered once the run has drained.
+//!
+//! Usage: software-trigger-latency [triggers per run] [camera name]
+
+#include "acquire.h"
+#include "device/hal/device.manager.h"
+#include "device/props/components.h"
+#include "device/props/device.h"
+#include "logger.h"
+#include "platform.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+void
+reporter(int is_error,
+         const char* file,
+         int line,
+         const char* function,
+         const char* msg)
+{
+    if (is_error)
+        fprintf(stderr, "ERROR %s(%d) - %s: %s\n", file, line, function, msg);
+}
+
+#define L (aq_logger)
+#define LOG(...) L(0, __FILE__, __LINE__, __FUNCTION__, __VA_ARGS__)
+#define ERR(...) L(1, __FILE__, __LINE__, __FUNCTION__, __VA_ARGS__)
+#define EXPECT(e, ...)                                                         \
+    do {                                                                       \
+        if (!(e)) {                                                            \
+            char buf[1 << 8] = { 0 };                                          \
+            ERR(__VA_ARGS__);                                                  \
+            snprintf(buf, sizeof(buf) - 1, __VA_ARGS__);                       \
+            throw std::runtime_error(buf);                                     \
+        }                                                                      \
+    } while (0)
+#define CHECK(e) EXPECT(e, "Expression evaluated as false: %s", #e)
+#define DEVOK(e) CHECK(Device_Ok == (e))
+#define OK(e) CHECK(AcquireStatus_Ok == (e))
+
+using Clock = std::chrono::steady_clock;
+
+struct Run
+{
+    double rate_hz;
+    float exposure_us;
+    uint32_t width, height;
+};
+
+struct Fired
+{
+    uint64_t before;     ///< `clock_tic()` just before the trigger
+    uint64_t after;      ///< `clock_tic()` once it has been set
+    Clock::time_point t; ///< same instant as `before`, for the latency
+    bool answered;
+};
+
+struct Result
+{
+    std::vector<double> latency_us; ///< one per answered trigger
+    int lost;
+};
+
+static int
+select_software_trigger_line(const AcquirePropertyMetadata* metadata)
+{
+    for (int i = 0; i < metadata->video[0].camera.digital_lines.line_count;
+         ++i) {
+        if (strcmp(metadata->video[0].camera.digital_lines.names[i],
+                   "software") == 0)
+            return i;
+    }
+    EXPECT(0, "Did not find software trigger line.");
+    return -1;
+}
+
+static void
+configure(AcquireRuntime* runtime,
+          const char* camera,
+          const Run& run,
+          int triggers)
+{
+    auto dm = acquire_device_manager(runtime);
+    CHECK(dm);
+
+    AcquireProperties props = {};
+    OK(acquire_get_configuration(runtime, &props));
+    DEVOK(device_manager_select(dm,
+                                DeviceKind_Camera,
+                                camera,
+                                strlen(camera),
+                                &props.video[0].camera.identifier));
+    DEVOK(device_manager_select(dm,
+                                DeviceKind_Storage,
+                                "trash",
+                                sizeof("trash") - 1,
+                                &props.video[0].storage.identifier));
+    OK(acquire_configure(runtime, &props));
+
+    AcquirePropertyMetadata metadata = { 0 };
+    OK(acquire_get_configuration_metadata(runtime, &metadata));
+
+    props.video[0].camera.settings.binning = 1;
+    props.video[0].camera.settings.pixel_type = SampleType_u8;
+    props.video[0].camera.settings.shape = { .x = run.width,
+                                             .y = run.height };
+    props.video[0].camera.settings.exposure_time_us = run.exposure_us;
+    props.video[0].camera.settings.input_triggers.frame_start = {
+        .enable = 1,
+        .line = (uint8_t)select_software_trigger_line(&metadata),
+        .kind = Signal_Input,
+        .edge = TriggerEdge_Rising,
+    };
+    props.video[0].max_frame_count = (uint64_t)triggers;
+    OK(acquire_configure(runtime, &props));
+}
+
+static const VideoFrame*
+next(const VideoFrame* frame)
+{
+    const uint8_t* f = (const uint8_t*)frame;
+    return (const VideoFrame*)(f + frame->bytes_of_frame);
+}
+
+/// Matches the frames that have arrived to the triggers fired so far.
+static void
+collect(AcquireRuntime* runtime,
+        std::vector<Fired>& fired,
+        Result& result)
+{
+    VideoFrame *beg, *end;
+    OK(acquire_map_read(runtime, 0, &beg, &end));
+    if (beg == end)
+        return;
+    const auto now = Clock::now();
+    for (const VideoFrame* cur = beg; cur < end; cur = next(cur)) {
+        // The newest trigger that was set before the camera consumed one.
+        // A trigger still being set at that time may or may not have been
+        // the one, so it's only chosen if there's nothing else.
+        const uint64_t hw = cur->timestamps.hardware;
+        Fired *match = 0, *maybe = 0;
+        for (auto& t : fired) {
+            if (!t.answered && t.after <= hw)
+                match = &t;
+            else if (!t.answered && t.before <= hw)
+                maybe = &t;
+        }
+        match = match ? match : maybe;
+        if (!match)
+            continue;
+        for (auto& t : fired)
+            if (!t.answered && t.before <= match->before)
+                t.answered = true; // older ones were merged into `match`
+        result.latency_us.push_back(
+          std::chrono::duration<double, std::micro>(now - match->t).count());
+    }
+    OK(acquire_unmap_read(runtime, 0, (uint8_t*)end - (uint8_t*)beg));
+}
+
+static Result
+measure(AcquireRuntime* runtime, const Run& run, int triggers)
+{
+    std::vector<Fired> fired;
+    fired.reserve(triggers);
+    Result result = {};
+
+    OK(acquire_start(runtime));
+    const auto period = std::chrono::duration_cast<Clock::duration>(
+      std::chrono::duration<double>(1.0 / run.rate_hz));
+    auto due = Clock::now() + period;
+    for (int i = 0; i < triggers; ++i) {
+        while (Clock::now() < due) {
+            collect(runtime, fired, result);
+            std::this_thread::yield();
+        }
+        Fired t = { clock_tic(0), 0, Clock::now(), false };
+        OK(acquire_execute_trigger(runtime, 0));
+        t.after = clock_tic(0);
+        fired.push_back(t);
+        due += period;
+    }
+
+    // Give the last trigger time to arrive.
+    const auto deadline =
+      Clock::now() + std::max<Clock::duration>(
+                       std::chrono::milliseconds(200),
+                       std::chrono::duration_cast<Clock::duration>(
+                         std::chrono::duration<double, std::micro>(
+                           10.0 * run.exposure_us)));
+    while (Clock::now() < deadline &&
+           std::any_of(fired.begin(), fired.end(), [](const Fired& t) {
+               return !t.answered;
+           })) {
+        collect(runtime, fired, result);
+        std::this_thread::yield();
+    }
+    OK(acquire_abort(runtime));
+
+    result.lost = (int)(fired.size() - result.latency_us.size());
+    return result;
+}
+
+/// @returns the `q` quantile of the sorted values, or 0 if there are none.
+static double
+quantile(const std::vector<double>& sorted, double q)
+{
+    if (sorted.empty())
+        return 0;
+    const size_t i = (size_t)(q * (double)(sorted.size() - 1) + 0.5);
+    return sorted[std::min(i, sorted.size() - 1)];
+}
+
+int
+main(int argc, char* argv[])
+{
+    const int triggers = argc > 1 ? atoi(argv[1]) : 500;
+    const char* camera = argc > 2 ? argv[2] : "simulated: empty";
+
+    const double rates_hz[] = { 100, 1000 };
+    const float exposures_us[] = { 100, 1000, 10000 };
+    const uint32_t sides[] = { 256, 1024, 2048 };
+
+    AcquireRuntime* runtime = 0;
+    try {
+        runtime = acquire_init(reporter);
+        CHECK(runtime);
+
+        printf("camera: %s, %d triggers per run, latency in us\n",
+               camera,
+               triggers);
+        printf("%8s %10s %11s %9s %9s %9s %9s %6s\n",
+               "rate Hz",
+               "exposure",
+               "shape",
+               "p50",
+               "p99",
+               "p99.9",
+               "max",
+               "lost");
+        for (double rate : rates_hz) {
+            for (float exposure : exposures_us) {
+                for (uint32_t side : sides) {
+                    const Run run = { rate, exposure, side, side };
+                    configure(runtime, camera, run, triggers);
+                    Result r = measure(runtime, run, triggers);
+                    std::sort(r.latency_us.begin(), r.latency_us.end());
+
+                    char shape[32];
+                    snprintf(shape, sizeof(shape), "%ux%u", side, side);
+                    printf("%8.0f %10.0f %11s %9.1f %9.1f %9.1f %9.1f %6d\n",
+                           rate,
+                           exposure,
+                           shape,
+                           quantile(r.latency_us, 0.5),
+                           quantile(r.latency_us, 0.99),
+                           quantile(r.latency_us, 0.999),
+                           r.latency_us.empty() ? 0 : r.latency_us.back(),
+                           r.lost);
+                    fflush(stdout);
+                }
+            }
+        }
+        OK(acquire_shutdown(runtime));
+        return 0;
+    } catch (const std::runtime_error& e) {
+        ERR("Runtime error: %s", e.what());
+    } catch (...) {
+        ERR("Uncaught exception");
+    }
+    acquire_shutdown(runtime);
+    return 1;
+}